@@ -19,6 +19,11 @@ class ClientOptions {
     std::string cxl_devdax_path;
     size_t cxl_memory_size;
     int prealloc_fiber_num = 2;  // Number of pre-allocated boost coroutine
+
+    // The msgq poller spins for `idle_spin_us` when idle, then sleeps until the daemon rings it,
+    // for at most `idle_sleep_us` (0 to always spin)
+    uint64_t idle_spin_us = 100;
+    uint64_t idle_sleep_us = 0;
 };
 
 class DaemonOptions {
@@ -41,10 +46,43 @@ class DaemonOptions {
     size_t swap_zone_size = 64ul << 20;
 
     int prealloc_fiber_num = 32;     // Number of pre-allocated boost coroutine
+    int background_task_limit = 4;   // Background tasks (e.g. swaps) running at once per worker
     float heat_half_life_us = 1000;  // Page Heat decay coefficient
     float hot_swap_watermark = 3;    // Page Swap heat threshold
 
+    // Adjust the swap heat threshold of each rack online, within the bounds below
+    bool adaptive_swap_watermark = false;
+    float min_hot_swap_watermark = 1;
+    float max_hot_swap_watermark = 64;
+    uint64_t swap_back_window_us = 100000;  // A swapped page leaving within it is a swap-back
+
     int cm_qp_num = 2;  // Number of QPs connected to other daemons
+
+    // RDMA writes to other daemons up to this size are sent inline, 0 to never inline. The QPs
+    // are given a smaller size if the device can't afford it.
+    uint32_t rdma_max_inline = 256;
+
+    // Number of data plane threads, each serving a shard of pages. Daemons of a cluster need the
+    // same number.
+    int worker_num = 1;
+
+    // Ref invalidations to the same daemon within the window are sent as one request
+    uint64_t del_page_ref_batch_window_us = 10;
+
+    // Base page ids leased from the master at once, so that allocating base pages on the rack
+    // doesn't call the master. A new lease is asked for in background when fewer than half are
+    // left. 0 to always allocate through the master.
+    size_t page_id_lease_size = 4096;
+
+    // How long the owner of a remote page learned from the directory is trusted, during which its
+    // ref is asked from the owner directly instead of through the master
+    uint64_t dir_lease_us = 1000000;
+
+    // Workers spin for `idle_spin_us` when idle, then sleep until a client rings their msgq lane,
+    // for at most `idle_sleep_us` (0 to always spin). The bound is the extra latency of erpc
+    // requests and fiber timers on an idle worker.
+    uint64_t idle_spin_us = 100;
+    uint64_t idle_sleep_us = 0;
 };
 
 class MasterOptions {
@@ -54,6 +92,12 @@ class MasterOptions {
 
     size_t max_cluster_mac_num = 1000;  // Maximum number of connected nodes in the cluster
     int prealloc_fiber_num = 16;        // Number of pre-allocated boost coroutine
+    int shard_num = 1;                  // Number of threads serving the page directory
+
+    // How `allocPage` spreads the pages a rack can't hold, "weighted" or "first_fit"
+    std::string placement_policy = "weighted";
+    // Racks are near those of the same `rack_id / rack_group_size`, 0 if all racks are near
+    size_t rack_group_size = 0;
 };
 
 }  // namespace rcmp
\ No newline at end of file
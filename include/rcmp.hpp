@@ -11,6 +11,16 @@ namespace rcmp {
 using GAddr = uintptr_t;
 constexpr static GAddr GNullPtr = 0;
 
+/**
+ * @brief Page size of an `AllocPage` allocation, carried in the returned `GAddr`. A large page is
+ * tracked, referenced and swapped as one unit.
+ */
+enum PageSizeClass : uint8_t {
+    PAGE_4K = 0,
+    PAGE_64K = 1,
+    PAGE_2M = 2,
+};
+
 /**
  * @brief Memory Pool Client Context
  */
@@ -85,13 +95,14 @@ class PoolContext {
      * the proximity of the cabinet where the client is located. A failed request returns
      * `GNullPtr`.
      *
-     * @param size
+     * @param count Number of pages
+     * @param page_class Page size of each page
      * @return GAddr
      */
-    GAddr AllocPage(size_t count);
+    GAddr AllocPage(size_t count, PageSizeClass page_class = PAGE_4K);
 
     /**
-     * @brief Free consecutive memory pages.
+     * @brief Free consecutive memory pages, of the page size they were allocated with.
      *
      * @param gaddr
      * @return Status
@@ -1,81 +1,126 @@
 #include "allocator.hpp"
 
+#include <thread>
+
 #include "log.hpp"
 #include "utils.hpp"
 
+constexpr static size_t word_bits = 64;
+
 IDGenerator::id_t IDGenerator::Gen() {
-    if (UNLIKELY(m_size + 1 > m_bset.size())) {
+    if (UNLIKELY(size() + 1 > capacity())) {
         return -1;
     }
 
+    size_t mag_idx = localMagazineIndex();
+    Magazine *mag = tryLockMagazine(mag_idx);
+    if (mag != nullptr) {
+        std::lock_guard<SpinMutex> mag_guard(mag->lck, std::adopt_lock);
+        if (mag->cnt > 0) {
+            id_t id = mag->ids[--mag->cnt];
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            debugTake(id, 1);
+            return id;
+        }
+        mag_idx = mag - m_magazines;
+    }
+
     std::lock_guard<Mutex> guard(m_lck);
 
-    size_t cur_tmp = m_gen_cur;
-    do {
-        size_t cur = m_gen_cur;
-        m_gen_cur = (m_gen_cur + 1) % m_bset.size();
-        auto ref = m_bset[cur];
-        if (ref == false) {
-            ref.flip();
-            m_size += 1;
-            return cur;
+    id_t id = genLocked();
+    if (id == -1) {
+        // The rest of free ids may be cached in magazines
+        drainMagazinesLocked();
+        id = genLocked();
+        if (id == -1) {
+            return -1;
+        }
+    } else {
+        id_t batch[magazine_batch];
+        size_t n = 0;
+        while (n < magazine_batch) {
+            id_t b = genLocked();
+            if (b == -1) {
+                break;
+            }
+            batch[n++] = b;
         }
-    } while (cur_tmp != m_gen_cur);
 
-    return -1;
+        // Push in descending order, so that ids are handed out ascending. A busy magazine isn't
+        // waited for, the batch goes back to the bitmap instead.
+        Magazine &refill = m_magazines[mag_idx];
+        if (refill.lck.try_lock()) {
+            std::lock_guard<SpinMutex> mag_guard(refill.lck, std::adopt_lock);
+            while (n > 0 && refill.cnt < magazine_cap) {
+                refill.ids[refill.cnt++] = batch[--n];
+            }
+        }
+        while (n > 0) {
+            recycleLocked(batch[--n]);
+        }
+    }
+
+    m_size.fetch_add(1, std::memory_order_relaxed);
+    debugTake(id, 1);
+    return id;
 }
 
-IDGenerator::id_t IDGenerator::MultiGen(size_t count) {
-    if (count == 1) {
+IDGenerator::id_t IDGenerator::MultiGen(size_t count, size_t align) {
+    DLOG_ASSERT((align & (align - 1)) == 0, "IDGenerator align %lu isn't power of 2", align);
+
+    if (count == 1 && align == 1) {
         return Gen();
     }
 
-    if (UNLIKELY(m_size + count > m_bset.size())) {
+    if (UNLIKELY(size() + count > capacity())) {
         return -1;
     }
 
     std::lock_guard<Mutex> guard(m_lck);
 
-    id_t start = -1;
-    size_t c = 0;
-    size_t cur_tmp = m_gen_cur;
-
-    do {
-        size_t cur = m_gen_cur;
-        m_gen_cur = (m_gen_cur + 1) % m_bset.size();
-        if (m_bset[cur] == false) {
-            if (c == 0) {
-                start = cur;
-            }
-            ++c;
-            if (c == count) {
-                for (size_t k = start; k < start + count; ++k) {
-                    m_bset[k].flip();
-                }
-                m_size += count;
-                return start;
-            }
-        } else {
-            c = 0;
+    id_t start = multiGenLocked(count, align);
+    if (start == -1) {
+        drainMagazinesLocked();
+        start = multiGenLocked(count, align);
+        if (start == -1) {
+            return -1;
         }
+    }
 
-        // Preventing Loopback
-        if (m_gen_cur == 0) {
-            c = 0;
-        }
-
-    } while (cur_tmp != m_gen_cur);
-
-    return -1;
+    m_size.fetch_add(count, std::memory_order_relaxed);
+    debugTake(start, count);
+    return start;
 }
 
 void IDGenerator::Recycle(IDGenerator::id_t id) {
-    DLOG_ASSERT(m_bset[id] == true, "IDGenerator double recycle");
+    DLOG_ASSERT(id < capacity(), "IDGenerator recycle invalid id %lu", id);
+    debugGiveBack(id, 1);
+
+    m_size.fetch_sub(1, std::memory_order_relaxed);
+
+    size_t mag_idx = localMagazineIndex();
+    Magazine *mag = tryLockMagazine(mag_idx);
+    if (mag != nullptr) {
+        std::lock_guard<SpinMutex> mag_guard(mag->lck, std::adopt_lock);
+        if (mag->cnt < magazine_cap) {
+            mag->ids[mag->cnt++] = id;
+            return;
+        }
+        mag_idx = mag - m_magazines;
+    }
 
     std::lock_guard<Mutex> guard(m_lck);
 
-    m_bset[id].flip();
-    m_size -= 1;
+    recycleLocked(id);
+
+    // The magazine is full, return a batch to the bitmap
+    Magazine &flush = m_magazines[mag_idx];
+    if (flush.lck.try_lock()) {
+        std::lock_guard<SpinMutex> mag_guard(flush.lck, std::adopt_lock);
+        while (flush.cnt > magazine_cap - magazine_batch) {
+            recycleLocked(flush.ids[--flush.cnt]);
+        }
+    }
 }
 
 void IDGenerator::MultiRecycle(id_t id, size_t count) {
@@ -84,17 +129,246 @@ void IDGenerator::MultiRecycle(id_t id, size_t count) {
         return;
     }
 
+    debugGiveBack(id, count);
+
     std::lock_guard<Mutex> guard(m_lck);
 
-    while (count--) {
-        DLOG_ASSERT(m_bset[id] == true, "IDGenerator double recycle");
-        m_bset[id].flip();
-        id++;
+    for (size_t i = 0; i < count; ++i) {
+        recycleLocked(id + i);
     }
-    m_size -= count;
+    m_size.fetch_sub(count, std::memory_order_relaxed);
 }
 
 void IDGenerator::Expand(size_t n) {
     std::lock_guard<Mutex> guard(m_lck);
-    m_bset.insert(m_bset.end(), n, false);
+
+    size_t old_capacity = capacity();
+    size_t new_capacity = old_capacity + n;
+    m_free_bits.resize(div_ceil(new_capacity, word_bits), 0);
+    m_summary_bits.resize(div_ceil(m_free_bits.size(), word_bits), 0);
+
+    for (id_t id = old_capacity; id < new_capacity; ++id) {
+        size_t w = id / word_bits;
+        m_free_bits[w] |= 1ul << (id % word_bits);
+        m_summary_bits[w / word_bits] |= 1ul << (w % word_bits);
+    }
+
+#ifndef NDEBUG
+    {
+        std::lock_guard<SpinMutex> dbg_guard(m_dbg_lck);
+        m_dbg_taken.resize(new_capacity, false);
+    }
+#endif
+
+    m_capacity.store(new_capacity, std::memory_order_relaxed);
+}
+
+size_t IDGenerator::FreeRunNum(size_t count) {
+    std::lock_guard<Mutex> guard(m_lck);
+
+    size_t num = 0;
+    size_t run = 0;
+    for (uint64_t bits : m_free_bits) {
+        if (bits == ~0ul) {
+            run += word_bits;
+            continue;
+        }
+        // Walk the alternating stretches of free and used bits of the word
+        size_t i = 0;
+        while (i < word_bits) {
+            uint64_t rest = bits >> i;
+            if (rest & 1) {
+                size_t ones = __builtin_ctzll(~rest);
+                run += ones;
+                i += ones;
+            } else {
+                num += run / count;
+                run = 0;
+                i += (rest == 0) ? word_bits - i : __builtin_ctzll(rest);
+            }
+        }
+    }
+    return num + run / count;
+}
+
+size_t IDGenerator::localMagazineIndex() {
+    thread_local size_t mag_idx =
+        std::hash<std::thread::id>()(std::this_thread::get_id()) % magazine_num;
+    return mag_idx;
+}
+
+IDGenerator::Magazine *IDGenerator::tryLockMagazine(size_t mag_idx) {
+    // A magazine held by a preempted thread is skipped instead of spun on
+    for (size_t i = 0; i < magazine_num; ++i) {
+        Magazine &mag = m_magazines[(mag_idx + i) % magazine_num];
+        if (mag.lck.try_lock()) {
+            return &mag;
+        }
+    }
+    return nullptr;
+}
+
+void IDGenerator::debugTake(id_t id, size_t count) {
+#ifndef NDEBUG
+    std::lock_guard<SpinMutex> dbg_guard(m_dbg_lck);
+    for (size_t i = 0; i < count; ++i) {
+        DLOG_ASSERT(!m_dbg_taken[id + i], "IDGenerator hands out used id %lu", id + i);
+        m_dbg_taken[id + i] = true;
+    }
+#endif
+}
+
+void IDGenerator::debugGiveBack(id_t id, size_t count) {
+#ifndef NDEBUG
+    std::lock_guard<SpinMutex> dbg_guard(m_dbg_lck);
+    for (size_t i = 0; i < count; ++i) {
+        DLOG_ASSERT(m_dbg_taken[id + i], "IDGenerator double recycle %lu", id + i);
+        m_dbg_taken[id + i] = false;
+    }
+#endif
+}
+
+size_t IDGenerator::nextFreeWordLocked(size_t from) const {
+    size_t word_num = m_free_bits.size();
+    while (from < word_num) {
+        uint64_t sw = m_summary_bits[from / word_bits] & (~0ul << (from % word_bits));
+        if (sw != 0) {
+            return (from / word_bits) * word_bits + __builtin_ctzll(sw);
+        }
+        from = (from / word_bits + 1) * word_bits;
+    }
+    return word_num;
+}
+
+IDGenerator::id_t IDGenerator::genLocked() {
+    size_t word_num = m_free_bits.size();
+
+    size_t w = nextFreeWordLocked(m_gen_cur);
+    if (w == word_num) {
+        w = nextFreeWordLocked(0);
+        if (w == word_num) {
+            return -1;
+        }
+    }
+
+    uint64_t &bits = m_free_bits[w];
+    id_t id = w * word_bits + __builtin_ctzll(bits);
+    bits &= bits - 1;
+    if (bits == 0) {
+        m_summary_bits[w / word_bits] &= ~(1ul << (w % word_bits));
+    }
+    m_gen_cur = w;
+    return id;
+}
+
+IDGenerator::id_t IDGenerator::multiGenLocked(size_t count, size_t align) {
+    size_t word_num = m_free_bits.size();
+
+    // Bits at aligned positions of a word
+    uint64_t align_mask = 0;
+    for (size_t i = 0; i < word_bits; i += align) {
+        align_mask |= 1ul << i;
+    }
+    // Whether the free run [start, start + run) holds the aligned ids
+    auto fits = [&](id_t start, size_t run) {
+        return run >= align_ceil(start, align) - start + count;
+    };
+
+    // Start from the cursor, then from the beginning. A run never wraps around.
+    for (size_t from : {m_gen_cur, (size_t)0}) {
+        size_t run = 0;
+        id_t start = 0;
+        size_t w = from;
+        while (w < word_num) {
+            uint64_t bits = m_free_bits[w];
+            if (bits == 0) {
+                run = 0;
+                w = nextFreeWordLocked(w + 1);
+                continue;
+            }
+
+            if (bits == ~0ul) {
+                if (run == 0) {
+                    start = w * word_bits;
+                }
+                run += word_bits;
+                if (fits(start, run)) {
+                    start = align_ceil(start, align);
+                    allocRangeLocked(start, count);
+                    return start;
+                }
+                ++w;
+                continue;
+            }
+
+            // The run from previous words ends in the low free bits of this word
+            size_t low = __builtin_ctzll(~bits);
+            if (run > 0 && fits(start, run + low)) {
+                start = align_ceil(start, align);
+                allocRangeLocked(start, count);
+                return start;
+            }
+
+            // A run within this word: bit i of `m` survives if bits [i, i + count) are all free
+            if (count < word_bits) {
+                uint64_t m = bits;
+                size_t len = 1;
+                while (len < count) {
+                    size_t shift = std::min(len, count - len);
+                    m &= m >> shift;
+                    len += shift;
+                }
+                m &= (align <= word_bits || w * word_bits % align == 0) ? align_mask : 0;
+                if (m != 0) {
+                    start = w * word_bits + __builtin_ctzll(m);
+                    allocRangeLocked(start, count);
+                    return start;
+                }
+            }
+
+            // A new run starts from the high free bits of this word
+            size_t high = __builtin_clzll(~bits);
+            run = high;
+            start = (w + 1) * word_bits - high;
+            ++w;
+        }
+    }
+
+    return -1;
+}
+
+void IDGenerator::recycleLocked(id_t id) {
+    size_t w = id / word_bits;
+    uint64_t bit = 1ul << (id % word_bits);
+    DLOG_ASSERT((m_free_bits[w] & bit) == 0, "IDGenerator double recycle");
+
+    m_free_bits[w] |= bit;
+    m_summary_bits[w / word_bits] |= 1ul << (w % word_bits);
+}
+
+void IDGenerator::allocRangeLocked(id_t start, size_t count) {
+    id_t end = start + count;
+    for (id_t id = start; id < end;) {
+        size_t w = id / word_bits;
+        size_t lo = id % word_bits;
+        size_t hi = std::min<size_t>(word_bits, lo + (end - id));
+        uint64_t mask = (hi == word_bits ? ~0ul : (1ul << hi) - 1) & (~0ul << lo);
+        DLOG_ASSERT((m_free_bits[w] & mask) == mask, "IDGenerator allocates used id");
+
+        m_free_bits[w] &= ~mask;
+        if (m_free_bits[w] == 0) {
+            m_summary_bits[w / word_bits] &= ~(1ul << (w % word_bits));
+        }
+        id += hi - lo;
+    }
+    m_gen_cur = (end - 1) / word_bits;
+}
+
+void IDGenerator::drainMagazinesLocked() {
+    for (auto &mag : m_magazines) {
+        std::lock_guard<SpinMutex> mag_guard(mag.lck);
+        while (mag.cnt > 0) {
+            recycleLocked(mag.ids[--mag.cnt]);
+        }
+    }
 }
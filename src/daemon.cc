@@ -1,3 +1,4 @@
+#include <array>
 #include <boost/fiber/algo/round_robin.hpp>
 #include <boost/fiber/operations.hpp>
 #include <chrono>
@@ -5,6 +6,8 @@
 #include <future>
 #include <memory>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "cmdline.h"
 #include "common.hpp"
@@ -29,7 +32,8 @@ void DaemonContext::InitCXLPool() {
         cxl_open_simulate(m_options.cxl_devdax_path, m_options.cxl_memory_size, &m_cxl_devdax_fd);
 
     cxl_memory_init(m_cxl_format, m_cxl_memory_addr, m_options.cxl_memory_size,
-                    (m_options.max_client_limit + 1) * MsgQueueManager::RING_ELEM_SIZE);
+                    (m_options.max_client_limit + m_options.worker_num) *
+                        MsgQueueManager::RING_ELEM_SIZE);
 
     /* 2. Confirm the number of pages */
     m_page_table.total_page_num = m_cxl_format.super_block->page_data_zone_size / page_size;
@@ -44,6 +48,22 @@ void DaemonContext::InitCXLPool() {
 
     m_page_table.current_used_page_num = 0;
 
+    /* 3. Place the page slot table in the reserve zone */
+    DLOG_ASSERT(m_page_table.total_page_num * sizeof(PageSlot) <=
+                    m_cxl_format.super_block->reserve_heap_size,
+                "The reserve zone can't hold the page slot table");
+    m_page_table.page_slot_table = reinterpret_cast<PageSlot *>(m_cxl_format.reserve_zone_addr);
+    memset(m_page_table.page_slot_table, 0, m_page_table.total_page_num * sizeof(PageSlot));
+
+    /* 4. Place the stream bounce regions of the clients after it */
+    size_t slot_table_size = align_ceil(m_page_table.total_page_num * sizeof(PageSlot), page_size);
+    DLOG_ASSERT(slot_table_size + m_options.max_client_limit * stream_bounce_slot_num *
+                                      sizeof(rpc_daemon::StreamBounceSlot) <=
+                    m_cxl_format.super_block->reserve_heap_size,
+                "The reserve zone can't hold the stream bounce regions");
+    m_stream_zone_addr = reinterpret_cast<void *>(
+        reinterpret_cast<uintptr_t>(m_cxl_format.reserve_zone_addr) + slot_table_size);
+
     DLOG("total_page_num: %lu", m_page_table.total_page_num);
     DLOG("max_swap_page_num: %lu", m_page_table.max_swap_page_num);
     DLOG("max_data_page_num: %lu", m_page_table.max_data_page_num);
@@ -69,25 +89,31 @@ void DaemonContext::InitRPCNexus() {
     m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_daemon::tryDelPage)::rpc_type,
                                         bind_erpc_func<false>(rpc_daemon::tryDelPage));
 
-    erpc::SMHandlerWrap smhw;
-    smhw.set_empty();
-
-    erpc::IBRpcWrap rpc(m_erpc_ctx.nexus.get(), this, 0, smhw);
-    m_erpc_ctx.rpc_set.push_back(std::move(rpc));
-    DLOG_ASSERT(m_erpc_ctx.rpc_set.size() == 1);
-
-    /* 2. init msgq */
+    /* 2. init msgq, the public msgq is the lane of worker 0 */
     m_msgq_manager.nexus = std::make_unique<msgq::MsgQueueNexus>(m_cxl_format.msgq_zone_start_addr);
     m_msgq_manager.start_addr = m_cxl_format.msgq_zone_start_addr;
     m_msgq_manager.msgq_allocator =
         std::make_unique<SingleAllocator<MsgQueueManager::RING_ELEM_SIZE>>(
             m_cxl_format.super_block->msgq_zone_size);
 
-    msgq::MsgQueue *public_q = m_msgq_manager.allocQueue();
-    DLOG_ASSERT(public_q == m_msgq_manager.nexus->GetPublicMsgQ());
+    DLOG_ASSERT(m_options.worker_num > 0 && (size_t)m_options.worker_num <= max_daemon_worker_num,
+                "Invalid worker num %d", m_options.worker_num);
+    for (int i = 0; i < m_options.worker_num; ++i) {
+        msgq::MsgQueue *lane_q = m_msgq_manager.allocQueue();
+        DLOG_ASSERT(i != 0 || lane_q == m_msgq_manager.nexus->GetPublicMsgQ());
+
+        auto worker = std::make_unique<DaemonWorker>();
+        worker->worker_id = i;
+        worker->msgq_rpc =
+            std::make_unique<msgq::MsgQueueRPC>(m_msgq_manager.nexus.get(), nullptr, lane_q, this);
+        worker->idler = std::make_unique<msgq::MsgQueueIdler>(lane_q, m_options.idle_spin_us,
+                                                              m_options.idle_sleep_us);
+        worker->fiber_pool.SetWakeFn([idler = worker->idler.get()]() { idler->wake(); });
+        m_workers.push_back(std::move(worker));
+    }
 
-    m_msgq_manager.rpc = std::make_unique<msgq::MsgQueueRPC>(
-        m_msgq_manager.nexus.get(), nullptr, m_msgq_manager.nexus->GetPublicMsgQ(), this);
+    // The main thread runs worker 0
+    bindWorker(0);
 
     /* 3. bind rpc function */
     m_msgq_manager.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_daemon::joinRack)::rpc_type,
@@ -114,6 +140,7 @@ void DaemonContext::InitRPCNexus() {
 
 void DaemonContext::InitRDMARC() {
     rdma_rc::RDMAEnv::init();
+    rdma_rc::RDMAConnection::MAX_INLINE_DATA = m_options.rdma_max_inline;
 
     rdma_rc::RDMAConnection::register_connect_hook([this](rdma_cm_id *cm_id, void *param_) {
         auto param = reinterpret_cast<RDMARCConnectParam *>(param_);
@@ -127,18 +154,20 @@ void DaemonContext::InitRDMARC() {
             case DAEMON:
             case CXL_DAEMON: {
                 DaemonToDaemonConnection *conn = dynamic_cast<DaemonToDaemonConnection *>(conn_);
-                if (conn->rdma_conn == nullptr) {
-                    conn->rdma_conn.reset(new rdma_rc::RDMAConnection());
-                    conn->rdma_conn->m_conn_type_ = rdma_rc::RDMAConnection::SENDER;
+                auto &worker_rdma_conn = conn->rdma_conns[param->worker_id];
+                if (worker_rdma_conn == nullptr) {
+                    worker_rdma_conn.reset(new rdma_rc::RDMAConnection());
+                    worker_rdma_conn->m_conn_type_ = rdma_rc::RDMAConnection::SENDER;
+                    worker_rdma_conn->m_engine_ = &m_workers[param->worker_id]->rdma_engine;
                 }
 
-                rdma_rc::RDMAConnection *rdma_conn = conn->rdma_conn.get();
+                rdma_rc::RDMAConnection *rdma_conn = worker_rdma_conn.get();
                 rdma_conn->m_cm_ids_.push_back(cm_id);
                 cm_id->context = rdma_conn;
                 rdma_rc::RDMAConnection::m_init_last_subconnection_(rdma_conn);
 
-                DLOG("[RDMA_RC] Get New Connect: %s",
-                     conn->rdma_conn->get_peer_addr().first.c_str());
+                DLOG("[RDMA_RC] Get New Connect: %s, worker %lu",
+                     rdma_conn->get_peer_addr().first.c_str(), param->worker_id);
             } break;
         }
     });
@@ -149,6 +178,10 @@ void DaemonContext::InitRDMARC() {
     });
 
     m_listen_conn.listen(m_options.daemon_ip);
+    if (!m_listen_conn.m_atomic_glob_) {
+        // The seal of a page slot races with the pins of remote CASes
+        DLOG_WARNING("No global rdma atomicity, direct io CAS may be lost on page migration");
+    }
 }
 
 void DaemonContext::ConnectWithMaster() {
@@ -156,10 +189,10 @@ void DaemonContext::ConnectWithMaster() {
 
     auto &master_connection = m_conn_manager.GetMasterConnection();
 
-    master_connection.erpc_conn =
-        std::make_unique<ErpcClient>(rpc, m_options.master_ip, m_options.master_port);
+    master_connection.ip = m_options.master_ip;
+    master_connection.port = m_options.master_port;
 
-    auto fu = master_connection.erpc_conn->call<SpinPromise>(
+    auto fu = master_connection.GetErpcConn().call<SpinPromise>(
         rpc_master::joinDaemon, {
                                     .ip = m_options.daemon_ip,
                                     .port = m_options.daemon_port,
@@ -174,9 +207,8 @@ void DaemonContext::ConnectWithMaster() {
 
     auto &resp = fu.get();
 
-    master_connection.ip = m_options.master_ip;
-    master_connection.port = m_options.master_port;
     master_connection.master_id = resp.master_mac_id;
+    master_connection.shard_num = resp.shard_num;
     m_daemon_id = resp.daemon_mac_id;
 
     DLOG_ASSERT(master_connection.master_id == master_id, "Fail to get master id");
@@ -189,32 +221,60 @@ void DaemonContext::ConnectWithMaster() {
     param.mac_id = m_daemon_id;
     param.role = CXL_DAEMON;
 
-    master_connection.rdma_conn = std::make_unique<rdma_rc::RDMAConnection>();
-    master_connection.rdma_conn->connect(peer_ip, peer_port, &param, sizeof(param));
+    for (int w = 0; w < m_options.worker_num; ++w) {
+        param.worker_id = w;
+        master_connection.rdma_conns[w] = std::make_unique<rdma_rc::RDMAConnection>();
+        master_connection.rdma_conns[w]->m_engine_ = &m_workers[w]->rdma_engine;
+        master_connection.rdma_conns[w]->connect(peer_ip, peer_port, &param, sizeof(param));
+    }
+
+    master_connection.dir_slot_table_addr = resp.dir_slot_table_addr;
+    master_connection.dir_slot_table_rkey = resp.dir_slot_table_rkey;
+    if (master_connection.dir_slot_table_rkey != 0) {
+        for (auto &worker : m_workers) {
+            worker->dir_read_mr =
+                m_listen_conn.register_memory(DirSlotRead::per_worker_num * sizeof(DirSlotRead));
+            DLOG_ASSERT(worker->dir_read_mr != nullptr, "Can't register dir read buffers");
+            DirSlotRead *bufs = static_cast<DirSlotRead *>(worker->dir_read_mr->addr);
+            for (size_t i = 0; i < DirSlotRead::per_worker_num; ++i) {
+                worker->dir_read_bufs.push_back(&bufs[i]);
+            }
+        }
+    }
 
     DLOG("Connection with master OK, my id is %d", m_daemon_id);
 
+    uintptr_t page_slot_table_addr = reinterpret_cast<uintptr_t>(m_page_table.page_slot_table);
+    uint32_t page_slot_table_rkey = GetMR(m_page_table.page_slot_table)->rkey;
+    uintptr_t page_data_start_addr = reinterpret_cast<uintptr_t>(m_cxl_format.page_data_start_addr);
+
     for (size_t i = 0; i < resp.other_rack_count; ++i) {
         auto &rack_info = resp.other_rack_infos[i];
 
         // Establish erpc and RDMA RC with this daemon
         DaemonToDaemonConnection *dd_conn = new DaemonToDaemonConnection();
-        dd_conn->erpc_conn = std::make_unique<ErpcClient>(rpc, rack_info.daemon_ipv4.get_string(),
-                                                          rack_info.daemon_erpc_port);
         dd_conn->daemon_id = rack_info.daemon_id;
         dd_conn->rack_id = rack_info.rack_id;
         dd_conn->ip = rack_info.daemon_ipv4.get_string();
         dd_conn->port = rack_info.daemon_erpc_port;
+        dd_conn->swap_stats = m_swap_ctrl.AddRack(dd_conn->rack_id);
         DLOG("First connect daemon: %u", dd_conn->daemon_id);
 
-        auto fu = dd_conn->erpc_conn->call<SpinPromise>(rpc_daemon::crossRackConnect,
-                                                        {
-                                                            .mac_id = m_daemon_id,
-                                                            .ip = m_options.daemon_ip,
-                                                            .port = m_options.daemon_port,
-                                                            .rack_id = m_options.rack_id,
-                                                            .conn_mac_id = rack_info.daemon_id,
-                                                        });
+        auto fu = dd_conn->GetErpcConn().call<SpinPromise>(rpc_daemon::crossRackConnect,
+                                                           {
+                                                               .mac_id = m_daemon_id,
+                                                               .ip = m_options.daemon_ip,
+                                                               .port = m_options.daemon_port,
+                                                               .rack_id = m_options.rack_id,
+                                                               .conn_mac_id = rack_info.daemon_id,
+                                                               .page_slot_table_addr =
+                                                                   page_slot_table_addr,
+                                                               .page_slot_table_rkey =
+                                                                   page_slot_table_rkey,
+                                                               .page_data_start_addr =
+                                                                   page_data_start_addr,
+                                                               .worker_num = m_options.worker_num,
+                                                           });
 
         while (fu.wait_for(1ns) == std::future_status::timeout) {
             rpc.run_event_loop_once();
@@ -222,6 +282,11 @@ void DaemonContext::ConnectWithMaster() {
 
         auto &conn_resp = fu.get();
 
+        DLOG_ASSERT(conn_resp.worker_num == m_options.worker_num,
+                    "Daemon %d runs %d workers, but %d here", dd_conn->daemon_id,
+                    conn_resp.worker_num, m_options.worker_num);
+        dd_conn->peer_worker_num = conn_resp.worker_num;
+
         std::string peer_ip = dd_conn->ip;
         uint16_t peer_port(conn_resp.rdma_port);
 
@@ -231,9 +296,17 @@ void DaemonContext::ConnectWithMaster() {
 
         DLOG("Connect with daemon %d [%s] ...", dd_conn->daemon_id, peer_ip.c_str());
 
-        dd_conn->rdma_conn = std::make_unique<rdma_rc::RDMAConnection>();
-        for (int i = 0; i < m_options.cm_qp_num; ++i) {
-            dd_conn->rdma_conn->connect(peer_ip, peer_port, &param, sizeof(param));
+        dd_conn->page_slot_table_addr = conn_resp.page_slot_table_addr;
+        dd_conn->page_slot_table_rkey = conn_resp.page_slot_table_rkey;
+        dd_conn->page_data_start_addr = conn_resp.page_data_start_addr;
+
+        for (int w = 0; w < m_options.worker_num; ++w) {
+            param.worker_id = w;
+            dd_conn->rdma_conns[w] = std::make_unique<rdma_rc::RDMAConnection>();
+            dd_conn->rdma_conns[w]->m_engine_ = &m_workers[w]->rdma_engine;
+            for (int i = 0; i < m_options.cm_qp_num; ++i) {
+                dd_conn->rdma_conns[w]->connect(peer_ip, peer_port, &param, sizeof(param));
+            }
         }
         m_conn_manager.AddConnection(dd_conn->daemon_id, dd_conn);
 
@@ -261,20 +334,73 @@ void DaemonContext::RegisterCXLMR() {
 }
 
 void DaemonContext::InitFiberPool() {
-    boost::fibers::use_scheduling_algorithm<priority_scheduler>();
-    m_fiber_pool.AddFiber(m_options.prealloc_fiber_num);
+    boost::fibers::use_scheduling_algorithm<priority_scheduler>(&GetFiberPool().GetRunQueueStats());
+    GetFiberPool().SetBackgroundLimit(m_options.background_task_limit);
+    GetFiberPool().AddFiber(m_options.prealloc_fiber_num);
+}
+
+bool DaemonContext::RDMARCPoll() {
+    rdma_rc::CompletionEngine &engine = GetWorker().rdma_engine;
+    engine.Poll();
+    return engine.Busy();
 }
 
-void DaemonContext::RDMARCPoll() {
-    for (auto &conn : m_conn_manager.m_other_daemon_connect_table) {
-        if (conn->rdma_conn != nullptr && conn->rdma_conn->m_inflight_count_ > 0) {
-            conn->rdma_conn->m_poll_conn_sd_wr_();
+void DaemonContext::InitWorkers() {
+    // Idle workers steal background tasks from each other
+    for (auto &worker : m_workers) {
+        std::vector<FiberPool *> victims;
+        for (auto &victim : m_workers) {
+            if (victim != worker) {
+                victims.push_back(&victim->fiber_pool);
+            }
         }
+        worker->fiber_pool.SetStealVictims(std::move(victims));
+    }
+
+    // Rpcs of all workers are up before any peer connects to them
+    Barrier bound(m_workers.size());
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        m_workers[i]->thread = std::thread([this, i, &bound]() {
+            bindWorker(i);
+            bound.wait();
+            InitFiberPool();
+
+            while (true) {
+                WorkerPollOnce();
+                boost::this_fiber::yield();
+            }
+        });
     }
+    bound.wait();
+}
+
+void DaemonContext::WorkerPollOnce() {
+    DaemonWorker &worker = GetWorker();
+    uint32_t msg_num = worker.msgq_rpc->run_event_loop_once();
+    worker.rpc->run_event_loop_once();
+    bool rdma_inflight = RDMARCPoll();
+    // Tasks may be enqueued by other workers while all fibers are blocked
+    worker.fiber_pool.GrowIfBusy();
+    bool stolen = worker.fiber_pool.TrySteal();
+
+    auto pool_busy = [&worker]() { return !worker.fiber_pool.IsIdle(); };
+    worker.idler->poll_done(msg_num > 0 || rdma_inflight || stolen || pool_busy(), pool_busy);
+}
+
+void DaemonContext::bindWorker(size_t worker_id) {
+    DaemonWorker &worker = *m_workers[worker_id];
+
+    // An erpc Rpc is owned by the thread creating it
+    erpc::SMHandlerWrap smhw;
+    smhw.set_empty();
+    worker.rpc = std::make_unique<erpc::IBRpcWrap>(m_erpc_ctx.nexus.get(), this, worker_id, smhw);
+
+    m_local_worker = &worker;
 }
 
 void DaemonContext::InitHeatDecayCache() {
     FreqStats::init_exp_decays(m_options.heat_half_life_us);
+    m_swap_ctrl.Init(m_options);
 }
 
 int main(int argc, char *argv[]) {
@@ -288,6 +414,18 @@ int main(int argc, char *argv[]) {
     cmd.add<size_t>("cxl_memory_size");
     cmd.add<float>("heat_half_life_us");
     cmd.add<size_t>("hot_swap_watermark");
+    cmd.add("adaptive_swap_watermark");
+    cmd.add<float>("min_hot_swap_watermark", 0, "", false, 1);
+    cmd.add<float>("max_hot_swap_watermark", 0, "", false, 64);
+    cmd.add<uint64_t>("swap_back_window_us", 0, "", false, 100000);
+    cmd.add<uint64_t>("del_page_ref_batch_window_us", 0, "", false, 10);
+    cmd.add<uint64_t>("dir_lease_us", 0, "", false, 1000000);
+    cmd.add<int>("worker_num", 0, "", false, 1);
+    cmd.add<int>("background_task_limit", 0, "", false, 4);
+    cmd.add<uint64_t>("idle_spin_us", 0, "", false, 100);
+    cmd.add<uint64_t>("idle_sleep_us", 0, "", false, 0);
+    cmd.add<uint32_t>("rdma_max_inline", 0, "", false, 256);
+    cmd.add<size_t>("page_id_lease_size", 0, "", false, 4096);
     bool ret = cmd.parse(argc, argv);
     DLOG_ASSERT(ret);
 
@@ -303,8 +441,20 @@ int main(int argc, char *argv[]) {
     options.swap_zone_size = 100ul << 20;
     options.max_client_limit = 32;
     options.prealloc_fiber_num = 64;
+    options.background_task_limit = cmd.get<int>("background_task_limit");
     options.heat_half_life_us = cmd.get<float>("heat_half_life_us");
     options.hot_swap_watermark = cmd.get<size_t>("hot_swap_watermark");
+    options.adaptive_swap_watermark = cmd.exist("adaptive_swap_watermark");
+    options.min_hot_swap_watermark = cmd.get<float>("min_hot_swap_watermark");
+    options.max_hot_swap_watermark = cmd.get<float>("max_hot_swap_watermark");
+    options.swap_back_window_us = cmd.get<uint64_t>("swap_back_window_us");
+    options.del_page_ref_batch_window_us = cmd.get<uint64_t>("del_page_ref_batch_window_us");
+    options.dir_lease_us = cmd.get<uint64_t>("dir_lease_us");
+    options.worker_num = cmd.get<int>("worker_num");
+    options.idle_spin_us = cmd.get<uint64_t>("idle_spin_us");
+    options.idle_sleep_us = cmd.get<uint64_t>("idle_sleep_us");
+    options.rdma_max_inline = cmd.get<uint32_t>("rdma_max_inline");
+    options.page_id_lease_size = cmd.get<size_t>("page_id_lease_size");
 
     DaemonContext &daemon_context = DaemonContext::getInstance();
     daemon_context.m_options = options;
@@ -315,6 +465,7 @@ int main(int argc, char *argv[]) {
     daemon_context.RegisterCXLMR();
     daemon_context.InitFiberPool();
     daemon_context.InitHeatDecayCache();
+    daemon_context.InitWorkers();
     daemon_context.ConnectWithMaster();
 
     std::thread stat_worker = std::thread([&daemon_context]() {
@@ -330,6 +481,7 @@ int main(int argc, char *argv[]) {
         auto msgq_send_time = daemon_context.m_msgq_manager.nexus->m_stats.send_time;
         auto msgq_recv_bytes = daemon_context.m_msgq_manager.nexus->m_stats.recv_bytes;
         auto msgq_recv_time = daemon_context.m_msgq_manager.nexus->m_stats.recv_time;
+        std::unordered_map<rack_id_t, uint64_t> rack_dio_bytes;
 
         while (true) {
             std::this_thread::sleep_for(5s);
@@ -383,14 +535,101 @@ int main(int argc, char *argv[]) {
                 1.0 * diff_msgq_recv_time / (diff_msgq_recv_io + 1) / 1e3,
                 1.0 * diff_msgq_send_bytes / (diff_msgq_send_time + 1) / 1024 / 1024 * 1e9,
                 1.0 * diff_msgq_recv_bytes / (diff_msgq_recv_time + 1) / 1024 / 1024 * 1e9);
+            for (auto &worker : daemon_context.m_workers) {
+                auto &rq = worker->fiber_pool.GetRunQueueStats();
+                DLOG("worker %lu run queue: ready high: %lu, ready low: %lu, pinned: %lu, "
+                     "stealable: %lu, stolen: %lu, fibers: %lu",
+                     worker->worker_id, rq.ready_high.load(), rq.ready_low.load(),
+                     rq.pinned_tasks.load(), rq.stealable_tasks.load(), rq.stolen_tasks.load(),
+                     rq.fibers.load());
+
+                auto &idle = worker->idler->m_stats;
+                DLOG("worker %lu idle: sleeps: %lu, doorbell wakeups: %lu, slept: %f ms, wakeup "
+                     "lat: %f us",
+                     worker->worker_id, idle.sleeps.load(), idle.doorbell_wakeups.load(),
+                     idle.sleep_time.load() / 1e6,
+                     1.0 * idle.wakeup_time.load() / (idle.doorbell_wakeups.load() + 1) / 1e3);
+
+                auto &cq = worker->rdma_engine.GetStats();
+                DLOG("worker %lu rdma cq: polls: %lu, cqes: %lu, avg batch: %f, max batch: %lu, "
+                     "completion lat: %f us, wrs: %lu, inline wrs: %lu",
+                     worker->worker_id, cq.polls.load(), cq.cqes.load(),
+                     1.0 * cq.cqes.load() / (cq.polls.load() + 1), cq.max_batch.load(),
+                     1.0 * cq.latency_ns.load() / (cq.completions.load() + 1) / 1e3,
+                     cq.wrs.load(), cq.inline_wrs.load());
+
+                const char *class_names[task_class_num] = {"critical", "normal", "background"};
+                for (size_t c = 0; c < task_class_num; ++c) {
+                    Histogram hist = worker->fiber_pool.TakeLatencyHistogram(TaskClass(c));
+                    if (hist.getTotalCount() == 0) {
+                        continue;
+                    }
+                    DLOG("worker %lu %s tasks: %d, latency p50: %f us, p99: %f us",
+                         worker->worker_id, class_names[c], hist.getTotalCount(),
+                         hist.getPercentile(50), hist.getPercentile(99));
+                }
+            }
+
+            // The master weighs racks by the direct io they serve when placing new pages, and
+            // sizes the large pages of this rack by its free runs of frames
+            std::vector<rpc_master::RackLoad> loads;
+            daemon_context.m_swap_ctrl.ForEachRackTraffic([&](rack_id_t rack_id,
+                                                              uint64_t dio_bytes) {
+                uint64_t &last = rack_dio_bytes[rack_id];
+                if (dio_bytes != last) {
+                    loads.push_back({.rack_id = rack_id, .dio_bytes = dio_bytes - last});
+                    last = dio_bytes;
+                }
+            });
+            std::array<size_t, page_class_num> free_run_num;
+            for (size_t c = 0; c < page_class_num; ++c) {
+                free_run_num[c] = daemon_context.m_page_table.FreePageNum(
+                    static_cast<rcmp::PageSizeClass>(c));
+            }
+            daemon_context.m_workers[0]->fiber_pool.EnqueueTask(
+                TaskClass::Background,
+                [&daemon_context, loads = std::move(loads), free_run_num]() {
+                    size_t leased_page_num = daemon_context.m_page_id_lease.Remaining();
+                    size_t rack_num = loads.size();
+                    auto fu = daemon_context.m_conn_manager.GetMasterConnection()
+                                  .GetErpcConn()
+                                  .call<CortPromise>(
+                                      rpc_master::reportRackLoad,
+                                      sizeof(rpc_master::ReportRackLoadRequest) +
+                                          rack_num * sizeof(rpc_master::RackLoad),
+                                      [&](rpc_master::ReportRackLoadRequest *req_buf) {
+                                          req_buf->mac_id = daemon_context.m_daemon_id;
+                                          memcpy(req_buf->free_run_num, free_run_num.data(),
+                                                 sizeof(req_buf->free_run_num));
+                                          req_buf->leased_page_num = leased_page_num;
+                                          req_buf->rack_num = rack_num;
+                                          memcpy(req_buf->racks, loads.data(),
+                                                 rack_num * sizeof(rpc_master::RackLoad));
+                                      });
+                    if (!fu.get().return_lease) {
+                        return;
+                    }
+
+                    // The master needs the capacity, return the page ids not allocated yet
+                    for (auto &block : daemon_context.m_page_id_lease.TakeAll()) {
+                        daemon_context.m_conn_manager.GetMasterConnection()
+                            .GetErpcConn()
+                            .call<CortPromise>(rpc_master::returnPageID,
+                                               {
+                                                   .mac_id = daemon_context.m_daemon_id,
+                                                   .start_page_id = block.first,
+                                                   .count = block.second,
+                                               })
+                            .get();
+                    }
+                });
+
+            daemon_context.m_swap_ctrl.Adjust();
         }
     });
 
     while (true) {
-        daemon_context.m_msgq_manager.rpc->run_event_loop_once();
-        daemon_context.GetErpc().run_event_loop_once();
-        daemon_context.RDMARCPoll();
-
+        daemon_context.WorkerPollOnce();
         boost::this_fiber::yield();
     }
 
@@ -0,0 +1,71 @@
+#include "epoch.hpp"
+
+#include <boost/fiber/operations.hpp>
+#include <thread>
+#include <vector>
+
+EpochManager::EpochManager() {
+    for (auto &e : m_reserved_epochs) {
+        e.store(idle_epoch, std::memory_order_relaxed);
+    }
+}
+
+EpochManager::Guard::Guard(EpochManager &epoch_mgr) : m_epoch_mgr(epoch_mgr) {
+    thread_local size_t slot_hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    while (true) {
+        for (size_t i = 0; i < max_guard_num; ++i) {
+            m_slot = (slot_hint + i) % max_guard_num;
+            uint64_t expected = idle_epoch;
+            uint64_t epoch = m_epoch_mgr.m_epoch.load(std::memory_order_seq_cst);
+            // An object unlinked before the reservation can't be reached by this guard, so a
+            // stale epoch is only conservative.
+            if (m_epoch_mgr.m_reserved_epochs[m_slot].compare_exchange_strong(
+                    expected, epoch, std::memory_order_seq_cst)) {
+                slot_hint = m_slot + 1;
+                return;
+            }
+        }
+        // All slots are taken by guards, wait for one of them to leave
+        boost::this_fiber::yield();
+    }
+}
+
+EpochManager::Guard::~Guard() {
+    m_epoch_mgr.m_reserved_epochs[m_slot].store(idle_epoch, std::memory_order_release);
+}
+
+void EpochManager::Retire(std::function<void()> reclaim_fn) {
+    bool need_reclaim;
+    {
+        std::lock_guard<SpinMutex> lck(m_retire_lck);
+        m_retired.push_back({m_epoch.load(std::memory_order_seq_cst), std::move(reclaim_fn)});
+        need_reclaim = m_retired.size() >= reclaim_batch_num;
+    }
+
+    if (need_reclaim) {
+        Reclaim();
+    }
+}
+
+void EpochManager::Reclaim() {
+    // Objects retired from now on may be reached by guards reserved after their slots are read
+    // below, so only those retired before the new epoch are considered.
+    uint64_t min_epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    for (auto &e : m_reserved_epochs) {
+        min_epoch = std::min(min_epoch, e.load(std::memory_order_seq_cst));
+    }
+
+    std::vector<std::function<void()>> reclaim_fns;
+    {
+        std::lock_guard<SpinMutex> lck(m_retire_lck);
+        while (!m_retired.empty() && m_retired.front().first < min_epoch) {
+            reclaim_fns.push_back(std::move(m_retired.front().second));
+            m_retired.pop_front();
+        }
+    }
+
+    for (auto &fn : reclaim_fns) {
+        fn();
+    }
+}
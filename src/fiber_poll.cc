@@ -38,7 +38,8 @@ void priority_props::set_high_priority() { set_priority(100); }
 
 //[priority_scheduler
 
-priority_scheduler::priority_scheduler() : rqueue_high_(), rqueue_low_() {}
+priority_scheduler::priority_scheduler(RunQueueStats* stats)
+    : rqueue_high_(), rqueue_low_(), stats_(stats) {}
 
 // For a subclass of algorithm_with_properties<>, it's important to
 // override the correct awakened() overload.
@@ -57,8 +58,10 @@ void priority_scheduler::awakened(boost::fibers::context* ctx, priority_props& p
     // in the queue with LOWER priority, and insert before that one.
     if (ctx_priority == 1) {
         rqueue_low_.push_back(*ctx);
+        if (stats_) stats_->ready_low.fetch_add(1, std::memory_order_relaxed);
     } else {
         rqueue_high_.push_back(*ctx);
+        if (stats_) stats_->ready_high.fetch_add(1, std::memory_order_relaxed);
     }
 }
 
@@ -70,9 +73,11 @@ boost::fibers::context* priority_scheduler::pick_next() noexcept {
     if (!rqueue_high_.empty()) {
         ctx = &rqueue_high_.front();
         rqueue_high_.pop_front();
+        if (stats_) stats_->ready_high.fetch_sub(1, std::memory_order_relaxed);
     } else if (!rqueue_low_.empty()) {
         ctx = &rqueue_low_.front();
         rqueue_low_.pop_front();
+        if (stats_) stats_->ready_low.fetch_sub(1, std::memory_order_relaxed);
     } else {
         ctx = nullptr;
     }
@@ -112,7 +117,18 @@ void priority_scheduler::property_change(boost::fibers::context* ctx,
         return;
     }
 
-    // Found ctx: unlink it
+    // Found ctx: unlink it. A ready fiber rarely changes priority, so scanning for its queue
+    // to keep the stats right is fine.
+    if (stats_) {
+        bool in_low = false;
+        for (auto& c : rqueue_low_) {
+            if (&c == ctx) {
+                in_low = true;
+                break;
+            }
+        }
+        (in_low ? stats_->ready_low : stats_->ready_high).fetch_sub(1, std::memory_order_relaxed);
+    }
     ctx->ready_unlink();
 
     // Here we know that ctx was in our ready queue, but we've unlinked
@@ -142,33 +158,20 @@ void priority_scheduler::notify() noexcept {
     cnd_.notify_all();
 }
 
-FiberPool::~FiberPool() { EraseAll(); }
+FiberPool::FiberPool() {
+    for (size_t c = 0; c < task_class_num; ++c) {
+        latency_hists_.emplace_back(1000, 0, max_latency_us);
+    }
+}
 
-size_t FiberPool::FiberSize() const { return fibers_.size(); }
+FiberPool::~FiberPool() { EraseAll(); }
 
-void FiberPool::AddFiber(size_t n) { AddFiber(fr_queue_, n); }
+size_t FiberPool::FiberSize() const { return stats_.fibers.load(std::memory_order_relaxed); }
 
-void FiberPool::AddFiber(WorkerFiberTaskQueue& my_queue, size_t n) {
-    std::unique_lock<boost::fibers::mutex> lock(my_queue.fiber_mutex_);
+void FiberPool::AddFiber(size_t n) {
+    owner_ = std::this_thread::get_id();
     for (std::size_t i = 0; i < n; ++i) {
-        auto fiber = boost::fibers::fiber([this, &my_queue] {
-            while (!fiber_stop_) {
-                std::function<void()> task;
-                {
-                    std::unique_lock<boost::fibers::mutex> lock(my_queue.fiber_mutex_);
-                    my_queue.fiber_cond_.wait(lock, [this, &my_queue] {
-                        return !my_queue.fiber_tasks_.empty() || fiber_stop_;
-                    });
-                    if (fiber_stop_) return;
-                    if (my_queue.fiber_tasks_.empty()) continue;
-                    task = std::move(my_queue.fiber_tasks_.front());
-                    my_queue.fiber_tasks_.pop();
-                }
-                task();
-            }
-        });
-        fiber.properties<priority_props>().set_low_priority();
-        fibers_.emplace_back(std::move(fiber));
+        spawnFiber(false);
     }
 }
 
@@ -183,4 +186,229 @@ void FiberPool::EraseAll() {
         fiber.join();
     }
     fibers_.clear();
+    // The elastic fibers are detached
+    while (stats_.fibers.load() > 0) {
+        boost::this_fiber::yield();
+    }
+
+    // Drop the stealable tasks left, as the pinned ones
+    QueuedTask* task;
+    while (stealable_tasks_.TryPop(&task)) {
+        delete task;
+    }
+}
+
+void FiberPool::SetStealVictims(std::vector<FiberPool*> victims) { victims_ = std::move(victims); }
+
+bool FiberPool::TrySteal() {
+    if (victims_.empty() || idle_fiber_num_.load(std::memory_order_relaxed) == 0 ||
+        !stealable_tasks_.empty() || stats_.pinned_tasks.load(std::memory_order_relaxed) != 0 ||
+        background_running_ >= background_limit_) {
+        return false;
+    }
+
+    for (size_t i = 0; i < victims_.size(); ++i) {
+        FiberPool* victim = victims_[(steal_cur_ + i) % victims_.size()];
+        QueuedTask* task;
+        if (!victim->stealable_tasks_.TrySteal(&task)) {
+            continue;
+        }
+        victim->stats_.stealable_tasks.fetch_sub(1, std::memory_order_relaxed);
+
+        // Keep stealing from the same victim while it has work
+        steal_cur_ = (steal_cur_ + i) % victims_.size();
+        stats_.stolen_tasks.fetch_add(1, std::memory_order_relaxed);
+        if (!stealable_tasks_.TryPush(task)) {
+            EnqueueTask(TaskClass::Background, [task]() {
+                std::unique_ptr<QueuedTask> t(task);
+                t->fn();
+            });
+            return true;
+        }
+        stats_.stealable_tasks.fetch_add(1, std::memory_order_relaxed);
+        notifyTask();
+        return true;
+    }
+    steal_cur_ = (steal_cur_ + 1) % victims_.size();
+    return false;
+}
+
+bool FiberPool::IsIdle() const {
+    return stats_.pinned_tasks.load(std::memory_order_relaxed) == 0 &&
+           stats_.stealable_tasks.load(std::memory_order_relaxed) == 0 &&
+           stats_.ready_high.load(std::memory_order_relaxed) == 0 &&
+           stats_.ready_low.load(std::memory_order_relaxed) == 0 &&
+           idle_fiber_num_.load(std::memory_order_relaxed) ==
+               stats_.fibers.load(std::memory_order_relaxed);
+}
+
+void FiberPool::GrowIfBusy() {
+    if (std::this_thread::get_id() != owner_ || idle_fiber_num_.load() != 0 ||
+        stats_.pinned_tasks.load(std::memory_order_relaxed) == 0 ||
+        stats_.fibers.load(std::memory_order_relaxed) >= max_fiber_num) {
+        return;
+    }
+    spawnFiber(true);
+}
+
+Histogram FiberPool::TakeLatencyHistogram(TaskClass cls) {
+    std::lock_guard<SpinMutex> guard(latency_lck_);
+    Histogram hist = latency_hists_[static_cast<size_t>(cls)];
+    latency_hists_[static_cast<size_t>(cls)].clear();
+    return hist;
+}
+
+void FiberPool::spawnFiber(bool elastic) {
+    stats_.fibers.fetch_add(1, std::memory_order_relaxed);
+    auto fiber = boost::fibers::fiber([this, elastic] {
+        QueuedTask task;
+        size_t cls;
+        while (waitTask(task, cls, elastic)) {
+            task.fn();
+            finishTask(task, cls);
+        }
+        stats_.fibers.fetch_sub(1, std::memory_order_relaxed);
+    });
+    fiber.properties<priority_props>().set_low_priority();
+    if (elastic) {
+        fiber.detach();
+    } else {
+        fibers_.emplace_back(std::move(fiber));
+    }
+}
+
+bool FiberPool::waitTask(QueuedTask& task, size_t& cls, bool elastic) {
+    while (!fiber_stop_) {
+        if (takeTask(task, cls)) {
+            return true;
+        }
+
+        std::unique_lock<boost::fibers::mutex> lock(fr_queue_.fiber_mutex_);
+        // Counted before checking for tasks, paired with the fence in `notifyTask`
+        idle_fiber_num_.fetch_add(1);
+        auto pred = [this] { return hasTask() || fiber_stop_; };
+        bool woken = true;
+        if (elastic) {
+            woken = fr_queue_.fiber_cond_.wait_for(lock, fiber_idle_timeout, pred);
+        } else {
+            fr_queue_.fiber_cond_.wait(lock, pred);
+        }
+        idle_fiber_num_.fetch_sub(1);
+        if (!woken) {
+            return false;  // Idle for long, shrink
+        }
+    }
+    return false;
+}
+
+bool FiberPool::takeTask(QueuedTask& task, size_t& cls) {
+    // Each round picks up to the weight of tasks of every class, higher classes first. A round
+    // ends early when the classes with credits left have no task.
+    for (int round = 0; round < 2; ++round) {
+        for (size_t c = 0; c < task_class_num; ++c) {
+            if (class_credits_[c] > 0 && takeClassTask(c, task)) {
+                --class_credits_[c];
+                cls = c;
+                return true;
+            }
+        }
+        std::copy(task_class_weights, task_class_weights + task_class_num, class_credits_);
+    }
+    return false;
+}
+
+bool FiberPool::takeClassTask(size_t cls, QueuedTask& task) {
+    bool background = cls == static_cast<size_t>(TaskClass::Background);
+    if (background && background_running_ >= background_limit_) {
+        return false;
+    }
+
+    size_t& head = local_head_[cls];
+    size_t& num = local_num_[cls];
+    if (head == num) {
+        head = 0;
+        num = task_rings_[cls].TryDequeue(local_tasks_[cls], local_tasks_[cls] + task_batch);
+    }
+    if (head < num) {
+        task = std::move(local_tasks_[cls][head++]);
+        stats_.pinned_tasks.fetch_sub(1, std::memory_order_relaxed);
+        if (head < num) {
+            // Hand the rest of the batch to other fibers
+            if (idle_fiber_num_.load() > 0) {
+                fr_queue_.fiber_cond_.notify_one();
+            } else {
+                GrowIfBusy();
+            }
+        }
+        background_running_ += background;
+        return true;
+    }
+
+    if (overflow_task_num_[cls].load(std::memory_order_relaxed) > 0) {
+        std::unique_lock<boost::fibers::mutex> lock(fr_queue_.fiber_mutex_);
+        auto& overflow = fr_queue_.fiber_tasks_[cls];
+        if (!overflow.empty()) {
+            task = std::move(overflow.front());
+            overflow.pop();
+            overflow_task_num_[cls].fetch_sub(1, std::memory_order_relaxed);
+            stats_.pinned_tasks.fetch_sub(1, std::memory_order_relaxed);
+            background_running_ += background;
+            return true;
+        }
+    }
+
+    QueuedTask* stealable_task;
+    if (background && stealable_tasks_.TryPop(&stealable_task)) {
+        stats_.stealable_tasks.fetch_sub(1, std::memory_order_relaxed);
+        task = std::move(*stealable_task);
+        delete stealable_task;
+        ++background_running_;
+        return true;
+    }
+    return false;
+}
+
+bool FiberPool::hasTask() const {
+    for (size_t c = 0; c < task_class_num; ++c) {
+        if (hasClassTask(c)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FiberPool::hasClassTask(size_t cls) const {
+    if (cls == static_cast<size_t>(TaskClass::Background)) {
+        if (background_running_ >= background_limit_) {
+            return false;
+        }
+        if (!stealable_tasks_.empty()) {
+            return true;
+        }
+    }
+    return local_head_[cls] < local_num_[cls] || !task_rings_[cls].empty() ||
+           !fr_queue_.fiber_tasks_[cls].empty();
+}
+
+void FiberPool::notifyTask() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (idle_fiber_num_.load() > 0) {
+        // Lock for the waiters between checking for tasks and sleeping
+        { std::unique_lock<boost::fibers::mutex> lock(fr_queue_.fiber_mutex_); }
+        fr_queue_.fiber_cond_.notify_one();
+    }
+    if (wake_fn_ && std::this_thread::get_id() != owner_) {
+        wake_fn_();
+    }
+}
+
+void FiberPool::finishTask(QueuedTask& task, size_t cls) {
+    task.fn.reset();
+    if (cls == static_cast<size_t>(TaskClass::Background)) {
+        --background_running_;
+    }
+
+    double latency_us = (getNsTimestamp() - task.enqueue_ns) / 1e3;
+    std::lock_guard<SpinMutex> guard(latency_lck_);
+    latency_hists_[cls].addValue(std::min(latency_us, max_latency_us));
 }
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <vector>
+
+#include "config.hpp"
 #include "lock.hpp"
 #include "log.hpp"
 #include "utils.hpp"
@@ -44,23 +48,39 @@ class ObjectPoolAllocator {
 template <typename T>
 thread_local typename ObjectPoolAllocator<T>::raw_ptr_vector ObjectPoolAllocator<T>::pool;
 
+/**
+ * @brief Generator of dense ids in `[0, capacity)`.
+ *
+ * Free ids are kept in a two-level bitmap: a bit per id, and a summary bit per 64-id word that has
+ * any free id, so a scan skips exhausted words 64 at a time. Single ids are served by a few
+ * magazines shared by threads, each caching ids taken from the bitmap in batches, which keeps
+ * `Gen` and `Recycle` off the global lock in the common case. A magazine locked by another thread
+ * is skipped rather than spun on, since its holder may be preempted. Ids cached in magazines are
+ * drained back to the bitmap when the bitmap alone can't serve a request.
+ */
 class IDGenerator {
    public:
     using id_t = uint64_t;
 
-    IDGenerator() : m_gen_cur(0), m_size(0) {}
+    IDGenerator() : m_size(0), m_capacity(0), m_gen_cur(0) {}
 
     bool empty() const { return size() == 0; }
 
     bool full() const { return size() == capacity(); }
 
-    size_t size() const { return m_size; }
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
 
-    size_t capacity() const { return m_bset.size(); }
+    size_t capacity() const { return m_capacity.load(std::memory_order_relaxed); }
 
     id_t Gen();
 
-    id_t MultiGen(size_t count);
+    /**
+     * @brief Generate `count` contiguous ids, starting at a multiple of `align`.
+     *
+     * @param align A power of two
+     * @return id_t The first id, or -1 if no such run exists
+     */
+    id_t MultiGen(size_t count, size_t align = 1);
 
     void Recycle(id_t id);
 
@@ -68,11 +88,52 @@ class IDGenerator {
 
     void Expand(size_t n);
 
+    /**
+     * @brief Count the disjoint runs of `count` free ids. Ids cached in magazines are not counted,
+     * so it may fall short by a few.
+     */
+    size_t FreeRunNum(size_t count);
+
    private:
-    size_t m_size;
-    size_t m_gen_cur;
-    std::vector<bool> m_bset;
+    constexpr static size_t magazine_num = 8;
+    constexpr static size_t magazine_cap = 32;
+    constexpr static size_t magazine_batch = magazine_cap / 2;
+
+    struct CACHE_ALIGN Magazine {
+        SpinMutex lck;
+        size_t cnt = 0;
+        id_t ids[magazine_cap];
+    };
+
+    size_t localMagazineIndex();
+    // The first magazine from `mag_idx` that can be locked without waiting, or nullptr
+    Magazine *tryLockMagazine(size_t mag_idx);
+
+    // Track the ids handed out in debug builds, as magazines hide double recycles from the bitmap
+    void debugTake(id_t id, size_t count);
+    void debugGiveBack(id_t id, size_t count);
+
+    // The following must be called with `m_lck` held.
+    size_t nextFreeWordLocked(size_t from) const;
+    id_t genLocked();
+    id_t multiGenLocked(size_t count, size_t align);
+    void recycleLocked(id_t id);
+    void allocRangeLocked(id_t start, size_t count);
+    void drainMagazinesLocked();
+
+    std::atomic<size_t> m_size;      // Ids handed out, excluding those cached in magazines
+    std::atomic<size_t> m_capacity;  // Number of ids
+    size_t m_gen_cur;                // Word to start scanning from
+    std::vector<uint64_t> m_free_bits;
+    std::vector<uint64_t> m_summary_bits;
     Mutex m_lck;
+
+    Magazine m_magazines[magazine_num];
+
+#ifndef NDEBUG
+    SpinMutex m_dbg_lck;
+    std::vector<bool> m_dbg_taken;
+#endif
 };
 
 template <size_t UNIT_SZ>
@@ -80,16 +141,23 @@ class SingleAllocator : private IDGenerator {
    public:
     SingleAllocator(size_t total_size) { Expand(total_size / UNIT_SZ); }
 
+    /**
+     * @brief Allocate `n` contiguous units.
+     */
     uintptr_t allocate(size_t n) {
-        DLOG_ASSERT(n == 1, "Must allocate 1 element");
-        IDGenerator::id_t id = Gen();
+        IDGenerator::id_t id = MultiGen(n);
         if (UNLIKELY(id == -1)) {
             return -1;
         }
         return id * UNIT_SZ;
     }
 
-    void deallocate(uintptr_t ptr, size_t n) { Recycle(ptr / UNIT_SZ); }
+    void deallocate(uintptr_t ptr, size_t n) { MultiRecycle(ptr / UNIT_SZ, n); }
+
+    /**
+     * @brief Number of `n` contiguous units that can be allocated at once.
+     */
+    size_t FreeRunNum(size_t n) { return IDGenerator::FreeRunNum(n); }
 };
 
 template <size_t SZ, size_t BucketNum = 4>
@@ -142,12 +210,16 @@ class RingArena {
         DLOG_ASSERT(bc < BucketNum, "Out Of Memory");
 
         Block& b = m_bs[bc];
+        uint32_t off = reinterpret_cast<uint8_t*>(p) - b.b;
         atomic_po_val_t opv = b.pv.load(std::memory_order_acquire), npv;
         do {
             DLOG_ASSERT(opv.cnt != 0);
             npv = opv;
             if ((--npv.cnt) == 0) {
                 npv.pos = 0;
+            } else if (off + n == opv.pos) {
+                // The last allocated one, give its space back without waiting for the whole block
+                npv.pos = off;
             }
         } while (!b.pv.compare_exchange_weak(opv, npv, std::memory_order_release,
                                              std::memory_order_acquire));
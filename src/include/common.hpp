@@ -25,28 +25,54 @@ union GAddrCombineUnion {
     struct {
         offset_t off : offset_bits;
         page_id_t p : page_id_bits;
+        uint64_t cls : page_class_bits;
     };
     rcmp::GAddr gaddr;
 };
 
+constexpr static size_t page_class_num = 3;
+
+/**
+ * @brief Number of base pages (page ids and page frames) spanned by a page of `page_class`.
+ */
+inline static size_t GetPageUnits(rcmp::PageSizeClass page_class) {
+    constexpr static size_t page_unit_shift[] = {0, 4, 9};
+    return 1ul << page_unit_shift[page_class];
+}
+inline static size_t GetPageSize(rcmp::PageSizeClass page_class) {
+    return page_size * GetPageUnits(page_class);
+}
+
+inline static rcmp::PageSizeClass GetPageClass(rcmp::GAddr gaddr) {
+    GAddrCombineUnion u;
+    u.gaddr = gaddr;
+    return static_cast<rcmp::PageSizeClass>(u.cls);
+}
+/**
+ * @brief The page id of the page containing `gaddr`, which is the first base page id of a large
+ * page.
+ */
 inline static page_id_t GetPageID(rcmp::GAddr gaddr) {
     GAddrCombineUnion u;
     u.gaddr = gaddr;
-    return u.p;
+    return u.p & ~(GetPageUnits(GetPageClass(gaddr)) - 1);
 }
 inline static offset_t GetPageOffset(rcmp::GAddr gaddr) {
     GAddrCombineUnion u;
     u.gaddr = gaddr;
-    return u.off;
+    return ((u.p & (GetPageUnits(GetPageClass(gaddr)) - 1)) << offset_bits) | u.off;
 }
-inline static rcmp::GAddr GetGAddr(page_id_t page_id, offset_t offset) {
+inline static rcmp::GAddr GetGAddr(page_id_t page_id, offset_t offset,
+                                   rcmp::PageSizeClass page_class = rcmp::PAGE_4K) {
     GAddrCombineUnion u;
-    u.p = page_id;
-    u.off = offset;
+    u.p = page_id + (offset >> offset_bits);
+    u.off = offset & ((1ul << offset_bits) - 1);
+    u.cls = page_class;
     return u.gaddr;
 }
 
 struct RDMARCConnectParam {
     SystemRole role;
     mac_id_t mac_id;
+    size_t worker_id = 0;  // The daemon worker using the connection
 };
\ No newline at end of file
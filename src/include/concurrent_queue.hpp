@@ -3,7 +3,9 @@
 #include <atomic>
 #include <cstddef>
 #include <random>
+#include <type_traits>
 
+#include "config.hpp"
 #include "utils.hpp"
 
 enum ConcurrentQueueProducerMode { SP, MP };
@@ -59,6 +61,13 @@ class ConcurrentQueue<T, SZ, ConcurrentQueueProducerMode::MP, ConcurrentQueueCon
 
     size_t capacity() const { return SZ; }
 
+    size_t size() const {
+        return (uint32_t)(m_prod_tail.load(std::memory_order_acquire).pos -
+                          m_cons_tail.load(std::memory_order_acquire));
+    }
+
+    bool empty() const { return size() == 0; }
+
     void ForceEnqueue(T n) {
         atomic_po_val_t h, oh, nh;
 
@@ -150,6 +159,14 @@ class ConcurrentQueue<T, SZ, ConcurrentQueueProducerMode::MP, ConcurrentQueueCon
 
     size_t capacity() const { return SZ; }
 
+    size_t size() const {
+        uint32_t t = m_prod_tail.load(std::memory_order_acquire).pos;
+        uint32_t h = m_cons_head.load(std::memory_order_acquire).pos;
+        return (int32_t)(t - h) > 0 ? t - h : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
     void ForceEnqueue(T n) {
         atomic_po_val_t h, oh, nh;
 
@@ -173,7 +190,12 @@ class ConcurrentQueue<T, SZ, ConcurrentQueueProducerMode::MP, ConcurrentQueueCon
                                                     std::memory_order_acquire));
     }
 
-    bool TryEnqueue(T n) {
+    bool TryEnqueue(T n) { return TryMoveEnqueue(n); }
+
+    /**
+     * @brief Enqueue by moving from `n`, which is left untouched if the queue is full.
+     */
+    bool TryMoveEnqueue(T &n) {
         atomic_po_val_t h, oh, nh;
 
         oh = m_prod_head.load(std::memory_order_acquire);
@@ -230,7 +252,7 @@ class ConcurrentQueue<T, SZ, ConcurrentQueueProducerMode::MP, ConcurrentQueueCon
         } while (!m_cons_tail.compare_exchange_weak(ot, nt, std::memory_order_release,
                                                     std::memory_order_acquire));
 
-        return true;
+        return l;
     }
 
    private:
@@ -242,3 +264,93 @@ class ConcurrentQueue<T, SZ, ConcurrentQueueProducerMode::MP, ConcurrentQueueCon
     atomic_po_val_t m_cons_head;
     atomic_po_val_t m_cons_tail;
 };
+
+/**
+ * @brief Chase-Lev work-stealing deque of pointers. The owner thread pushes and pops at the
+ * bottom, other threads steal from the top. Its capacity is fixed, a push to the full deque fails.
+ */
+template <typename T, size_t SZ>
+class WorkStealingQueue {
+    static_assert(std::is_pointer<T>::value, "WorkStealingQueue holds pointers");
+    static_assert((SZ & (SZ - 1)) == 0, "WorkStealingQueue size must be power of 2");
+
+   public:
+    WorkStealingQueue() : m_top(0), m_bottom(0) {
+        for (auto &e : m_data) {
+            e.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    size_t capacity() const { return SZ; }
+
+    size_t size() const {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+        return b > t ? b - t : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    /**
+     * @warning Only called by the owner
+     */
+    bool TryPush(T n) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        if (UNLIKELY(b - t >= (int64_t)SZ)) {
+            return false;  // full
+        }
+        m_data[b & (SZ - 1)].store(n, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * @warning Only called by the owner
+     */
+    bool TryPop(T *n) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return false;  // empty
+        }
+
+        *n = m_data[b & (SZ - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last one, race with thieves
+            bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool TrySteal(T *n) {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return false;  // empty
+        }
+
+        T e = m_data[t & (SZ - 1)].load(std::memory_order_relaxed);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed)) {
+            return false;  // lost to the owner or another thief
+        }
+        *n = e;
+        return true;
+    }
+
+   private:
+    CACHE_ALIGN std::atomic<int64_t> m_top;
+    CACHE_ALIGN std::atomic<int64_t> m_bottom;
+    std::atomic<T> m_data[SZ];
+};
@@ -11,15 +11,48 @@ constexpr static size_t cache_line_size = 64;
 constexpr static size_t min_slab_size = 64;
 constexpr static size_t mem_region_aligned_size = 2ul << 30;
 
+// `page_size` is the base page, which page ids and page frames are counted in. A page of a
+// larger `rcmp::PageSizeClass` spans aligned consecutive page ids, and its class is kept in the
+// top bits of the `GAddr`.
 constexpr static size_t offset_bits = __builtin_ffsl(page_size) - 1;
-constexpr static size_t page_id_bits = sizeof(rcmp::GAddr) * 8 - offset_bits;
+constexpr static size_t page_class_bits = 2;
+constexpr static size_t page_id_bits = sizeof(rcmp::GAddr) * 8 - offset_bits - page_class_bits;
 
 constexpr static size_t msgq_ring_buf_len = 16ul << 20;
 constexpr static size_t msgq_ring_depth = 256;
 constexpr static size_t write_batch_buffer_size = 64ul << 20;
 constexpr static size_t write_batch_buffer_overflow_size = 2ul << 20;
 
-constexpr static size_t get_page_cxl_ref_or_proxy_write_raw_max_size = UINT64_MAX;
+/**
+ * @brief Direct io of at least this size streams through the CXL bounce region of the client, in
+ * pipelined chunks of RDMA io, instead of carrying the data in the msgq
+ */
+constexpr static size_t stream_io_min_size = 64ul << 10;
+constexpr static size_t stream_chunk_size = 64ul << 10;
+constexpr static size_t stream_window = 4;  // Chunks in flight of a stream
+// A slot holds the largest page, as an io stays in a page
+constexpr static size_t stream_bounce_size = 2ul << 20;
+constexpr static size_t stream_bounce_slot_num = 4;  // Streams in flight of a client
+
+/**
+ * @brief Maximum number of data plane threads of a daemon
+ */
+constexpr static size_t max_daemon_worker_num = 64;
+
+/**
+ * @brief Maximum number of shards of the master, each a thread with its own Rpc
+ */
+constexpr static size_t max_master_shard_num = 16;
+
+/**
+ * @brief Page ids are dealt to the master shards in ranges of `1 << master_shard_range_bits`
+ */
+constexpr static size_t master_shard_range_bits = 16;
+
+/**
+ * @brief Maximum number of pages carried by one `delPageRDMARef` request
+ */
+constexpr static size_t del_page_ref_batch_max_num = 1024;
 
 /**
  * @brief Intervals before and after heat statisticsus
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+
+#include "lock.hpp"
+#include "utils.hpp"
+
+/**
+ * @brief Epoch based reclamation.
+ *
+ * An object unlinked from a shared structure is retired with the epoch at that time, and reclaimed
+ * once every guard alive was entered after that epoch. Guards reserve a slot instead of a thread,
+ * so they can be held by fibers across yields.
+ */
+class EpochManager {
+   public:
+    class Guard : public NOCOPYABLE {
+       public:
+        Guard(EpochManager &epoch_mgr);
+        ~Guard();
+
+       private:
+        EpochManager &m_epoch_mgr;
+        size_t m_slot;
+    };
+
+    EpochManager();
+
+    /**
+     * @brief Run `reclaim_fn` once no guard can access the unlinked object.
+     */
+    void Retire(std::function<void()> reclaim_fn);
+
+    /**
+     * @brief Advance the epoch and run the reclaimers safe to run.
+     */
+    void Reclaim();
+
+   private:
+    constexpr static size_t max_guard_num = 1024;
+    constexpr static uint64_t idle_epoch = UINT64_MAX;
+    constexpr static size_t reclaim_batch_num = 64;
+
+    std::atomic<uint64_t> m_epoch{1};
+    std::atomic<uint64_t> m_reserved_epochs[max_guard_num];
+
+    SpinMutex m_retire_lck;
+    std::deque<std::pair<uint64_t, std::function<void()>>> m_retired;
+};
+
+using EpochGuard = EpochManager::Guard;
@@ -14,11 +14,30 @@
 #include <condition_variable>
 #include <functional>
 #include <list>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
+#include "concurrent_queue.hpp"
+#include "lock.hpp"
 #include "log.hpp"
+#include "stats.hpp"
+#include "utils.hpp"
+
+/**
+ * @brief Run queue depths of a thread, updated by the thread and sampled by others.
+ */
+struct RunQueueStats {
+    std::atomic<size_t> ready_high{0};       // Ready fibers of high priority
+    std::atomic<size_t> ready_low{0};        // Ready fibers of low priority
+    std::atomic<size_t> pinned_tasks{0};     // Pool tasks only run by this thread
+    std::atomic<size_t> stealable_tasks{0};  // Pool tasks other threads may steal
+    std::atomic<uint64_t> stolen_tasks{0};   // Tasks this thread has stolen from others
+    std::atomic<size_t> fibers{0};           // Fibers of the pool, including elastic ones
+};
 
 //[priority_props
 class priority_props : public boost::fibers::fiber_properties {
@@ -55,9 +74,10 @@ class priority_scheduler : public boost::fibers::algo::algorithm_with_properties
     std::mutex mtx_{};
     std::condition_variable cnd_{};
     bool flag_{false};
+    RunQueueStats* stats_;
 
    public:
-    priority_scheduler();
+    priority_scheduler(RunQueueStats* stats = nullptr);
 
     // For a subclass of algorithm_with_properties<>, it's important to
     // override the correct awakened() overload.
@@ -86,37 +106,275 @@ class priority_scheduler : public boost::fibers::algo::algorithm_with_properties
     void notify() noexcept;
 };
 
+/**
+ * @brief A move-only `void()` callable. Callables small enough are stored inline, so that queueing
+ * a request handler doesn't touch the heap.
+ */
+class FiberTask {
+   public:
+    // Fits the msgq handler, which captures a whole `MsgBuffer`, with room for more captures.
+    // Aligned to pointers rather than `max_align_t`, so that a queued task with its enqueue time
+    // fills two cache lines without padding.
+    constexpr static size_t inline_size = 112;
+    constexpr static size_t inline_align = alignof(void*);
+
+    template <typename Fn>
+    constexpr static bool fits_inline = sizeof(Fn) <= inline_size &&
+                                        alignof(Fn) <= inline_align &&
+                                        std::is_nothrow_move_constructible<Fn>::value;
+
+    FiberTask() = default;
+
+    template <typename F,
+              typename = std::enable_if_t<!std::is_same<std::decay_t<F>, FiberTask>::value>>
+    FiberTask(F&& f) {
+        using Fn = std::decay_t<F>;
+        if constexpr (fits_inline<Fn>) {
+            new (m_buf) Fn(std::forward<F>(f));
+            m_ops = &inline_ops<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(m_buf) = new Fn(std::forward<F>(f));
+            m_ops = &heap_ops<Fn>;
+        }
+    }
+
+    FiberTask(FiberTask&& other) noexcept { moveFrom(other); }
+
+    FiberTask& operator=(FiberTask&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    ~FiberTask() { reset(); }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+    void operator()() { m_ops->invoke(m_buf); }
+
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(m_buf);
+            m_ops = nullptr;
+        }
+    }
+
+   private:
+    struct Ops {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template <typename Fn>
+    constexpr static Ops inline_ops = {
+        [](void* p) { (*reinterpret_cast<Fn*>(p))(); },
+        [](void* dst, void* src) {
+            new (dst) Fn(std::move(*reinterpret_cast<Fn*>(src)));
+            reinterpret_cast<Fn*>(src)->~Fn();
+        },
+        [](void* p) { reinterpret_cast<Fn*>(p)->~Fn(); },
+    };
+
+    template <typename Fn>
+    constexpr static Ops heap_ops = {
+        [](void* p) { (**reinterpret_cast<Fn**>(p))(); },
+        [](void* dst, void* src) { *reinterpret_cast<Fn**>(dst) = *reinterpret_cast<Fn**>(src); },
+        [](void* p) { delete *reinterpret_cast<Fn**>(p); },
+    };
+
+    void moveFrom(FiberTask& other) {
+        if (other.m_ops) {
+            other.m_ops->move(m_buf, other.m_buf);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    alignas(inline_align) unsigned char m_buf[inline_size];
+    const Ops* m_ops = nullptr;
+};
+
+/**
+ * @brief Scheduling class of a pool task.
+ */
+enum class TaskClass : uint8_t {
+    LatencyCritical,  // On the path of a client access
+    Normal,
+    Background,  // Page swaps, prefetches and frees, which may be delayed
+};
+
+constexpr static size_t task_class_num = 3;
+
+/**
+ * @brief Fibers of a thread running queued tasks.
+ *
+ * Tasks are queued per class in lock-free rings of pinned tasks, run by the thread of the pool.
+ * Background tasks may also be stealable, kept in a work-stealing deque, which idle pools of other
+ * threads may steal. Classes are picked by weighted round robin, and the background tasks running
+ * at once are capped. The pool grows fibers while tasks wait and none is idle, and the extra fibers
+ * exit after idling for a while.
+ */
 class FiberPool {
    private:
+    struct QueuedTask {
+        FiberTask fn;
+        uint64_t enqueue_ns;
+    };
+    static_assert(sizeof(QueuedTask) == 2 * 64, "A queued task should fill two cache lines");
+
     struct WorkerFiberTaskQueue {
-        std::queue<std::function<void()>> fiber_tasks_;
+        std::queue<QueuedTask> fiber_tasks_[task_class_num];  // Overflow of the task rings
         boost::fibers::mutex fiber_mutex_;
         boost::fibers::condition_variable fiber_cond_;
     };
 
+    using TaskRing = ConcurrentQueue<QueuedTask, 2048, ConcurrentQueueProducerMode::MP,
+                                     ConcurrentQueueConsumerMode::MC>;
+
+    constexpr static size_t task_batch = 16;
+    constexpr static size_t stealable_task_cap = 1024;
+    constexpr static size_t max_fiber_num = 1024;
+    constexpr static auto fiber_idle_timeout = std::chrono::milliseconds(100);
+    // Tasks of each class picked in a round when all classes have tasks
+    constexpr static size_t task_class_weights[task_class_num] = {8, 4, 1};
+    constexpr static double max_latency_us = 10000;
+
    public:
+    FiberPool();
     ~FiberPool();
 
     size_t FiberSize() const;
 
+    /**
+     * @brief Add fibers on the calling thread, which becomes the owner of the pool. These fibers
+     * live until `EraseAll`.
+     */
     void AddFiber(size_t n);
 
-    void AddFiber(WorkerFiberTaskQueue& my_queue, size_t n);
-
     void EraseAll();
 
+    /**
+     * @brief Enqueue a task pinned to the thread of the pool.
+     */
     template <typename F>
     void EnqueueTask(F&& f) {
-        {
+        EnqueueTask(TaskClass::Normal, std::forward<F>(f));
+    }
+
+    template <typename F>
+    void EnqueueTask(TaskClass cls, F&& f) {
+        QueuedTask task{FiberTask(std::forward<F>(f)), getNsTimestamp()};
+        size_t c = static_cast<size_t>(cls);
+        stats_.pinned_tasks.fetch_add(1, std::memory_order_relaxed);
+        if (UNLIKELY(!task_rings_[c].TryMoveEnqueue(task))) {
             std::unique_lock<boost::fibers::mutex> lock(fr_queue_.fiber_mutex_);
-            fr_queue_.fiber_tasks_.emplace(std::forward<F>(f));
+            fr_queue_.fiber_tasks_[c].emplace(std::move(task));
+            overflow_task_num_[c].fetch_add(1, std::memory_order_relaxed);
+        }
+        notifyTask();
+        GrowIfBusy();
+    }
+
+    /**
+     * @brief Enqueue a background task, which may be stolen by another thread. It must not depend
+     * on the thread it's enqueued from.
+     */
+    template <typename F>
+    void EnqueueStealableTask(F&& f) {
+        auto task = new QueuedTask{FiberTask(std::forward<F>(f)), getNsTimestamp()};
+        // Only the owner pushes to the deque
+        if (std::this_thread::get_id() != owner_ || !stealable_tasks_.TryPush(task)) {
+            EnqueueTask(TaskClass::Background, [task]() {
+                std::unique_ptr<QueuedTask> t(task);
+                t->fn();
+            });
+            return;
         }
-        fr_queue_.fiber_cond_.notify_one();
+        stats_.stealable_tasks.fetch_add(1, std::memory_order_relaxed);
+        notifyTask();
     }
 
+    /**
+     * @brief Pools to steal from when this one is idle.
+     */
+    void SetStealVictims(std::vector<FiberPool*> victims);
+
+    /**
+     * @brief Wake the owner thread on tasks from other threads, when it may sleep outside the
+     * fiber scheduler.
+     */
+    void SetWakeFn(std::function<void()> wake_fn) { wake_fn_ = std::move(wake_fn); }
+
+    /**
+     * @brief Whether no task is queued or running, and no fiber is ready.
+     */
+    bool IsIdle() const;
+
+    /**
+     * @brief Cap the background tasks running at once.
+     */
+    void SetBackgroundLimit(size_t limit) { background_limit_ = limit; }
+
+    /**
+     * @brief Steal a task from the victims if this pool has idle fibers and nothing queued.
+     *
+     * @warning Only called by the owner
+     *
+     * @return bool Whether a task is stolen
+     */
+    bool TrySteal();
+
+    /**
+     * @brief Add a fiber if tasks are waiting and no fiber is idle. No-op off the owner thread.
+     */
+    void GrowIfBusy();
+
+    RunQueueStats& GetRunQueueStats() { return stats_; }
+
+    /**
+     * @brief Take the histogram of task latencies in us of a class, from enqueue to finish, since
+     * the last call.
+     */
+    Histogram TakeLatencyHistogram(TaskClass cls);
+
    private:
+    void spawnFiber(bool elastic);
+    bool waitTask(QueuedTask& task, size_t& cls, bool elastic);
+    bool takeTask(QueuedTask& task, size_t& cls);
+    bool takeClassTask(size_t cls, QueuedTask& task);
+    bool hasTask() const;
+    bool hasClassTask(size_t cls) const;
+    void notifyTask();
+    void finishTask(QueuedTask& task, size_t cls);
+
     std::vector<boost::fibers::fiber> fibers_;
     volatile bool fiber_stop_ = false;
-    volatile bool stop_ = false;
     WorkerFiberTaskQueue fr_queue_;
+    std::atomic<size_t> overflow_task_num_[task_class_num] = {};
+
+    TaskRing task_rings_[task_class_num];
+    // Tasks dequeued from the rings in batches, only touched by the owner
+    QueuedTask local_tasks_[task_class_num][task_batch];
+    size_t local_head_[task_class_num] = {};
+    size_t local_num_[task_class_num] = {};
+
+    // Weighted round robin, only touched by the owner
+    size_t class_credits_[task_class_num] = {};
+    size_t background_running_ = 0;
+    size_t background_limit_ = SIZE_MAX;
+
+    std::thread::id owner_;
+    std::atomic<size_t> idle_fiber_num_{0};
+    WorkStealingQueue<QueuedTask*, stealable_task_cap> stealable_tasks_;
+    std::vector<FiberPool*> victims_;
+    size_t steal_cur_ = 0;
+
+    RunQueueStats stats_;
+    std::function<void()> wake_fn_;
+
+    SpinMutex latency_lck_;
+    std::vector<Histogram> latency_hists_;
 };
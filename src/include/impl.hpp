@@ -4,8 +4,11 @@
 #include "fiber_pool.hpp"
 #include "msg_queue.hpp"
 #include "page_table.hpp"
+#include "placement.hpp"
+#include "promise.hpp"
 #include "proto/rpc_adaptor.hpp"
 #include "rdma_rc.hpp"
+#include "swap_watermark.hpp"
 #include "udp_server.hpp"
 
 struct SysStatistics {
@@ -179,7 +182,12 @@ struct MasterToDaemonConnection : public MasterConnection {
     rack_id_t rack_id;
     mac_id_t daemon_id;
 
-    std::unique_ptr<ErpcClient> erpc_conn;
+    /**
+     * @brief The erpc session to the daemon on the Rpc of the current shard, created on first use.
+     */
+    ErpcClient &GetErpcConn();
+
+    std::unique_ptr<ErpcClient> erpc_conns[max_master_shard_num];
     std::unique_ptr<rdma_rc::RDMAConnection> rdma_conn = nullptr;
 };
 
@@ -189,6 +197,30 @@ struct ClusterManager {
     std::unique_ptr<IDGenerator> mac_id_allocator;
 };
 
+/**
+ * @brief A thread of the master with its own Rpc and fiber scheduler. Daemons send the requests of
+ * a page to the shard owning its id range, and the others to shard 0.
+ */
+struct MasterShard : public NOCOPYABLE {
+    size_t shard_id;
+    std::thread thread;
+    std::unique_ptr<erpc::IBRpcWrap> rpc;
+    FiberPool fiber_pool;
+
+    // Load of the shard, written by its thread and read by the stats thread
+    std::atomic<uint64_t> rpc_opn{0};
+    std::atomic<uint64_t> rpc_exec_time{0};
+};
+
+/**
+ * @brief Load statistics of the master, kept per shard. Always on, to tell when the shards are
+ * overloaded.
+ */
+struct MasterStatistics {
+    void start_sample(uint64_t &timer) { timer = getNsTimestamp(); }
+    void rpc_exec_sample(uint64_t &timer);
+};
+
 struct MasterContext : public NOCOPYABLE {
     rcmp::MasterOptions m_options;
 
@@ -196,17 +228,20 @@ struct MasterContext : public NOCOPYABLE {
 
     ClusterManager m_cluster_manager;
     PageDirectory m_page_directory;
+    std::unique_ptr<PlacementPolicy> m_placement;  // Places pages a rack can't hold on others
 
-    FiberPool m_fiber_pool_;
+    std::vector<std::unique_ptr<MasterShard>> m_shards;
+    // The shard running on this thread
+    inline static thread_local MasterShard *m_local_shard = nullptr;
 
     struct {
         std::unique_ptr<erpc::NexusWrap> nexus;
-        std::vector<erpc::IBRpcWrap> rpc_set;
     } m_erpc_ctx;
 
     rdma_rc::RDMAConnection m_listen_conn;
+    ibv_mr *m_dir_slot_mr = nullptr;  // The `DirSlot` table, if exposed to one-sided rdma
 
-    SysStatistics m_stats;
+    MasterStatistics m_stats;
 
     static MasterContext &getInstance() {
         static MasterContext master_ctx;
@@ -222,80 +257,240 @@ struct MasterContext : public NOCOPYABLE {
         return it->second;
     }
 
-    erpc::IBRpcWrap &GetErpc() { return m_erpc_ctx.rpc_set[0]; }
+    MasterShard &GetShard() {
+        DLOG_ASSERT(m_local_shard != nullptr, "Not on a shard thread");
+        return *m_local_shard;
+    }
+
+    erpc::IBRpcWrap &GetErpc() { return *GetShard().rpc; }
 
-    FiberPool &GetFiberPool() { return m_fiber_pool_; }
+    FiberPool &GetFiberPool() { return GetShard().fiber_pool; }
 
     void InitCluster();
     void InitRDMARC();
     void InitRPCNexus();
     void InitFiberPool();
+    void InitShards();
+    void ShardPollOnce();
+
+   private:
+    void bindShard(size_t shard_id);
 };
 
+inline void MasterStatistics::rpc_exec_sample(uint64_t &timer) {
+    MasterShard &shard = MasterContext::getInstance().GetShard();
+    uint64_t tmp = getNsTimestamp();
+    shard.rpc_opn.fetch_add(1, std::memory_order_relaxed);
+    shard.rpc_exec_time.fetch_add(tmp - timer, std::memory_order_relaxed);
+    timer = tmp;
+}
+
+inline ErpcClient &MasterToDaemonConnection::GetErpcConn() {
+    MasterShard &shard = MasterContext::getInstance().GetShard();
+    auto &erpc_conn = erpc_conns[shard.shard_id];
+    if (erpc_conn == nullptr) {
+        erpc_conn = std::make_unique<ErpcClient>(*shard.rpc, ip, port);
+    }
+    return *erpc_conn;
+}
+
 /************************  Daemon   **********************/
 
 struct DaemonConnection {
     std::string ip;
-    uint16_t port;  // erpc port
+    uint16_t port;            // erpc port
+    int peer_worker_num = 1;  // The worker i calls the Rpc `i % peer_worker_num` of the peer
 
     virtual ~DaemonConnection() = default;
 
     virtual msgq::MsgQueueRPC *GetMsgQ() = 0;
+
+    /**
+     * @brief The erpc session to the peer on the Rpc of the current worker, created on first use.
+     */
+    ErpcClient &GetErpcConn();
+
+    std::unique_ptr<ErpcClient> erpc_conns[max_daemon_worker_num];
 };
 
 struct DaemonToMasterConnection : public DaemonConnection {
     mac_id_t master_id;
+    size_t shard_num = 1;  // Shards of the master
 
-    std::unique_ptr<ErpcClient> erpc_conn;
-    std::unique_ptr<rdma_rc::RDMAConnection> rdma_conn;
+    using DaemonConnection::GetErpcConn;
+
+    /**
+     * @brief The erpc session to the master shard owning `page_id`, on the Rpc of the current
+     * worker.
+     */
+    ErpcClient &GetErpcConn(page_id_t page_id);
+
+    std::unique_ptr<ErpcClient> shard_erpc_conns[max_daemon_worker_num][max_master_shard_num];
+
+    // The `DirSlot` table of the master, rkey 0 if not exposed
+    uintptr_t dir_slot_table_addr = 0;
+    uint32_t dir_slot_table_rkey = 0;
+
+    std::unique_ptr<rdma_rc::RDMAConnection> rdma_conns[max_daemon_worker_num];
 
     virtual msgq::MsgQueueRPC *GetMsgQ() override { return nullptr; }
+
+    /**
+     * @brief The RDMA connection of the current worker.
+     */
+    rdma_rc::RDMAConnection *GetRDMAConn();
 };
 
 struct DaemonToClientConnection : public DaemonConnection {
     std::unique_ptr<MsgQClient> msgq_conn;
 
     mac_id_t client_id;
+    uint32_t ref_idx;  // Dense index in the `ref_client` of pages
 
     virtual msgq::MsgQueueRPC *GetMsgQ() override { return &msgq_conn->rpc; }
 };
 
+/**
+ * @brief `delPageRDMARef` invalidations waiting to be sent to one daemon. All of them travel in one
+ * request and share its completion.
+ */
+struct DelPageRefBatch {
+    DelPageRefBatch() : done_fu(done.get_future().share()) {}
+
+    std::vector<PageRefInvalidation> pages;
+    CortPromise<void> done;
+    boost::fibers::shared_future<void> done_fu;
+};
+
 struct DaemonToDaemonConnection : public DaemonConnection {
     rack_id_t rack_id;
     mac_id_t daemon_id;
+    uint32_t ref_idx;  // Dense index in the `ref_daemon` of pages
 
-    std::unique_ptr<ErpcClient> erpc_conn;
-    std::unique_ptr<rdma_rc::RDMAConnection> rdma_conn = nullptr;
+    SwapWatermarkController::RackStats *swap_stats = nullptr;
+
+    // Page slot table of the peer, to validate the direct io on its pages
+    uintptr_t page_slot_table_addr;
+    uint32_t page_slot_table_rkey;
+    uintptr_t page_data_start_addr;
+
+    CortMutex del_ref_batch_lock;
+    std::shared_ptr<DelPageRefBatch> del_ref_batch;
+
+    // Connected by the worker of the same index on both sides, each with its own QPs and CQ
+    std::unique_ptr<rdma_rc::RDMAConnection> rdma_conns[max_daemon_worker_num];
 
     virtual msgq::MsgQueueRPC *GetMsgQ() override { return nullptr; }
+
+    /**
+     * @brief The RDMA connection of the current worker.
+     */
+    rdma_rc::RDMAConnection *GetRDMAConn();
 };
 
 struct ConnectionManager {
+    // Connections are never removed, so reserved tables are read without locking
+    constexpr static size_t max_ref_conn_num = 1024;
+
+    ConnectionManager() {
+        m_client_ref_table.reserve(max_ref_conn_num);
+        m_daemon_ref_table.reserve(max_ref_conn_num);
+    }
+
     DaemonToMasterConnection &GetMasterConnection() { return m_master_connection; }
 
+    DaemonToClientConnection *GetClientByRefIdx(uint32_t ref_idx) {
+        return m_client_ref_table[ref_idx];
+    }
+    DaemonToDaemonConnection *GetDaemonByRefIdx(uint32_t ref_idx) {
+        return m_daemon_ref_table[ref_idx];
+    }
+
     DaemonConnection *GetConnection(mac_id_t mac_id) {
         if (mac_id == master_id) {
             return &GetMasterConnection();
         }
+        std::shared_lock<SharedMutex> lck(m_lck);
         auto it = m_connect_table.find(mac_id);
         DLOG_ASSERT(it != m_connect_table.end(), "Can't find mac %d", mac_id);
         return it->second;
     }
 
+    /**
+     * @brief Like `GetConnection()`, but nullptr if the peer isn't connected, for ids that may be
+     * stale.
+     */
+    DaemonConnection *FindConnection(mac_id_t mac_id) {
+        std::shared_lock<SharedMutex> lck(m_lck);
+        auto it = m_connect_table.find(mac_id);
+        return it == m_connect_table.end() ? nullptr : it->second;
+    }
+
+    template <typename F>
+    void ForEachDaemon(F &&fn) {
+        std::shared_lock<SharedMutex> lck(m_lck);
+        for (auto &conn : m_other_daemon_connect_table) {
+            fn(conn);
+        }
+    }
+
     void AddConnection(mac_id_t mac_id, DaemonToClientConnection *conn) {
+        std::unique_lock<SharedMutex> lck(m_lck);
+        DLOG_ASSERT(m_client_ref_table.size() < max_ref_conn_num, "Too many clients");
+        conn->ref_idx = m_client_ref_table.size();
+        m_client_ref_table.push_back(conn);
         m_connect_table.insert({mac_id, conn});
         m_client_connect_table.insert(conn);
     }
 
     void AddConnection(mac_id_t mac_id, DaemonToDaemonConnection *conn) {
+        std::unique_lock<SharedMutex> lck(m_lck);
+        DLOG_ASSERT(m_daemon_ref_table.size() < max_ref_conn_num, "Too many daemons");
+        conn->ref_idx = m_daemon_ref_table.size();
+        m_daemon_ref_table.push_back(conn);
         m_connect_table.insert({mac_id, conn});
         m_other_daemon_connect_table.insert(conn);
     }
 
     DaemonToMasterConnection m_master_connection;
+    SharedMutex m_lck;  // Connections are added by any worker
     std::set<DaemonToClientConnection *> m_client_connect_table;
     std::set<DaemonToDaemonConnection *> m_other_daemon_connect_table;
     std::unordered_map<mac_id_t, DaemonConnection *> m_connect_table;
+    std::vector<DaemonToClientConnection *> m_client_ref_table;
+    std::vector<DaemonToDaemonConnection *> m_daemon_ref_table;
+};
+
+/**
+ * @brief Landing buffer of a one-sided latched read of a `DirSlot`.
+ */
+struct DirSlotRead {
+    constexpr static size_t per_worker_num = 256;
+
+    uint64_t latch;  // The latch word before latching
+    DirSlot slot;
+    uint64_t unlatch;
+};
+
+/**
+ * @brief A data plane thread of the daemon, serving the pages of its shard. It polls its own Rpc,
+ * msgq lane and RDMA connections, and runs its own fiber scheduler.
+ */
+struct DaemonWorker : public NOCOPYABLE {
+    size_t worker_id;
+    std::thread thread;
+    std::unique_ptr<erpc::IBRpcWrap> rpc;
+    std::unique_ptr<msgq::MsgQueueRPC> msgq_rpc;  // Receives from the clients on its lane
+    std::unique_ptr<msgq::MsgQueueIdler> idler;   // Sleeps on the doorbell of its lane
+    Mutex lane_lck;
+    std::vector<DaemonToClientConnection *> lane_clients;  // Guarded by lane_lck
+    rdma_rc::CompletionEngine rdma_engine;         // Polls the rdma connections of the worker
+    FiberPool fiber_pool;
+
+    // Registered buffers for one-sided reads of the master directory, used by the fibers of the
+    // worker only
+    ibv_mr *dir_read_mr = nullptr;
+    std::vector<DirSlotRead *> dir_read_bufs;
 };
 
 struct DaemonContext : public NOCOPYABLE {
@@ -307,21 +502,25 @@ struct DaemonContext : public NOCOPYABLE {
     void *m_cxl_memory_addr;
 
     CXLMemFormat m_cxl_format;
+    void *m_stream_zone_addr;  // Stream bounce regions of the clients, in the reserve zone
     MsgQueueManager m_msgq_manager;
     ConnectionManager m_conn_manager;
     PageTableManager m_page_table;
+    PageIDLease m_page_id_lease;
+    SwapWatermarkController m_swap_ctrl;
 
     rdma_rc::RDMAConnection m_listen_conn;
     // Registered for cxl, unchangeable after initialisation of length
     std::vector<ibv_mr *> m_rdma_page_mr_table;
     std::unordered_map<void *, ibv_mr *> m_rdma_mr_table;
 
-    FiberPool m_fiber_pool;
+    std::vector<std::unique_ptr<DaemonWorker>> m_workers;
+    // The worker running on this thread
+    inline static thread_local DaemonWorker *m_local_worker = nullptr;
 
     struct {
         volatile bool running;
         std::unique_ptr<erpc::NexusWrap> nexus;
-        std::vector<erpc::IBRpcWrap> rpc_set;
     } m_erpc_ctx;
 
     SysStatistics m_stats;
@@ -333,13 +532,29 @@ struct DaemonContext : public NOCOPYABLE {
 
     mac_id_t GetMacID() const { return m_daemon_id; }
 
-    erpc::IBRpcWrap &GetErpc() { return m_erpc_ctx.rpc_set[0]; }
+    DaemonWorker &GetWorker() {
+        DLOG_ASSERT(m_local_worker != nullptr, "Not on a worker thread");
+        return *m_local_worker;
+    }
+
+    erpc::IBRpcWrap &GetErpc() { return *GetWorker().rpc; }
 
     DaemonConnection *GetConnection(mac_id_t mac_id) {
         return m_conn_manager.GetConnection(mac_id);
     }
 
-    FiberPool &GetFiberPool() { return m_fiber_pool; }
+    FiberPool &GetFiberPool() { return GetWorker().fiber_pool; }
+
+    /**
+     * @brief The worker owning the page. Pages are hashed, for ids of large pages are aligned.
+     */
+    size_t GetPageShard(page_id_t page_id) const {
+        return ((page_id * 0x9e3779b97f4a7c15ul) >> 32) % m_workers.size();
+    }
+
+    FiberPool &GetShardFiberPool(page_id_t page_id) {
+        return m_workers[GetPageShard(page_id)]->fiber_pool;
+    }
 
     ibv_mr *GetMR(void *p) {
         if (p >= m_cxl_format.start_addr && p < m_cxl_format.end_addr) {
@@ -363,10 +578,47 @@ struct DaemonContext : public NOCOPYABLE {
     void InitFiberPool();
     void ConnectWithMaster();
     void RegisterCXLMR();
-    void RDMARCPoll();
+    bool RDMARCPoll();
     void InitHeatDecayCache();
+    void InitWorkers();
+    void WorkerPollOnce();
+
+   private:
+    void bindWorker(size_t worker_id);
 };
 
+inline ErpcClient &DaemonConnection::GetErpcConn() {
+    DaemonWorker &worker = DaemonContext::getInstance().GetWorker();
+    auto &erpc_conn = erpc_conns[worker.worker_id];
+    if (erpc_conn == nullptr) {
+        erpc_conn = std::make_unique<ErpcClient>(*worker.rpc, ip, port,
+                                                 worker.worker_id % peer_worker_num);
+    }
+    return *erpc_conn;
+}
+
+inline ErpcClient &DaemonToMasterConnection::GetErpcConn(page_id_t page_id) {
+    size_t shard_id = PageDirectory::ShardOf(page_id, shard_num);
+    if (shard_id == 0) {
+        return GetErpcConn();
+    }
+
+    DaemonWorker &worker = DaemonContext::getInstance().GetWorker();
+    auto &erpc_conn = shard_erpc_conns[worker.worker_id][shard_id];
+    if (erpc_conn == nullptr) {
+        erpc_conn = std::make_unique<ErpcClient>(*worker.rpc, ip, port, shard_id);
+    }
+    return *erpc_conn;
+}
+
+inline rdma_rc::RDMAConnection *DaemonToMasterConnection::GetRDMAConn() {
+    return rdma_conns[DaemonContext::getInstance().GetWorker().worker_id].get();
+}
+
+inline rdma_rc::RDMAConnection *DaemonToDaemonConnection::GetRDMAConn() {
+    return rdma_conns[DaemonContext::getInstance().GetWorker().worker_id].get();
+}
+
 /************************  Client   **********************/
 
 struct ClientConnection {
@@ -407,10 +659,15 @@ struct ClientContext : public NOCOPYABLE {
     PageThreadCacheManager m_tcache_mgr;
     float m_half_life_us;
 
+    // Slots of the stream bounce region owned by this client
+    offset_t m_stream_bounce_offset;
+    IDGenerator m_stream_slots;
+
     FiberPool m_fiber_pool_;
 
     volatile bool m_msgq_stop;
     std::thread m_msgq_worker;
+    std::unique_ptr<msgq::MsgQueueIdler> m_msgq_idler;
 
     // char *m_batch_buffer = new char[write_batch_buffer_size +
     // write_batch_buffer_overflow_size]; size_t m_batch_cur = 0;
@@ -2,6 +2,7 @@
 
 #include <pthread.h>
 
+#include <atomic>
 #include <boost/fiber/condition_variable.hpp>
 #include <boost/fiber/mutex.hpp>
 #include <mutex>
@@ -37,72 +38,122 @@ class Barrier {
 using CortMutex = boost::fibers::mutex;
 using CortConditionalVariable = boost::fibers::condition_variable;
 
+/**
+ * @brief A fiber reader-writer lock with writer preference.
+ *
+ * The state is one atomic word, so an uncontended lock or unlock is a single atomic operation.
+ * Fibers only park on the condition variable when contended.
+ */
 class CortSharedMutex {
    public:
-    CortSharedMutex() : state(0) {}
+    CortSharedMutex() : m_state(0), m_waiters(0), m_writers_waiting(0) {}
 
     void lock() {
-        std::unique_lock<boost::fibers::mutex> lk(mtx);
-        g1.wait(lk, [=] { return !write_entered(); });
-        state |= _S_write_entered;
-        g2.wait(lk, [=] { return readers() == 0; });
+        if (try_lock()) {
+            return;
+        }
+
+        std::unique_lock<CortMutex> lk(m_mtx);
+        m_waiters.fetch_add(1);
+        // Block the new readers
+        if (m_writers_waiting++ == 0) {
+            m_state.fetch_or(_S_write_waiting);
+        }
+
+        unsigned s = m_state.load();
+        while (true) {
+            if (write_entered(s)) {
+                m_cv.wait(lk);
+                s = m_state.load();
+            } else if (m_state.compare_exchange_weak(s, s | _S_write_entered)) {
+                break;
+            }
+        }
+        // Wait for the readers in to leave
+        while (readers(m_state.load()) != 0) {
+            m_cv.wait(lk);
+        }
+
+        if (--m_writers_waiting == 0) {
+            m_state.fetch_and(~_S_write_waiting);
+        }
+        m_waiters.fetch_sub(1);
     }
 
     bool try_lock() {
-        std::unique_lock<boost::fibers::mutex> lk(mtx, std::try_to_lock);
-        if (lk.owns_lock() && state == 0) {
-            state = _S_write_entered;
-            return true;
-        }
-        return false;
+        unsigned expected = 0;
+        return m_state.compare_exchange_strong(expected, _S_write_entered);
     }
 
     void unlock() {
-        std::lock_guard<boost::fibers::mutex> lk(mtx);
-        state = 0;
-        g1.notify_all();
+        m_state.fetch_and(~_S_write_entered);
+        wake();
     }
 
     void lock_shared() {
-        std::unique_lock<boost::fibers::mutex> lk(mtx);
-        g1.wait(lk, [=] { return state < _S_max_readers; });
-        ++state;
+        unsigned s = m_state.fetch_add(1);
+        if ((s & _S_writer_mask) == 0) {
+            return;
+        }
+
+        // A writer is in or waiting, back off
+        s = m_state.fetch_sub(1);
+        if (write_entered(s) && readers(s) == 1) {
+            wake();
+        }
+
+        std::unique_lock<CortMutex> lk(m_mtx);
+        m_waiters.fetch_add(1);
+        s = m_state.load();
+        while (true) {
+            if (s & _S_writer_mask) {
+                m_cv.wait(lk);
+                s = m_state.load();
+            } else if (m_state.compare_exchange_weak(s, s + 1)) {
+                break;
+            }
+        }
+        m_waiters.fetch_sub(1);
     }
 
     bool try_lock_shared() {
-        std::unique_lock<boost::fibers::mutex> lk(mtx, std::try_to_lock);
-        if (!lk.owns_lock()) {
-            return false;
-        }
-        if (state < _S_max_readers) {
-            ++state;
-            return true;
+        unsigned s = m_state.load();
+        while ((s & _S_writer_mask) == 0) {
+            if (m_state.compare_exchange_weak(s, s + 1)) {
+                return true;
+            }
         }
         return false;
     }
 
     void unlock_shared() {
-        std::lock_guard<boost::fibers::mutex> lk(mtx);
-        auto prev = state--;
-        if (write_entered()) {
-            if (readers() == 0) {
-                g2.notify_one();
-            }
-        } else {
-            if (prev == _S_max_readers) {
-                g1.notify_one();
-            }
+        unsigned s = m_state.fetch_sub(1);
+        if (write_entered(s) && readers(s) == 1) {
+            // The last reader lets the writer in
+            wake();
         }
     }
 
    private:
-    boost::fibers::mutex mtx;
-    boost::fibers::condition_variable g1, g2;
-    unsigned state;
-
     static constexpr unsigned _S_write_entered = 1U << (sizeof(unsigned) * __CHAR_BIT__ - 1);
-    static constexpr unsigned _S_max_readers = ~_S_write_entered;
+    static constexpr unsigned _S_write_waiting = _S_write_entered >> 1;
+    static constexpr unsigned _S_writer_mask = _S_write_entered | _S_write_waiting;
+    static constexpr unsigned _S_max_readers = ~_S_writer_mask;
+
+    static bool write_entered(unsigned s) { return s & _S_write_entered; }
+    static unsigned readers(unsigned s) { return s & _S_max_readers; }
+
+    void wake() {
+        // Paired with the waiters checking the state after counting themselves in
+        if (m_waiters.load() > 0) {
+            std::lock_guard<CortMutex> lk(m_mtx);
+            m_cv.notify_all();
+        }
+    }
 
-    bool write_entered() const { return state & _S_write_entered; }
-    unsigned readers() const { return state & _S_max_readers; }
-};
\ No newline at end of file
+    std::atomic<unsigned> m_state;
+    std::atomic<unsigned> m_waiters;
+    unsigned m_writers_waiting;  // Guarded by m_mtx
+    CortMutex m_mtx;
+    CortConditionalVariable m_cv;
+};
@@ -8,6 +8,7 @@
 #include "common.hpp"
 #include "concurrent_queue.hpp"
 #include "config.hpp"
+#include "utils.hpp"
 
 /**
  * @brief
@@ -22,8 +23,36 @@ namespace msgq {
 struct MsgBuffer;
 struct MsgQueue;
 
+/**
+ * @brief Credits of a sender, each allowing one request in flight. The credit of a request comes
+ * back with its response, so a sender can't hold more of the receiver's queue than its window.
+ * The receiver may resize the window in any response, as its queue is shared by more senders.
+ */
+struct MsgQueueCredits {
+    std::atomic<int> m_avail{msgq_ring_depth};
+    std::atomic<int> m_window{msgq_ring_depth};
+    std::atomic<int> m_peer_window{0};  // Granted to the peer in the responses, 0 to keep it
+
+    bool try_acquire();
+    void release() { m_avail.fetch_add(1, std::memory_order_release); }
+    void resize(int window);
+};
+
+/**
+ * @brief The doorbell of a queue in the msgq zone. An idle receiver announces its sleep and waits
+ * on the futex word, which a sender bumps after enqueuing if the receiver sleeps.
+ */
+struct MsgQueueDoorbell {
+    std::atomic<uint32_t> m_seq{0};       // The futex word
+    std::atomic<uint32_t> m_sleeping{0};  // Whether the receiver sleeps, cleared by the ringer
+    std::atomic<uint64_t> m_ring_ts{0};   // When the sleeping receiver is rung
+
+    void ring();
+};
+
 struct MsgUDPConnPacket {
     uintptr_t recv_q_off;
+    uintptr_t send_q_off;  // The lane of the daemon worker serving this client
 };
 
 using msgq_handler_t = void (*)(MsgBuffer &req, void *ctx);
@@ -38,6 +67,8 @@ struct MsgHeader final {
     size_t size : 32;  // Actual data size
     msgq_callback_t cb;
     void *arg;
+    MsgQueueCredits *credits;  // Of the requester, returned by the response
+    int credit_window;         // New window of the requester in a response, 0 if unchanged
 
     uint8_t data[0];
 };
@@ -59,7 +90,9 @@ struct MsgQueue final {
     void enqueue_msg();
     void dequeue_msg(std::vector<MsgHeader *> &hv);
     void free_msg_buffer();
+    bool empty() const { return m_prod_tail.load().pos == m_cons_head.load().pos; }
 
+    MsgQueueDoorbell m_doorbell;
     atomic_po_val_t m_prod_head;
     atomic_po_val_t m_prod_tail;
     atomic_po_val_t m_cons_head;
@@ -82,6 +115,8 @@ struct MsgHeader final {
     msgq_callback_t cb;
     uint64_t send_ts;
     void *arg;
+    MsgQueueCredits *credits;  // Of the requester, returned by the response
+    int credit_window;         // New window of the requester in a response, 0 if unchanged
 
     // static_assert(msgq_ring_buf_len < (1ul << 16), "");
 };
@@ -99,10 +134,13 @@ struct MsgQueue final {
     ~MsgQueue() = default;
 
     offset_t alloc_msg_buffer(size_t size);
+    bool try_alloc_msg_buffer(size_t size, offset_t &off);
     void enqueue_msg(MsgBuffer &msg_buf);
     uint32_t dequeue_msg(MsgHeader *hv, size_t max_deq);
     void free_msg_buffer(MsgBuffer &msg_buf);
+    bool empty() const { return msgq_q.empty(); }
 
+    MsgQueueDoorbell m_doorbell;
     ConcurrentQueue<MsgHeader, msgq_ring_depth, ConcurrentQueueProducerMode::MP,
                     ConcurrentQueueConsumerMode::SC>
         msgq_q;
@@ -118,6 +156,13 @@ struct MsgQueueSatistics {
     uint64_t recv_io = 0;
     uint64_t recv_bytes = 0;
     uint64_t recv_time = 0;
+    std::atomic<uint64_t> credit_stall{0};  // Requests waiting for a credit, from any worker
+
+    void clear() {
+        send_io = send_bytes = send_time = 0;
+        recv_io = recv_bytes = recv_time = 0;
+        credit_stall.store(0, std::memory_order_relaxed);
+    }
 
     void start_sample(uint64_t &timer) {
 #if (RCMP_PERF_ON != 0)
@@ -146,6 +191,88 @@ struct MsgQueueSatistics {
     }
 };
 
+// Written by the receiver and read by stats threads, so relaxed atomics
+struct MsgQueueIdleStats {
+    std::atomic<uint64_t> sleeps{0};            // Transitions from spinning to sleeping
+    std::atomic<uint64_t> doorbell_wakeups{0};  // Sleeps ended by a sender, others timed out
+    std::atomic<uint64_t> sleep_time{0};
+    // From the doorbell to the receiver running, of doorbell wakeups
+    std::atomic<uint64_t> wakeup_time{0};
+
+    void clear() {
+        sleeps.store(0, std::memory_order_relaxed);
+        doorbell_wakeups.store(0, std::memory_order_relaxed);
+        sleep_time.store(0, std::memory_order_relaxed);
+        wakeup_time.store(0, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * @brief Adaptive idling of a receiver polling `q`: it spins while busy, and once idle for the
+ * spin budget, sleeps on the doorbell of `q` until rung or for at most `max_sleep_us`. The bound
+ * is for sources that can't ring the doorbell, e.g. erpc and fiber timers.
+ */
+struct MsgQueueIdler {
+    /**
+     * @param spin_us Idle time spun before sleeping
+     * @param max_sleep_us Longest sleep, 0 to never sleep
+     */
+    MsgQueueIdler(MsgQueue *q, uint64_t spin_us, uint64_t max_sleep_us)
+        : m_q(q), m_spin_ns(spin_us * 1000), m_max_sleep_us(max_sleep_us) {}
+
+    /**
+     * @brief Account a poll round, sleeping if idle past the spin budget. `has_work` is checked
+     * again after the sleep is announced, so that nothing arriving meanwhile is slept through.
+     */
+    template <typename F>
+    void poll_done(bool busy, F &&has_work) {
+        if (busy || m_max_sleep_us == 0) {
+            m_idle_since = 0;
+            return;
+        }
+        uint64_t now = getNsTimestamp();
+        if (m_idle_since == 0) {
+            m_idle_since = now;
+            return;
+        }
+        // A sleep doesn't reset the idle time, so the receiver sleeps again after a round of
+        // polling the sources that can't ring
+        if (now - m_idle_since < m_spin_ns) {
+            return;
+        }
+
+        MsgQueueDoorbell &db = m_q->m_doorbell;
+        uint32_t seq = db.m_seq.load(std::memory_order_acquire);
+        db.m_sleeping.store(1, std::memory_order_relaxed);
+        // Paired with the fence of the ringer after enqueuing
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_q->empty() && !has_work()) {
+            m_stats.sleeps.fetch_add(1, std::memory_order_relaxed);
+            futexWait(&db.m_seq, seq, m_max_sleep_us);
+            uint64_t woken = getNsTimestamp();
+            m_stats.sleep_time.fetch_add(woken - now, std::memory_order_relaxed);
+            if (db.m_seq.load(std::memory_order_acquire) != seq) {
+                m_stats.doorbell_wakeups.fetch_add(1, std::memory_order_relaxed);
+                m_stats.wakeup_time.fetch_add(
+                    woken - db.m_ring_ts.load(std::memory_order_relaxed),
+                    std::memory_order_relaxed);
+            }
+        }
+        db.m_sleeping.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Wake the receiver for work not coming from `q`, e.g. tasks from other threads.
+     */
+    void wake() { m_q->m_doorbell.ring(); }
+
+    MsgQueue *m_q;
+    uint64_t m_spin_ns;
+    uint64_t m_max_sleep_us;
+    uint64_t m_idle_since = 0;
+    MsgQueueIdleStats m_stats;
+};
+
 struct MsgQueueNexus {
     constexpr static size_t max_msgq_handler = (1 << (sizeof(uint8_t) * 8));
 
@@ -178,7 +305,38 @@ struct MsgQueueRPC {
     MsgBuffer alloc_msg_buffer(size_t size);
 
     /**
-     * @brief Enqueue a request message
+     * @brief Allocate msg buffer without blocking
+     *
+     * @return bool False if the queue is full
+     */
+    bool try_alloc_msg_buffer(size_t size, MsgBuffer &msg_buf);
+
+    /**
+     * @brief Set the number of requests in flight, granted by the receiver
+     */
+    void set_credit_window(int window);
+
+    /**
+     * @brief Set the window granted to the peer, which learns it from the next response
+     */
+    void set_peer_credit_window(int window);
+
+    /**
+     * @brief Take a credit for a request
+     *
+     * @warning The operation is a blocking call
+     */
+    void acquire_credit();
+
+    /**
+     * @brief Take a credit for a request without blocking
+     *
+     * @return bool False if the window is used up
+     */
+    bool try_acquire_credit() { return m_credits->try_acquire(); }
+
+    /**
+     * @brief Enqueue a request message, which consumes a credit taken before
      *
      * @param rpc_type
      * @param msg_buf
@@ -198,8 +356,9 @@ struct MsgQueueRPC {
     /**
      * @brief rpc queue polling once
      *
+     * @return uint32_t The number of messages handled
      */
-    void run_event_loop_once();
+    uint32_t run_event_loop_once();
 
     /**
      * @brief free msg buffer
@@ -212,6 +371,7 @@ struct MsgQueueRPC {
     MsgQueue *m_send_queue;
     MsgQueue *m_recv_queue;
     void *m_ctx;
+    std::shared_ptr<MsgQueueCredits> m_credits;  // Shared by the copies
 };
 
 }  // namespace msgq
@@ -223,7 +383,6 @@ struct MsgQueueManager {
     uint32_t ring_cnt;
     std::unique_ptr<SingleAllocator<RING_ELEM_SIZE>> msgq_allocator;
     std::unique_ptr<msgq::MsgQueueNexus> nexus;
-    std::unique_ptr<msgq::MsgQueueRPC> rpc;
 
     msgq::MsgQueue *allocQueue();
     void freeQueue(msgq::MsgQueue *msgq);
@@ -1,57 +1,415 @@
 #pragma once
 
+#include <atomic>
+#include <boost/fiber/future.hpp>
+#include <deque>
 #include <list>
+#include <map>
 #include <mutex>
 #include <set>
 
 #include "allocator.hpp"
 #include "common.hpp"
 #include "concurrent_hashmap.hpp"
+#include "epoch.hpp"
 #include "lock.hpp"
+#include "radix_table.hpp"
 #include "robin_hood.h"
 #include "stats.hpp"
 
 struct MasterToDaemonConnection;
 struct MasterToClientConnection;
 
-struct PageRackMetadata {
+/**
+ * @brief A run of page ids living on the same daemon. Pages allocated together on a rack share an
+ * extent, which is split when some of them migrate or are freed.
+ */
+struct PageExtent {
+    page_id_t start;
+    size_t count;  // Number of page ids, a multiple of the units of `page_class`
     uint32_t rack_id;
     mac_id_t daemon_id;
-    CortSharedMutex latch;
+    rcmp::PageSizeClass page_class;
+};
+
+/**
+ * @brief Cached rdma ref of a page on its daemon, valid until the page migrates or is freed.
+ * Daemons that got the ref from this cache are kept in `ref_daemons` for invalidation. Only pages
+ * resolved by other racks have one.
+ */
+struct PageRefCache {
+    SpinMutex ref_lck;
+    bool ref_cached = false;
+    uintptr_t ref_addr;
+    uint32_t ref_rkey;
+    std::vector<mac_id_t> ref_daemons;  // Distinct, a few at most
+};
+
+/**
+ * @brief An entry of `delPageRDMARef`. `new_daemon_id` is where the page is migrating to, or
+ * `master_id` if unknown or freed.
+ */
+struct PageRefInvalidation {
+    page_id_t page_id;
+    mac_id_t new_daemon_id;
 };
 
 struct RackMacTable {
-    size_t GetCurrentAllocatedPageNum() const { return current_allocated_page_num; }
+    size_t GetCurrentAllocatedPageNum() const {
+        return current_allocated_page_num.load(std::memory_order_relaxed);
+    }
     size_t GetMaxFreePageNum() const { return max_free_page_num; }
 
     bool with_cxl;
     MasterToDaemonConnection *daemon_connect;
     size_t max_free_page_num;
-    size_t current_allocated_page_num;
+    std::atomic<size_t> current_allocated_page_num;  // Updated by all shards
+    // Of the allocated pages, the page ids leased to the daemon and not allocated yet. Set by the
+    // reports of the daemon, and raised by the leases granted in between.
+    std::atomic<size_t> leased_page_num{0};
     std::vector<MasterToClientConnection *> client_connect_table;
+
+    // Load of the rack, counted by the master and turned into rates by its stats thread
+    std::atomic<uint64_t> dio_bytes{0};  // Direct io bytes other racks reported sending to it
+    std::atomic<uint64_t> swap_cnt{0};   // Pages migrated into or out of it
+    std::atomic<float> dio_rate{0};      // Bytes per second
+    std::atomic<float> swap_rate{0};     // Pages per second
+
+    // Pages of each class the free frames of the rack can back, as its daemon last reported.
+    // Large pages need contiguous frames, so they may be fewer than the free pages allow.
+    std::atomic<size_t> free_run_num[page_class_num];
+
+    /**
+     * @brief Pages of `page_class` the rack can still hold, as far as the master knows.
+     */
+    size_t GetFreePageNum(rcmp::PageSizeClass page_class) const {
+        size_t max_free_page_num = GetMaxFreePageNum();
+        size_t allocated_page_num = GetCurrentAllocatedPageNum();
+        if (allocated_page_num >= max_free_page_num) {
+            return 0;
+        }
+        size_t free_page_num = (max_free_page_num - allocated_page_num) / GetPageUnits(page_class);
+        if (page_class == rcmp::PAGE_4K) {
+            return free_page_num;
+        }
+        return std::min(free_page_num, free_run_num[page_class].load(std::memory_order_relaxed));
+    }
 };
 
-struct PageDirectory {
-    PageRackMetadata *FindPage(page_id_t page_id);
-    PageRackMetadata *AddPage(RackMacTable *rack_table, page_id_t page_id);
-    void RemovePage(RackMacTable *rack_table, page_id_t page_id);
+/**
+ * @brief Slot of the directory table the master exposes to one-sided rdma, indexed by page id.
+ * It publishes the cached ref of one page of the slot. Daemons read it under a shared latch
+ * taken by an rdma fetch-and-add on `latch`, so resolving a cached ref costs no master cpu.
+ */
+struct alignas(32) DirSlot {
+    constexpr static uint64_t exclusive_bit = 1ul << 63;
+
+    static uint64_t Tag(page_id_t page_id) { return page_id + 1; }
+
+    uint64_t latch;  // Number of one-sided readers, and `exclusive_bit` while the master writes
+    uint64_t tag;    // `Tag` of the page whose ref is published, 0 if none
+    uintptr_t ref_addr;
+    uint32_t ref_rkey;
+    mac_id_t daemon_id;
+};
+
+/**
+ * @brief Latches of the pages latched at the moment, created by the first latcher of a page and
+ * dropped by the last. Latches are held across rpcs to the daemons, so each page has its own, and
+ * latching a page never waits on another page.
+ */
+class PageLatchTable : public NOCOPYABLE {
+   public:
+    ~PageLatchTable();
+
+    void Lock(page_id_t page_id);
+    bool TryLock(page_id_t page_id);
+    void Unlock(page_id_t page_id);
+    void LockShared(page_id_t page_id);
+    void UnlockShared(page_id_t page_id);
+
+   private:
+    struct Latch {
+        CortSharedMutex mtx;
+        size_t pins = 0;  // Fibers holding or waiting for the latch, guarded by the bucket
+    };
+    struct Bucket {
+        SpinMutex lck;
+        robin_hood::unordered_flat_map<page_id_t, Latch *, std::hash<page_id_t>> latches;
+    };
+
+    constexpr static size_t bucket_num = 1024;
+
+    Bucket &bucketOf(page_id_t page_id) { return m_buckets[page_id % bucket_num]; }
+    // Find or create the latch of a page, held until `unpin`
+    Latch *pin(page_id_t page_id);
+    void unpin(page_id_t page_id);
+
+    Bucket m_buckets[bucket_num];
+};
+
+/**
+ * @brief Locations of all pages, kept by the master as extents ordered by their start, so the
+ * directory costs memory per extent rather than per page. Extents are partitioned by the id ranges
+ * of the master shards, so shards only contend on the partitions they share.
+ */
+class PageDirectory : public NOCOPYABLE {
+   public:
+    constexpr static size_t dir_slot_num = 1ul << 14;
+
+    PageDirectory();
+    ~PageDirectory();
+
+    /**
+     * @brief The master shard owning `page_id`. Ranges of ids are dealt to the shards round robin.
+     */
+    static size_t ShardOf(page_id_t page_id, size_t shard_num) {
+        return (page_id >> master_shard_range_bits) % shard_num;
+    }
+
+    /**
+     * @brief Partition the extents for `shard_num` shards, before any page is added.
+     */
+    void Init(size_t shard_num);
+
+    /**
+     * @brief Find the extent holding `page_id`, copied to `extent`.
+     *
+     * @return false if the page isn't allocated
+     */
+    bool FindPage(page_id_t page_id, PageExtent *extent);
+
+    /**
+     * @brief Add `count` pages of `page_class` starting at `start_page_id` on the rack, merged
+     * into the extent before them if they are contiguous on the same daemon.
+     */
+    void AddPages(RackMacTable *rack_table, page_id_t start_page_id, size_t count,
+                  rcmp::PageSizeClass page_class);
+
+    /**
+     * @brief Remove `count` pages of `page_class` starting at `start_page_id` on the rack, with
+     * their ref caches.
+     */
+    void RemovePages(RackMacTable *rack_table, page_id_t start_page_id, size_t count,
+                     rcmp::PageSizeClass page_class);
+
+    /**
+     * @brief Move a page to another daemon, splitting it out of its extent.
+     */
+    void MovePage(page_id_t page_id, uint32_t rack_id, mac_id_t daemon_id);
+
+    /**
+     * @brief Latch a page, which may be held across rpcs. A fiber latching several pages locks
+     * them in the order of their ids, or only try-latches the others.
+     */
+    void LatchPage(page_id_t page_id, bool exclusive) {
+        exclusive ? m_latches.Lock(page_id) : m_latches.LockShared(page_id);
+    }
+    bool TryLatchPage(page_id_t page_id) { return m_latches.TryLock(page_id); }
+    void UnlatchPage(page_id_t page_id, bool exclusive) {
+        exclusive ? m_latches.Unlock(page_id) : m_latches.UnlockShared(page_id);
+    }
+
+    /**
+     * @brief The ref cache of a page, created if `create`. The page must be latched.
+     */
+    PageRefCache *GetRefCache(page_id_t page_id, bool create);
+
+    size_t ExtentNum();
+
+    /**
+     * @brief The slot table for one-sided resolution, of `dir_slot_num` slots.
+     */
+    DirSlot *DirSlots() { return m_dir_slots.get(); }
+
+    /**
+     * @brief Publish the ref of a page on `daemon_id` to its slot, replacing the page published
+     * before. The page must be latched.
+     */
+    void PublishRef(page_id_t page_id, mac_id_t daemon_id, uintptr_t addr, uint32_t rkey);
+
+    /**
+     * @brief Withdraw the ref of a page from its slot, if published. The page must be latched.
+     */
+    void UnpublishRef(page_id_t page_id);
 
-    ConcurrentHashMap<page_id_t, PageRackMetadata *, CortSharedMutex> table;
     std::unique_ptr<IDGenerator> page_id_allocator;
+
+   private:
+    using ExtentMap = std::map<page_id_t, PageExtent>;
+
+    // Extents never cross an id range, so each lives in the partition of its shard
+    struct Partition {
+        SharedMutex lck;
+        ExtentMap extents;
+    };
+
+    Partition &partitionOf(page_id_t page_id) {
+        return m_partitions[ShardOf(page_id, m_partition_num)];
+    }
+
+    // Call `fn(start, count)` for the pieces of the ids [start, start + count) in each id range
+    template <typename F>
+    static void forEachRange(page_id_t start, size_t count, F &&fn) {
+        page_id_t end = start + count;
+        while (start < end) {
+            page_id_t range_end = ((start >> master_shard_range_bits) + 1)
+                                  << master_shard_range_bits;
+            page_id_t piece_end = std::min(range_end, end);
+            fn(start, piece_end - start);
+            start = piece_end;
+        }
+    }
+
+    static ExtentMap::iterator findExtentLocked(ExtentMap &extents, page_id_t page_id);
+    // Split the extent at `page_id`, returning the extent starting there
+    static ExtentMap::iterator splitLocked(ExtentMap &extents, ExtentMap::iterator it,
+                                           page_id_t page_id);
+    // Merge the extent into the one before it if they can form one extent
+    static ExtentMap::iterator mergePrevLocked(ExtentMap &extents, ExtentMap::iterator it);
+
+    // Exclude one-sided readers and other writers of the slot
+    static void lockSlot(DirSlot &slot);
+    static void unlockSlot(DirSlot &slot);
+
+    size_t m_partition_num = 1;
+    std::unique_ptr<Partition[]> m_partitions;
+
+    PageLatchTable m_latches;
+    std::unique_ptr<DirSlot[]> m_dir_slots;
+    ConcurrentHashMap<page_id_t, PageRefCache *> m_ref_caches;
 };
 
 struct DaemonToClientConnection;
 struct DaemonToDaemonConnection;
 
+/**
+ * @brief Entry of the page slot table, one per page frame of the page data zone. It tags the page
+ * held by the frame, so that daemons holding a ref of the page can validate their direct io with a
+ * one-sided read instead of being invalidated synchronously when the page leaves.
+ */
+struct PageSlot {
+    constexpr static uint64_t moved_tag = 0;
+    // The high bits count the daemons pinning the page for a CAS, which holds off the seal, so a
+    // pinned CAS is done on the page exactly once.
+    constexpr static uint64_t pin_shift = 48;
+    constexpr static uint64_t pin_unit = 1ul << pin_shift;
+    constexpr static uint64_t tag_mask = pin_unit - 1;
+
+    static uint64_t Tag(page_id_t page_id) { return page_id + 1; }
+    static bool Match(uint64_t slot_tag, page_id_t page_id) {
+        return (slot_tag & tag_mask) == Tag(page_id);
+    }
+
+    volatile uint64_t tag;
+};
+
+/**
+ * @brief Set of connections referencing a page, by their `ref_idx`. Indexes below 64 live in one
+ * atomic word, so tracking a referencer is one `fetch_or`. Larger ones fall back to a locked set
+ * allocated on first use.
+ */
+class RefBitmap : public NOCOPYABLE {
+   public:
+    constexpr static uint32_t inline_bits = 64;
+
+    RefBitmap() = default;
+    ~RefBitmap() { delete m_overflow.load(std::memory_order_relaxed); }
+
+    void Insert(uint32_t idx) {
+        if (idx < inline_bits) {
+            uint64_t bit = 1ul << idx;
+            // Skip the write on the common repeated hit, keeping the cache line shared
+            if ((m_bits.load(std::memory_order_relaxed) & bit) == 0) {
+                m_bits.fetch_or(bit, std::memory_order_relaxed);
+            }
+            return;
+        }
+
+        OverflowSet *overflow = m_overflow.load(std::memory_order_acquire);
+        if (overflow == nullptr) {
+            OverflowSet *new_overflow = new OverflowSet();
+            if (m_overflow.compare_exchange_strong(overflow, new_overflow,
+                                                   std::memory_order_acq_rel)) {
+                overflow = new_overflow;
+            } else {
+                delete new_overflow;
+            }
+        }
+        std::lock_guard<SpinMutex> lck(overflow->lck);
+        overflow->ids.insert(idx);
+    }
+
+    bool Empty() const {
+        if (m_bits.load(std::memory_order_relaxed) != 0) {
+            return false;
+        }
+        OverflowSet *overflow = m_overflow.load(std::memory_order_acquire);
+        if (overflow == nullptr) {
+            return true;
+        }
+        std::lock_guard<SpinMutex> lck(overflow->lck);
+        return overflow->ids.empty();
+    }
+
+    /**
+     * @brief Merge the referencers into `bits`, for the inline part only. Returns false if the
+     * overflow part is not empty.
+     */
+    bool MergeInline(uint64_t &bits) const {
+        bits |= m_bits.load(std::memory_order_relaxed);
+        return m_overflow.load(std::memory_order_acquire) == nullptr;
+    }
+
+    template <typename F>
+    void ForEach(F &&fn) const {
+        ForEachBit(m_bits.load(std::memory_order_relaxed), fn);
+
+        OverflowSet *overflow = m_overflow.load(std::memory_order_acquire);
+        if (overflow != nullptr) {
+            // `fn` may yield, which must not happen under the spin lock
+            std::vector<uint32_t> ids;
+            {
+                std::lock_guard<SpinMutex> lck(overflow->lck);
+                ids.assign(overflow->ids.begin(), overflow->ids.end());
+            }
+            for (uint32_t idx : ids) {
+                fn(idx);
+            }
+        }
+    }
+
+    template <typename F>
+    static void ForEachBit(uint64_t bits, F &&fn) {
+        while (bits != 0) {
+            fn(static_cast<uint32_t>(__builtin_ctzll(bits)));
+            bits &= bits - 1;
+        }
+    }
+
+   private:
+    struct OverflowSet {
+        SpinMutex lck;
+        std::set<uint32_t> ids;
+    };
+
+    std::atomic<uint64_t> m_bits{0};
+    std::atomic<OverflowSet *> m_overflow{nullptr};
+};
+
 struct PageVMMapMetadata {
-    offset_t cxl_memory_offset;  // Relative to `format.page_data_start_addr`
-    std::set<DaemonToClientConnection *> ref_client;
-    std::set<DaemonToDaemonConnection *> ref_daemon;
+    offset_t cxl_memory_offset;      // Relative to `format.page_data_start_addr`
+    rcmp::PageSizeClass page_class;  // The page occupies `GetPageUnits(page_class)` frames
+    RefBitmap ref_client;            // By `DaemonToClientConnection::ref_idx`
+    RefBitmap ref_daemon;            // By `DaemonToDaemonConnection::ref_idx`
 };
 
 struct RemotePageRefMeta {
     volatile int version;
     volatile bool swapping = false;
+    // Registered on the owner, which deletes the ref before reusing the frame. Refs read from the
+    // directory slot aren't, and only serve reads, which the page slot validates after the io.
+    volatile bool tracked = true;
     FreqStats stats;
     uintptr_t remote_page_addr;
     uint32_t remote_page_rkey;
@@ -67,29 +425,56 @@ struct RemotePageRefMeta {
 };
 
 struct PageMetadata {
-    uint32_t version;
+    uint32_t version;  // Bumped when reclaimed, so that stale hints of clients mismatch
     CortSharedMutex page_ref_lock;
     CortMutex remote_ref_lock;
     PageVMMapMetadata *vm_meta = nullptr;
     RemotePageRefMeta *remote_ref_meta = nullptr;
+    rcmp::PageSizeClass page_class = rcmp::PAGE_4K;
+
+    // Directory lease: the daemon believed to own the page, learned from the directory or from the
+    // last invalidation. The ref can be asked from it directly before `dir_lease_expire_us`.
+    mac_id_t dir_lease_daemon_id = master_id;
+    uint64_t dir_lease_expire_us = 0;
 };
 
+/**
+ * @brief The page table of daemon. Lookups are lock-free, and must be done within an `EpochGuard`
+ * of `epoch` if the page may be erased concurrently.
+ */
 struct PageTableManager {
+    /**
+     * @brief `fn` may be called even if another page meta wins the insertion.
+     */
     template <typename F, typename... Args>
     PageMetadata *FindOrCreatePageMeta(page_id_t page_id, F &&fn, Args &&...args) {
-        auto p = table.find_or_emplace(page_id, [&]() {
-            PageMetadata *page_meta = new PageMetadata();
-            fn(page_meta, std::move(args)...);
+        PageMetadata *page_meta = table.find(page_id);
+        if (page_meta != nullptr) {
             return page_meta;
-        });
-        return p.first->second;
+        }
+
+        page_meta = AllocPageMeta();
+        fn(page_meta, std::move(args)...);
+        return insertPageMeta(page_id, page_meta);
     }
 
     PageMetadata *FindOrCreatePageMeta(page_id_t page_id) {
-        auto p = table.find_or_emplace(page_id, [&]() { return new PageMetadata(); });
-        return p.first->second;
+        PageMetadata *page_meta = table.find(page_id);
+        if (page_meta != nullptr) {
+            return page_meta;
+        }
+
+        return insertPageMeta(page_id, AllocPageMeta());
     }
 
+    PageMetadata *AllocPageMeta();
+    /**
+     * @brief Erase the page meta of a page without memory or ref, which is reused after all guards
+     * that may see it leave. The memory of page metas is never released, since clients hold them
+     * as hints.
+     */
+    void ErasePageMeta(page_id_t page_id, PageMetadata *page_meta);
+
     template <typename F, typename... Args>
     RemotePageRefMeta *FindOrCreateRemotePageRefMeta(PageMetadata *page_meta, F &&fn,
                                                      Args &&...args) {
@@ -115,16 +500,47 @@ struct PageTableManager {
     }
 
     void EraseRemotePageRefMeta(PageMetadata *page_meta);
-    PageVMMapMetadata *AllocPageMemory();
+    /**
+     * @brief Allocate the frames of a page.
+     *
+     * @return PageVMMapMetadata* nullptr if the memory is full, or has no contiguous frames for a
+     * large page
+     */
+    PageVMMapMetadata *AllocPageMemory(rcmp::PageSizeClass page_class = rcmp::PAGE_4K);
     void FreePageMemory(PageVMMapMetadata *page_vm_meta);
-    void ApplyPageMemory(PageMetadata *page_meta, PageVMMapMetadata *page_vm_meta);
-    void CancelPageMemory(PageMetadata *page_meta);
-    bool PickUnvisitPage(page_id_t &page_id, PageMetadata *&page_meta);
-    std::vector<std::pair<page_id_t, PageMetadata *>> RandomPickVMPage(size_t n);
+    void ApplyPageMemory(page_id_t page_id, PageMetadata *page_meta,
+                         PageVMMapMetadata *page_vm_meta);
+    /**
+     * @brief Mark the page as moved in its slot, after the pinned CASes on it are done. Must be
+     * called before the page data leaves.
+     */
+    void SealPageMemory(PageMetadata *page_meta);
+    /**
+     * @brief Detach the page memory. The frame is not reused until `ref_del_fu_vec` are all done,
+     * since the daemons still holding the ref may access it till then.
+     */
+    void CancelPageMemory(PageMetadata *page_meta,
+                          std::vector<boost::fibers::shared_future<void>> ref_del_fu_vec = {});
+
+    PageSlot *GetPageSlot(offset_t cxl_memory_offset) {
+        return &page_slot_table[cxl_memory_offset / page_size];
+    }
+    void AddUnvisitPage(page_id_t page_id, PageMetadata *page_meta) {
+        std::lock_guard<SpinMutex> lck(unvisited_pages_lck);
+        unvisited_pages.push({page_id, page_meta});
+    }
 
-    // TODO: release page meta resource when vm_meta and remote_ref_meta are nullptr
+    /**
+     * @brief Pick a local page of `page_class` not referenced by clients, and lock it.
+     */
+    bool PickUnvisitPage(page_id_t &page_id, PageMetadata *&page_meta,
+                         rcmp::PageSizeClass page_class);
+    std::vector<std::pair<page_id_t, PageMetadata *>> RandomPickVMPage(
+        size_t n, rcmp::PageSizeClass page_class);
 
-    bool NearlyFull() const { return current_used_page_num == max_data_page_num; }
+    bool NearlyFull(size_t count = 1) const {
+        return current_used_page_num + count > max_data_page_num;
+    }
 
     bool TestAllocPageMemory(size_t count = 1) const {
         return current_used_page_num + count <= total_page_num;
@@ -132,17 +548,38 @@ struct PageTableManager {
 
     size_t GetCurrentUsedPageNum() const { return current_used_page_num; }
 
+    /**
+     * @brief Number of pages of `page_class` the free frames can back, as reported to the master.
+     */
+    size_t FreePageNum(rcmp::PageSizeClass page_class) {
+        size_t free_page_num = (total_page_num - current_used_page_num) / GetPageUnits(page_class);
+        if (page_class == rcmp::PAGE_4K) {
+            return free_page_num;
+        }
+        return std::min(free_page_num, page_allocator->FreeRunNum(GetPageUnits(page_class)));
+    }
+
     uint64_t heat_half_life_us;
 
+    // Counted in frames of `page_size`
     size_t total_page_num;     // Number of all pages
     size_t max_swap_page_num;  // Number of pages in swap area
     size_t max_data_page_num;  // Number of all available data pages
 
     std::atomic<size_t> current_used_page_num;  // Number of data pages currently in use
 
-    RandomAccessMap<page_id_t, PageMetadata *, CortSharedMutex> table;
-    std::queue<std::pair<page_id_t, PageMetadata *>> unvisited_pages;  // lock unsafe
+    PageSlot *page_slot_table;  // Located in the reserve zone of cxl memory, registered to rdma
+
+    RadixTable<page_id_t, PageMetadata *> table;
+    EpochManager epoch;
+    SpinMutex page_meta_pool_lck;
+    std::vector<PageMetadata *> page_meta_pool;  // Reclaimed page metas
+    SpinMutex unvisited_pages_lck;
+    std::queue<std::pair<page_id_t, PageMetadata *>> unvisited_pages;
     std::unique_ptr<SingleAllocator<page_size>> page_allocator;
+
+   private:
+    PageMetadata *insertPageMeta(page_id_t page_id, PageMetadata *page_meta);
 };
 
 struct LocalPageCache {
@@ -178,6 +615,33 @@ struct PageCacheTable {
     robin_hood::unordered_flat_map<page_id_t, PageCacheMeta *, std::hash<page_id_t>> table;
 };
 
+/**
+ * @brief Blocks of base page ids the daemon leased from the master. The master has already placed
+ * them on this daemon, so allocating from them needs no master round trip.
+ */
+class PageIDLease : public NOCOPYABLE {
+   public:
+    /**
+     * @brief Take `count` contiguous ids from the oldest block holding enough.
+     *
+     * @return page_id_t The first id, or `invalid_page_id` if no block holds enough
+     */
+    page_id_t Take(size_t count);
+    void Add(page_id_t start_page_id, size_t count);
+    /**
+     * @brief Take all blocks left, to return them to the master.
+     */
+    std::deque<std::pair<page_id_t, size_t>> TakeAll();
+    size_t Remaining() const { return m_remaining.load(std::memory_order_relaxed); }
+
+    std::atomic<bool> refilling{false};  // Whether a lease is being asked from the master
+
+   private:
+    SpinMutex m_lck;
+    std::deque<std::pair<page_id_t, size_t>> m_blocks;
+    std::atomic<size_t> m_remaining{0};
+};
+
 struct PageThreadLocalCache;
 
 struct PageThreadCacheManager {
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "common.hpp"
+#include "options.hpp"
+
+struct RackMacTable;
+
+/**
+ * @brief Policy placing the pages a rack can't hold on other racks. Candidates carry the load of
+ * each rack sampled by the master, so a policy can spread the overflow instead of filling racks
+ * in the order of the rack table.
+ */
+class PlacementPolicy {
+   public:
+    struct Candidate {
+        RackMacTable *rack_table;
+        size_t free_page_num;  // Pages of the allocated class the rack can hold
+        float dio_rate;        // Direct io bytes per second the rack serves to other racks
+        float swap_rate;       // Pages per second migrated into or out of the rack
+        uint32_t distance;     // From the requesting rack, 1 if near
+        size_t alloc_cnt = 0;  // Pages placed on the rack, filled by `Place`
+    };
+
+    PlacementPolicy(const rcmp::MasterOptions &options)
+        : m_rack_group_size(options.rack_group_size) {}
+    virtual ~PlacementPolicy() = default;
+
+    /**
+     * @brief Create the policy named by `options.placement_policy`.
+     */
+    static std::unique_ptr<PlacementPolicy> Create(const rcmp::MasterOptions &options);
+
+    /**
+     * @brief Place up to `count` pages on the candidates by filling their `alloc_cnt`.
+     *
+     * @return size_t The number of pages placed, less than `count` if the racks are full
+     */
+    virtual size_t Place(std::vector<Candidate> &candidates, size_t count) = 0;
+
+    uint32_t RackDistance(rack_id_t a, rack_id_t b) const {
+        if (m_rack_group_size == 0 || a / m_rack_group_size == b / m_rack_group_size) {
+            return 1;
+        }
+        return 2;
+    }
+
+   private:
+    size_t m_rack_group_size;
+};
+
+/**
+ * @brief Fill the candidates in order, which was the placement before policies.
+ */
+class FirstFitPlacement : public PlacementPolicy {
+   public:
+    using PlacementPolicy::PlacementPolicy;
+
+    size_t Place(std::vector<Candidate> &candidates, size_t count) override;
+};
+
+/**
+ * @brief Spread the pages over the candidates in proportion to their weights, which grow with
+ * the free pages and shrink with the load and distance of the rack. Pages left after the
+ * proportional shares are drawn by weight, so small allocations also spread.
+ */
+class WeightedPlacement : public PlacementPolicy {
+   public:
+    using PlacementPolicy::PlacementPolicy;
+
+    size_t Place(std::vector<Candidate> &candidates, size_t count) override;
+
+   private:
+    // Loads halving the weight of a rack
+    constexpr static double dio_rate_ref = 1ul << 30;
+    constexpr static double swap_rate_ref = 1000;
+
+    static double weight(const Candidate &c);
+};
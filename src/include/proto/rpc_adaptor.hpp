@@ -2,10 +2,12 @@
 
 #include <boost/fiber/future/async.hpp>
 #include <future>
+#include <optional>
 #include <type_traits>
 
 #include "allocator.hpp"
 #include "eRPC/erpc.h"
+#include "fiber_pool.hpp"
 #include "log.hpp"
 #include "msg_queue.hpp"
 #include "proto/rpc_caller.hpp"
@@ -112,13 +114,36 @@ struct MsgQResponseHandle : public ResponseHandle<ResponseType> {
     msgq::MsgBuffer resp_raw;
 };
 
+/**
+ * @brief Whether the request has a task class, by a `GetTaskClass(req)` found through ADL.
+ */
+template <typename RequestType, typename = void>
+struct HasTaskClass : std::false_type {};
+
+template <typename RequestType>
+struct HasTaskClass<RequestType,
+                    std::void_t<decltype(GetTaskClass(std::declval<const RequestType &>()))>>
+    : std::true_type {};
+
+template <typename RequestType>
+TaskClass RequestTaskClass(const RequestType &req) {
+    if constexpr (HasTaskClass<RequestType>::value) {
+        return GetTaskClass(req);
+    } else {
+        return TaskClass::Normal;
+    }
+}
+
 template <typename EFW, bool ESTABLISH>
 void erpc_call_target(erpc::ReqHandle *req_handle, void *context) {
     auto self_ctx = reinterpret_cast<typename EFW::SelfContext *>(context);
     uint64_t perf_stat_timer;
     self_ctx->m_stats.start_sample(perf_stat_timer);
 
-    self_ctx->GetFiberPool().EnqueueTask([self_ctx, req_handle, perf_stat_timer]() mutable {
+    TaskClass cls = RequestTaskClass(*reinterpret_cast<typename EFW::RequestType *>(
+        erpc::ReqHandleWrap(req_handle).get_req_msgbuf().get_buf()));
+
+    auto task = [self_ctx, req_handle, perf_stat_timer]() mutable {
         auto &rpc = self_ctx->GetErpc();
         erpc::ReqHandleWrap req_wrap(req_handle);
         ErpcResponseHandle<typename EFW::ResponseType> resp_handle(rpc, req_wrap);
@@ -139,16 +164,43 @@ void erpc_call_target(erpc::ReqHandle *req_handle, void *context) {
         rpc.enqueue_response(req_wrap, resp_handle.GetBuffer());
 
         self_ctx->m_stats.rpc_exec_sample(perf_stat_timer);
-    });
+    };
+    static_assert(FiberTask::fits_inline<decltype(task)>,
+                  "The erpc handler task must be queued without touching the heap");
+
+    self_ctx->GetFiberPool().EnqueueTask(cls, std::move(task));
 }
 
+/**
+ * @brief Whether the request is bound to a page, by a `GetShardPageID(req)` found through ADL.
+ */
+template <typename RequestType, typename = void>
+struct HasShardPageID : std::false_type {};
+
+template <typename RequestType>
+struct HasShardPageID<RequestType,
+                      std::void_t<decltype(GetShardPageID(std::declval<const RequestType &>()))>>
+    : std::true_type {};
+
 template <typename EFW, bool ESTABLISH>
 void msgq_call_target(msgq::MsgBuffer &req_raw, void *ctx) {
     auto self_ctx = reinterpret_cast<typename EFW::SelfContext *>(ctx);
     uint64_t perf_stat_timer;
     self_ctx->m_stats.start_sample(perf_stat_timer);
 
-    self_ctx->GetFiberPool().EnqueueTask([self_ctx, req_raw, perf_stat_timer]() mutable {
+    FiberPool *fiber_pool;
+    if constexpr (HasShardPageID<typename EFW::RequestType>::value) {
+        // Run on the worker owning the page, so that the page is mostly touched by one thread
+        auto req = reinterpret_cast<typename EFW::RequestType *>(req_raw.get_buf());
+        fiber_pool = &self_ctx->GetShardFiberPool(GetShardPageID(*req));
+    } else {
+        fiber_pool = &self_ctx->GetFiberPool();
+    }
+
+    TaskClass cls =
+        RequestTaskClass(*reinterpret_cast<typename EFW::RequestType *>(req_raw.get_buf()));
+
+    auto task = [self_ctx, req_raw, perf_stat_timer]() mutable {
         auto req = reinterpret_cast<typename EFW::RequestType *>(req_raw.get_buf());
 
         typename EFW::PeerContext *peer_connection = nullptr;
@@ -181,7 +233,11 @@ void msgq_call_target(msgq::MsgBuffer &req_raw, void *ctx) {
         rpc->free_msg_buffer(req_raw);
 
         self_ctx->m_stats.rpc_exec_sample(perf_stat_timer);
-    });
+    };
+    static_assert(FiberTask::fits_inline<decltype(task)>,
+                  "The msgq handler task must be queued without touching the heap");
+
+    fiber_pool->EnqueueTask(cls, std::move(task));
 }
 
 }  // namespace detail
@@ -269,9 +325,10 @@ struct ErpcFuture {
 };
 
 struct ErpcClient {
-    ErpcClient(erpc::IBRpcWrap &rpc, std::string ip, uint16_t port) : rpc(rpc) {
+    ErpcClient(erpc::IBRpcWrap &rpc, std::string ip, uint16_t port, uint8_t remote_rpc_id = 0)
+        : rpc(rpc) {
         std::string server_uri = erpc::concat_server_uri(ip, port);
-        peer_session = rpc.create_session(server_uri, 0);
+        peer_session = rpc.create_session(server_uri, remote_rpc_id);
     }
 
     ErpcClient(erpc::IBRpcWrap &rpc, int peer_session) : rpc(rpc), peer_session(peer_session) {}
@@ -304,7 +361,7 @@ struct ErpcClient {
         fu.resp_raw = rpc.alloc_msg_buffer_or_die(sizeof(ResponseType) + 64);
 
         auto req_buf = reinterpret_cast<RequestType *>(fu.req_raw.get_buf());
-        copy_fn(req_buf, std::move(args...));
+        copy_fn(req_buf, std::move(args)...);
 
         rpc.enqueue_request(peer_session, RpcCallerWrapper::rpc_type, fu.req_raw, fu.resp_raw,
                             erpc_general_promise_cb<PromiseType>, static_cast<void *>(fu.pro));
@@ -398,6 +455,8 @@ struct MsgQClient {
         using ResponseType = typename RpcCallerWrapper::ResponseType;
         using PromiseType = PromiseTType<msgq::MsgBuffer>;
 
+        rpc.acquire_credit();
+
         MsgQFuture<ResponseType, PromiseType> fu;
         fu.rpc = &rpc;
         fu.pro = new (ObjectPoolAllocator<PromiseType>().allocate(1)) PromiseType();
@@ -413,6 +472,41 @@ struct MsgQClient {
         return fu;
     }
 
+    /**
+     * @brief Call without blocking. Returns no future when the credit window is used up or the
+     * queue is full, for the caller to back off.
+     */
+    template <template <typename T> class PromiseTType, typename RpcFuncType,
+              typename Fn = std::remove_reference_t<RpcFuncType>>
+    auto try_call(RpcFuncType &&_, typename ::detail::RpcCallerWrapper<Fn>::RequestType &&req) {
+        using RpcCallerWrapper = ::detail::RpcCallerWrapper<Fn>;
+        using RequestType = typename RpcCallerWrapper::RequestType;
+        using ResponseType = typename RpcCallerWrapper::ResponseType;
+        using PromiseType = PromiseTType<msgq::MsgBuffer>;
+
+        std::optional<MsgQFuture<ResponseType, PromiseType>> fu;
+        if (!rpc.try_acquire_credit()) {
+            return fu;
+        }
+        msgq::MsgBuffer req_raw;
+        if (!rpc.try_alloc_msg_buffer(sizeof(RequestType), req_raw)) {
+            rpc.m_credits->release();
+            return fu;
+        }
+
+        fu.emplace();
+        fu->rpc = &rpc;
+        fu->pro = new (ObjectPoolAllocator<PromiseType>().allocate(1)) PromiseType();
+        fu->req_raw = req_raw;
+
+        *reinterpret_cast<RequestType *>(req_raw.get_buf()) = std::move(req);
+
+        rpc.enqueue_request(RpcCallerWrapper::rpc_type, fu->req_raw,
+                            msgq_general_promise_cb<PromiseType>, static_cast<void *>(fu->pro));
+
+        return fu;
+    }
+
     template <typename PromiseType>
     static void msgq_general_promise_cb(msgq::MsgBuffer &resp, void *pr) {
         PromiseType *pro = reinterpret_cast<PromiseType *>(pr);
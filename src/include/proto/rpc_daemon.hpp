@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include "common.hpp"
@@ -21,6 +22,8 @@ struct JoinRackReply {
     mac_id_t client_mac_id;
     mac_id_t daemon_mac_id;
     float half_life_us;
+    int msgq_credit_window;         // Requests the client may have in flight to the daemon
+    offset_t stream_bounce_offset;  // From the start of the CXL memory
 };
 /**
  * @brief Adds client to the rack. Called when the connection is established.
@@ -40,15 +43,34 @@ struct CrossRackConnectRequest {
     uint16_t port;
     rack_id_t rack_id;
     mac_id_t conn_mac_id;
+    uintptr_t page_slot_table_addr;
+    uint32_t page_slot_table_rkey;
+    uintptr_t page_data_start_addr;
+    int worker_num;
 };
 struct CrossRackConnectReply {
     mac_id_t daemon_mac_id;
     uint16_t rdma_port;
+    uintptr_t page_slot_table_addr;
+    uint32_t page_slot_table_rkey;
+    uintptr_t page_data_start_addr;
+    int worker_num;
 };
 void crossRackConnect(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon_connection,
                       CrossRackConnectRequest& req,
                       ResponseHandle<CrossRackConnectReply>& resp_handle);
 
+/**
+ * @brief A slot of the bounce region in CXL memory owned by a client. The data of a stream io is
+ * staged in the slot, and its producer, the client for writes and the daemon for reads, publishes
+ * how much has landed, so the consumer works on chunks while the rest is in flight.
+ */
+struct StreamBounceSlot {
+    alignas(cache_line_size) std::atomic<size_t> ready_size;
+    alignas(cache_line_size) uint64_t tags[stream_window];  // Page slots read after the chunks
+    alignas(page_size) uint8_t data[stream_bounce_size];
+};
+
 struct GetPageCXLRefOrProxyRequest {
     mac_id_t mac_id;
     enum {
@@ -56,6 +78,8 @@ struct GetPageCXLRefOrProxyRequest {
         WRITE,
         WRITE_RAW,
         CAS,
+        STREAM_READ,
+        STREAM_WRITE,
     } type;
     rcmp::GAddr gaddr;
     uint32_t hint_version;
@@ -76,8 +100,18 @@ struct GetPageCXLRefOrProxyRequest {
             size_t expected;
             size_t desired;
         } cas;
+        struct {  // type == STREAM_READ or STREAM_WRITE
+            size_t size;
+            offset_t bounce_offset;  // Of the `StreamBounceSlot`, from the start of the CXL memory
+        } stream;
     } u;
 };
+inline page_id_t GetShardPageID(const GetPageCXLRefOrProxyRequest& req) {
+    return GetPageID(req.gaddr);
+}
+inline TaskClass GetTaskClass(const GetPageCXLRefOrProxyRequest& req) {
+    return TaskClass::LatencyCritical;
+}
 struct GetPageCXLRefOrProxyReply {
     bool refs;
     uint32_t hint_version;
@@ -114,6 +148,7 @@ struct AllocPageMemoryRequest {
     mac_id_t mac_id;
     page_id_t start_page_id;
     size_t count;
+    rcmp::PageSizeClass page_class;
 };
 struct AllocPageMemoryReply {
     bool ret;
@@ -142,6 +177,7 @@ void alloc(DaemonContext& daemon_context, DaemonToClientConnection& client_conne
 struct AllocPageRequest {
     mac_id_t mac_id;
     size_t count;
+    rcmp::PageSizeClass page_class;
 };
 struct AllocPageReply {
     page_id_t start_page_id;  // Allocated start page id
@@ -162,6 +198,7 @@ struct FreePageRequest {
     mac_id_t mac_id;
     page_id_t start_page_id;
     size_t count;
+    rcmp::PageSizeClass page_class;
 };
 struct FreePageReply {
     bool ret;
@@ -192,13 +229,17 @@ struct GetPageRDMARefRequest {
     mac_id_t mac_id;
     page_id_t page_id;
 };
+inline TaskClass GetTaskClass(const GetPageRDMARefRequest& req) {
+    return TaskClass::LatencyCritical;
+}
 struct GetPageRDMARefReply {
+    bool ret;  // False if the page isn't on this daemon any more
     uintptr_t addr;
     uint32_t rkey;
 };
 /**
- * @brief Get a reference to the page. If the local Page Table does not have that page id, a remote
- * io is triggered.
+ * @brief Get a reference to the page. Fails if this daemon doesn't own the page, which happens when
+ * the requester's directory lease is stale.
  *
  * @param daemon_context
  * @param daemon_connection
@@ -210,20 +251,22 @@ void getPageRDMARef(DaemonContext& daemon_context, DaemonToDaemonConnection& dae
 
 struct DelPageRDMARefRequest {
     mac_id_t mac_id;
-    page_id_t page_id;  // Preparing to delete the page id of the ref
+    size_t page_num;
+    PageRefInvalidation pages[0];  // Preparing to delete the refs of the pages
 };
 struct DelPageRDMARefReply {
     bool ret;
 };
 /**
- * @brief Removes a reference to a page.
+ * @brief Removes the references to a batch of pages. Sent by the owner daemon or by the master for
+ * refs handed out from the directory cache, so a ref may be already deleted.
  *
  * @param daemon_context
  * @param daemon_connection
  * @param req
  * @param resp_handle
  */
-void delPageRDMARef(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon_connection,
+void delPageRDMARef(DaemonContext& daemon_context, DaemonConnection& peer_connection,
                     DelPageRDMARefRequest& req, ResponseHandle<DelPageRDMARefReply>& resp_handle);
 
 struct MigratePageRequest {
@@ -252,11 +295,21 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
 
 struct TryDelPageRequest {
     mac_id_t mac_id;
-    page_id_t page_id;
+    size_t page_num;
+    page_id_t page_ids[0];
 };
 struct TryDelPageReply {
-    bool ret;
+    size_t page_num;
+    bool rets[0];  // Whether each page is deleted, or busy and to be retried
 };
+/**
+ * @brief Delete the pages from the daemon, skipping those whose refs are in use
+ *
+ * @param daemon_context
+ * @param master_connection
+ * @param req
+ * @param resp_handle
+ */
 void tryDelPage(DaemonContext& daemon_context, DaemonToMasterConnection& master_connection,
                 TryDelPageRequest& req, ResponseHandle<TryDelPageReply>& resp_handle);
 
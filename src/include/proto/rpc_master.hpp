@@ -19,6 +19,10 @@ struct JoinDaemonReply {
     mac_id_t daemon_mac_id;
     mac_id_t master_mac_id;
     uint16_t rdma_port;
+    size_t shard_num;  // Shards of the master, which serve the pages by id range
+    // The `DirSlot` table for one-sided resolution, rkey 0 if not exposed
+    uintptr_t dir_slot_table_addr;
+    uint32_t dir_slot_table_rkey;
 
     struct RackInfo {
         rack_id_t rack_id;
@@ -65,6 +69,8 @@ void joinClient(MasterContext& master_context, MasterToClientConnection& client_
 struct AllocPageRequest {
     mac_id_t mac_id;
     size_t count;
+    rcmp::PageSizeClass page_class;
+    size_t local_page_num;  // Pages the requesting daemon has memory for
 };
 struct AllocPageReply {
     page_id_t current_start_page_id;  // Allocated start page id
@@ -90,6 +96,7 @@ struct FreePageRequest {
     mac_id_t mac_id;
     page_id_t start_page_id;
     size_t count;
+    rcmp::PageSizeClass page_class;
 };
 struct FreePageReply {
     bool ret;
@@ -105,6 +112,77 @@ struct FreePageReply {
 void freePage(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
               FreePageRequest& req, ResponseHandle<FreePageReply>& resp_handle);
 
+struct LeasePageIDRequest {
+    mac_id_t mac_id;
+    size_t count;
+};
+struct LeasePageIDReply {
+    page_id_t start_page_id;
+    size_t count;  // Number actually leased, 0 if the rack is full
+};
+/**
+ * @brief Lease a block of base page ids to the daemon, with the capacity of its rack reserved for
+ * them. The block is added to the directory as pages of the daemon at once, so the daemon can
+ * allocate pages from it without calling `allocPage()`. A lease takes at most a quarter of the
+ * free capacity of the rack, and `reportRackLoad()` asks the daemon to return its leases once
+ * they hold much of it.
+ *
+ * @param master_context
+ * @param daemon_connection
+ * @param req
+ * @param resp_handle
+ */
+void leasePageID(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                 LeasePageIDRequest& req, ResponseHandle<LeasePageIDReply>& resp_handle);
+
+struct ReturnPageIDRequest {
+    mac_id_t mac_id;
+    page_id_t start_page_id;
+    size_t count;
+};
+struct ReturnPageIDReply {
+    bool ret;
+};
+/**
+ * @brief Return a block of leased page ids the daemon hasn't allocated, with the capacity of its
+ * rack reserved for them.
+ *
+ * @param master_context
+ * @param daemon_connection
+ * @param req
+ * @param resp_handle
+ */
+void returnPageID(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                  ReturnPageIDRequest& req, ResponseHandle<ReturnPageIDReply>& resp_handle);
+
+struct RackLoad {
+    rack_id_t rack_id;
+    uint64_t dio_bytes;  // Direct io bytes sent to the rack since the last report
+};
+struct ReportRackLoadRequest {
+    mac_id_t mac_id;
+    size_t free_run_num[page_class_num];  // Pages of each class the free frames can back
+    size_t leased_page_num;               // Leased page ids not allocated yet
+    size_t rack_num;
+    RackLoad racks[0];
+};
+struct ReportRackLoadReply {
+    bool ret;
+    bool return_lease;  // The leases hold too much of the free capacity of the rack
+};
+/**
+ * @brief Report the rdma traffic the daemon sent to other racks, which the master can't observe.
+ * The master turns it into the rates weighing the racks in the placement of new pages. The report
+ * also carries the large pages the rack can still back, which fragmentation limits.
+ *
+ * @param master_context
+ * @param daemon_connection
+ * @param req
+ * @param resp_handle
+ */
+void reportRackLoad(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                    ReportRackLoadRequest& req, ResponseHandle<ReportRackLoadReply>& resp_handle);
+
 struct GetRackDaemonByPageIDRequest {
     page_id_t page_id;
 };
@@ -148,10 +226,37 @@ void latchRemotePage(MasterContext& master_context, MasterToDaemonConnection& da
                      LatchRemotePageRequest& req,
                      ResponseHandle<LatchRemotePageReply>& resp_handle);
 
+struct ResolvePageRDMARefRequest {
+    mac_id_t mac_id;
+    page_id_t page_id;
+};
+struct ResolvePageRDMARefReply {
+    rack_id_t dest_rack_id;
+    mac_id_t dest_daemon_id;
+    bool cached;  // If false, the page is shared latched and the ref must be got from the owner
+    uintptr_t addr;
+    uint32_t rkey;
+};
+/**
+ * @brief Resolve the rdma ref of the remote page from the directory cache. On a hit, the requester
+ * is recorded for invalidation and no latch is held. On a miss, the page is shared latched like
+ * `latchRemotePage`, and the ref got from the owner should be filled back by `unLatchRemotePage`.
+ *
+ * @param master_context
+ * @param daemon_connection
+ * @param req
+ * @param resp_handle
+ */
+void resolvePageRDMARef(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                        ResolvePageRDMARefRequest& req,
+                        ResponseHandle<ResolvePageRDMARefReply>& resp_handle);
+
 struct UnLatchRemotePageRequest {
     mac_id_t mac_id;
     bool exclusive;
     page_id_t page_id;
+    uintptr_t page_addr = 0;  // The ref got from the owner to cache, unused if `page_addr` is 0
+    uint32_t page_rkey = 0;
 };
 struct UnLatchRemotePageReply {
     bool ret;
@@ -172,6 +277,7 @@ struct tryMigratePageRequest {
     mac_id_t mac_id;
     bool exclusive;
     page_id_t page_id;
+    mac_id_t page_daemon_id;  // The daemon the requester's ref points to
     float page_heat;
     page_id_t page_id_swap;
 };
@@ -180,7 +286,8 @@ struct tryMigratePageReply {
 };
 /**
  * @brief Try migrate page, if success, all pages will locked. You need call `MigratePageDone` when
- * migrating is done.
+ * migrating is done. Fails if the page is no longer on `page_daemon_id`, since the requester's ref
+ * is invalidated lazily.
  *
  * @param master_context
  * @param daemon_connection
@@ -198,6 +305,8 @@ struct MigratePageDoneRequest {
     page_id_t page_id_swap;       // Swapped out page (originally local), if invalid, no swap
     mac_id_t new_daemon_id_swap;  // The peer's daemon id
     rack_id_t new_rack_id_swap;   // The peer's rack id
+    uintptr_t new_page_addr;      // The rdma ref of the swapin page on this daemon, 0 if unknown
+    uint32_t new_page_rkey;
 };
 struct MigratePageDoneReply {
     bool ret;
@@ -13,8 +13,12 @@ BIND_RPC_TYPE_STRUCT(rpc_master::allocPage);
 BIND_RPC_TYPE_STRUCT(rpc_master::freePage);
 BIND_RPC_TYPE_STRUCT(rpc_master::latchRemotePage);
 BIND_RPC_TYPE_STRUCT(rpc_master::unLatchRemotePage);
+BIND_RPC_TYPE_STRUCT(rpc_master::resolvePageRDMARef);
 BIND_RPC_TYPE_STRUCT(rpc_master::tryMigratePage);
 BIND_RPC_TYPE_STRUCT(rpc_master::MigratePageDone);
+BIND_RPC_TYPE_STRUCT(rpc_master::leasePageID);
+BIND_RPC_TYPE_STRUCT(rpc_master::returnPageID);
+BIND_RPC_TYPE_STRUCT(rpc_master::reportRackLoad);
 
 BIND_RPC_TYPE_STRUCT(rpc_daemon::joinRack);
 BIND_RPC_TYPE_STRUCT(rpc_daemon::crossRackConnect);
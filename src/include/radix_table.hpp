@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <random>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include "log.hpp"
+#include "utils.hpp"
+
+/**
+ * @brief A table of pointers keyed by a dense integer space, as a three-level radix tree.
+ *
+ * Lookups are lock-free, insertions and erasures are a CAS on the leaf slot. Inner nodes are
+ * created on demand and live as long as the table. The table doesn't own the values, whose
+ * reclamation after `erase` is up to the caller.
+ */
+template <typename K, typename V>
+class RadixTable : public NOCOPYABLE {
+    static_assert(std::is_integral<K>::value && std::is_pointer<V>::value,
+                  "RadixTable maps integers to pointers");
+
+    constexpr static size_t leaf_bits = 12;
+    constexpr static size_t mid_bits = 12;
+    constexpr static size_t root_bits = 16;
+
+    struct Leaf {
+        std::atomic<V> slots[1ul << leaf_bits];
+    };
+    struct Mid {
+        std::atomic<Leaf *> leaves[1ul << mid_bits];
+    };
+
+   public:
+    RadixTable() {
+        for (auto &m : m_root) {
+            m.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~RadixTable() {
+        for (auto &m : m_root) {
+            Mid *mid = m.load(std::memory_order_relaxed);
+            if (mid == nullptr) {
+                continue;
+            }
+            for (auto &l : mid->leaves) {
+                delete l.load(std::memory_order_relaxed);
+            }
+            delete mid;
+        }
+    }
+
+    size_t size() const { return m_size.load(std::memory_order_relaxed); }
+
+    V find(K key) const {
+        Leaf *leaf = getLeaf(key, false);
+        if (leaf == nullptr) {
+            return nullptr;
+        }
+        return leaf->slots[key & leaf_mask].load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Insert `value` unless `key` exists.
+     *
+     * @return std::pair<V, bool> The value in the table, and whether `value` is inserted
+     */
+    std::pair<V, bool> insert(K key, V value) {
+        Leaf *leaf = getLeaf(key, true);
+        V expected = nullptr;
+        if (leaf->slots[key & leaf_mask].compare_exchange_strong(expected, value,
+                                                                 std::memory_order_acq_rel)) {
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            updateMaxKey(key);
+            return {value, true};
+        }
+        return {expected, false};
+    }
+
+    /**
+     * @brief Erase `key` if it still maps to `value`.
+     */
+    bool erase(K key, V value) {
+        Leaf *leaf = getLeaf(key, false);
+        if (leaf == nullptr) {
+            return false;
+        }
+        if (leaf->slots[key & leaf_mask].compare_exchange_strong(value, nullptr,
+                                                                 std::memory_order_acq_rel)) {
+            m_size.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Sample up to `n` distinct entries passing `filter_fn` by probing random keys. Fewer
+     * entries are returned when the probes run out, for the key space may be sparse.
+     */
+    template <typename Generator, typename F>
+    std::vector<std::pair<K, V>> getRandomN(Generator &g, size_t n, F &&filter_fn) const {
+        std::vector<std::pair<K, V>> result;
+        if (n == 0 || size() == 0) {
+            return result;
+        }
+
+        std::unordered_set<K> picked;
+        std::uniform_int_distribution<K> dis(0, m_max_key.load(std::memory_order_relaxed));
+        for (size_t probe = 0; probe < n * max_probe_factor && result.size() < n; ++probe) {
+            K key = dis(g);
+            V value = find(key);
+            if (value != nullptr && filter_fn(std::make_pair(key, value)) &&
+                picked.insert(key).second) {
+                result.push_back({key, value});
+            }
+        }
+        return result;
+    }
+
+   private:
+    constexpr static size_t leaf_mask = (1ul << leaf_bits) - 1;
+    constexpr static size_t mid_mask = (1ul << mid_bits) - 1;
+    constexpr static size_t max_probe_factor = 32;
+
+    Leaf *getLeaf(K key, bool create) const {
+        size_t root_idx = key >> (leaf_bits + mid_bits);
+        DLOG_ASSERT(root_idx < (1ul << root_bits), "Key %lu is out of radix table", (size_t)key);
+
+        Mid *mid = m_root[root_idx].load(std::memory_order_acquire);
+        if (mid == nullptr) {
+            if (!create) {
+                return nullptr;
+            }
+            mid = createNode(m_root[root_idx]);
+        }
+
+        auto &leaf_ptr = mid->leaves[(key >> leaf_bits) & mid_mask];
+        Leaf *leaf = leaf_ptr.load(std::memory_order_acquire);
+        if (leaf == nullptr) {
+            if (!create) {
+                return nullptr;
+            }
+            leaf = createNode(leaf_ptr);
+        }
+        return leaf;
+    }
+
+    template <typename Node>
+    static Node *createNode(std::atomic<Node *> &node_ptr) {
+        // Value-initialized, which nulls all slots
+        Node *node = new Node();
+        Node *expected = nullptr;
+        if (!node_ptr.compare_exchange_strong(expected, node, std::memory_order_acq_rel)) {
+            delete node;
+            return expected;
+        }
+        return node;
+    }
+
+    void updateMaxKey(K key) {
+        K max_key = m_max_key.load(std::memory_order_relaxed);
+        while (max_key < key &&
+               !m_max_key.compare_exchange_weak(max_key, key, std::memory_order_relaxed)) {
+        }
+    }
+
+    mutable std::atomic<Mid *> m_root[1ul << root_bits];
+    std::atomic<size_t> m_size{0};
+    std::atomic<K> m_max_key{0};
+};
@@ -3,9 +3,11 @@
 #include <rdma/rdma_cma.h>
 
 #include <array>
+#include <atomic>
 
 #include "allocator.hpp"
 #include "fiber_pool.hpp"
+#include "lock.hpp"
 #include "promise.hpp"
 
 namespace rdma_rc {
@@ -51,11 +53,17 @@ struct SyncData {
     uint32_t now_ms;
     RDMAConnection *conn;
     volatile bool wc_finish;
-    bool timeout;
+    bool timeout;  // Also set if the batch failed, so the future fails
     uint8_t props_size;
     std::array<priority_props *, 8> props;
     FutureControlBlock *cbk;
 
+    ibv_send_wr *wr_head;
+    ibv_send_wr *wr_tail;
+    // The next submission in the submission queue, and then in the batch posted with it
+    SyncData *next;
+    uint64_t submit_ns;  // Only sampled by connections of a completion engine
+
     SyncData() : cbk(ObjectPool<FutureControlBlock>().pop()) {}
     ~SyncData() { ObjectPool<FutureControlBlock>().put(cbk); }
 
@@ -66,6 +74,67 @@ struct SyncData {
     }
 };
 
+// Written by the poller and submitters, and read by the stats thread, so relaxed atomics
+struct CompletionStats {
+    std::atomic<uint64_t> polls{0};  // Polls finding completions
+    std::atomic<uint64_t> cqes{0};
+    std::atomic<uint64_t> max_batch{0};  // Most cqes found by a poll
+    std::atomic<uint64_t> completions{0};
+    std::atomic<uint64_t> latency_ns{0};  // From submit to completion, of all completions
+    std::atomic<uint64_t> wrs{0};         // Submitted wrs
+    std::atomic<uint64_t> inline_wrs{0};  // Submitted wrs carrying their payload inline
+};
+
+/**
+ * @brief Completions of the connections polled by a thread. The connections share a CQ per
+ * device, which is drained in batches by `Poll`, and completions are dispatched to their waiters
+ * by the wr id. Connections with submissions to post are queued to the engine, so polling doesn't
+ * scan connections.
+ */
+class CompletionEngine : public NOCOPYABLE {
+   public:
+    constexpr static int cq_depth = 4096;
+    constexpr static int poll_batch = 64;
+
+    ~CompletionEngine();
+
+    /**
+     * @brief The CQ of the engine on a device, created on first use.
+     */
+    ibv_cq *GetCQ(ibv_context *verbs, ibv_comp_channel *comp_chan);
+
+    /**
+     * @brief Post the submissions queued by connections, and drain the CQs.
+     *
+     * @return int -1 on a failed completion, or the number of completions found
+     */
+    int Poll();
+
+    /**
+     * @brief Whether submissions wait for their completions.
+     */
+    bool Busy() const { return m_inflight_.load(std::memory_order_relaxed) > 0; }
+
+    const CompletionStats &GetStats() const { return m_stats_; }
+
+   private:
+    friend struct RDMAConnection;
+
+    void queuePost(RDMAConnection *conn);
+
+    constexpr static size_t max_cq_num = 8;
+
+    // CQs are only appended, so the poller reads them without the lock
+    SpinMutex m_cq_lck_;
+    ibv_context *m_cq_verbs_[max_cq_num];
+    ibv_cq *m_cqs_[max_cq_num];
+    std::atomic<size_t> m_cq_num_{0};
+
+    std::atomic<RDMAConnection *> m_post_head_{nullptr};
+    std::atomic<uint32_t> m_inflight_{0};
+    CompletionStats m_stats_;
+};
+
 struct RDMAFuture {
     int get();
     /**
@@ -90,6 +159,7 @@ struct RDMAConnection {
     static uint8_t INITIATOR_DEPTH;
     static int RESPONDER_RESOURCES;
     static int POLL_ENTRY_COUNT;
+    static uint32_t MAX_INLINE_DATA;  // Requested inline size of QPs, 0 to never inline
     static bool RDMA_TIMEOUT_ENABLE;
     static uint32_t RDMA_TIMEOUT_MS;
 
@@ -122,6 +192,9 @@ struct RDMAConnection {
     void deregister_memory(ibv_mr *mr, bool freed = true);
 
     // prep operations are thread-unsafety for the same `sge_vec`.
+    //
+    // Writes up to the inline size of the QPs carry their payload in the wr, which saves the DMA
+    // read of the local buffer. `inline_data` forces it for larger writes.
 
     int prep_write(std::vector<SgeWr> &sge_vec, uint64_t local_addr, uint32_t lkey, uint32_t length,
                    uint64_t remote_addr, uint32_t rkey, bool inline_data);
@@ -149,6 +222,13 @@ struct RDMAConnection {
     /**
      * @brief submit prep sgewr
      *
+     * Submissions are queued and posted by the next poll of the connection, chained with those of
+     * other fibers into one doorbell, where only the last wr is signaled.
+     *
+     * Wrs of a submission run in order at the peer, so a read sees the writes before it without
+     * waiting for their completions. Only wrs using the result of a read or atomic before them
+     * need `IBV_SEND_FENCE`.
+     *
      * @warning The sge wr array must be reserved before future get
      *
      * @param begin
@@ -171,7 +251,9 @@ struct RDMAConnection {
     conn_type_t m_conn_type_;
     volatile bool m_stop_ : 1;
     bool m_atomic_support_ : 1;
+    bool m_atomic_glob_ : 1;  // Atomics of the device are atomic with those of the cpu
     bool m_inline_support_ : 1;
+    uint32_t m_max_inline_data_ = 0;  // Inline size granted to all the QPs
     std::atomic<uint32_t> m_inflight_count_;
     ibv_comp_channel *m_comp_chan_;
     ibv_pd *m_pd_;
@@ -181,16 +263,24 @@ struct RDMAConnection {
     std::thread *m_conn_handler_;
 
     Mutex m_mu_;
-    // std::unique_ptr<SyncData> m_current_sd_ = {nullptr};
-    SgeWr *m_sw_head_ = nullptr;
-    SgeWr *m_sw_tail_ = nullptr;
+
+    // Submissions of fibers waiting to be posted by the poller, pushed lock-free in LIFO order
+    std::atomic<SyncData *> m_submit_head_{nullptr};
+    std::atomic<bool> m_posting_{false};
+
+    // The engine polling this connection, set before connecting. Without an engine, the
+    // connection polls the CQ of its device by itself.
+    CompletionEngine *m_engine_ = nullptr;
+    std::atomic<bool> m_post_queued_{false};  // Whether queued to the engine to post
+    RDMAConnection *m_post_next_ = nullptr;
 
     bool m_rdma_conn_param_valid_();
     int m_init_last_ibv_subconnection_();
     void m_handle_connection_();
     int m_poll_conn_sd_wr_();
+    void m_post_submitted_();
     static void m_init_last_subconnection_(RDMAConnection *init_conn);
-    static int m_acknowledge_sd_cqe_(int rc, ibv_wc wcs[]);
+    static int m_acknowledge_sd_cqe_(int rc, ibv_wc wcs[], CompletionStats *stats = nullptr);
     RDMAFuture m_submit_impl(SgeWr *sge_wrs, size_t n);
 };
 
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+
+#include "common.hpp"
+#include "lock.hpp"
+#include "options.hpp"
+
+/**
+ * @brief Online controller of the page swap heat watermark.
+ *
+ * Each completed swap records the page heat, which tracks its direct io rate. While the page stays
+ * in this rack, that rate is credited as saved direct io traffic of the rack it came from, for at
+ * most `swap_back_window_us`. A page leaving again within that window counts as a swap-back. At
+ * every epoch (driven by the stats thread) the watermark of a rack whose swaps don't pay back their
+ * page transfers is raised, and lowered when they clearly do, always within the configured bounds.
+ */
+class SwapWatermarkController {
+   public:
+    struct RackStats {
+        rack_id_t rack_id;
+        std::atomic<float> watermark;
+
+        // hot path counters
+        std::atomic<uint64_t> dio_cnt{0};
+        std::atomic<uint64_t> dio_bytes{0};
+        std::atomic<uint64_t> dio_bytes_total{0};  // Never reset, for the load reports to master
+
+        SpinMutex lck;
+        uint64_t swap_cnt = 0;
+        uint64_t swap_back_cnt = 0;
+        uint64_t swap_cost_bytes = 0;
+        double avg_dio_bytes = 64;
+        double saved_dio = 0;          // Estimated direct io ops avoided since last epoch
+        double resident_dio_rate = 0;  // Sum of direct io rate (op/us) of credited swapped pages
+        uint64_t last_accrue_us = 0;
+
+        void Accrue(uint64_t now_us);
+        void RemoveRate(double dio_rate, uint64_t until_us);
+    };
+
+    void Init(const rcmp::DaemonOptions &options);
+
+    /**
+     * @brief Get the stats of rack. Must be called before swapping pages with that rack.
+     */
+    RackStats *AddRack(rack_id_t rack_id);
+
+    float GetWatermark(const RackStats *rack_stats) const {
+        return m_enable ? rack_stats->watermark.load(std::memory_order_relaxed) : m_init_watermark;
+    }
+
+    void RecordDirectIO(RackStats *rack_stats, size_t bytes) {
+        rack_stats->dio_cnt.fetch_add(1, std::memory_order_relaxed);
+        rack_stats->dio_bytes.fetch_add(bytes, std::memory_order_relaxed);
+        rack_stats->dio_bytes_total.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Call `fn(rack_id, dio_bytes)` for each rack, with the direct io bytes sent to it since
+     * start.
+     */
+    template <typename F>
+    void ForEachRackTraffic(F &&fn) {
+        std::shared_lock<SharedMutex> lck(m_rack_lck);
+        for (auto &p : m_rack_table) {
+            fn(p.first, p.second->dio_bytes_total.load(std::memory_order_relaxed));
+        }
+    }
+
+    /**
+     * @brief Record a completed swap of `page_id` from `rack_stats`.
+     *
+     * @param heat The page heat at the time of swapping
+     * @param page_bytes The page size
+     * @param with_swapout Whether a local page was evicted for this swap
+     */
+    void RecordSwapIn(RackStats *rack_stats, page_id_t page_id, float heat, size_t page_bytes,
+                      bool with_swapout);
+
+    /**
+     * @brief Record that `page_id` leaves this rack by migration.
+     */
+    void RecordSwapOut(page_id_t page_id) { erasePage(page_id, true); }
+
+    /**
+     * @brief Forget `page_id` after it is freed.
+     */
+    void RecordPageFree(page_id_t page_id) { erasePage(page_id, false); }
+
+    /**
+     * @brief Adjust the watermark of every rack by the statistics of last epoch and log the
+     * decisions.
+     */
+    void Adjust();
+
+   private:
+    struct SwapRecord {
+        RackStats *rack_stats;
+        double dio_rate;
+        uint64_t swapin_us;
+    };
+
+    void erasePage(page_id_t page_id, bool swap_out);
+
+    bool m_enable;
+    float m_init_watermark;
+    float m_min_watermark;
+    float m_max_watermark;
+    float m_half_life_us;
+    uint64_t m_swap_back_window_us;
+
+    SharedMutex m_rack_lck;
+    std::unordered_map<rack_id_t, std::unique_ptr<RackStats>> m_rack_table;
+
+    // Pages swapped in within `swap_back_window_us`, in order of swap time
+    SpinMutex m_page_lck;
+    std::unordered_map<page_id_t, SwapRecord> m_swapped_pages;
+    std::deque<std::pair<page_id_t, uint64_t>> m_swapin_queue;
+};
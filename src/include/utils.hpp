@@ -3,6 +3,7 @@
 #include <unistd.h>
 
 #include <atomic>
+#include <cstdint>
 #include <functional>
 #include <future>
 #include <queue>
@@ -54,6 +55,15 @@ uint64_t getMsTimestamp();
 uint64_t getUsTimestamp();
 uint64_t getNsTimestamp();
 
+/**
+ * @brief Sleep while `*addr == expected`, for at most `timeout_us`. The futex isn't private, so
+ * `addr` may be in memory shared with other processes.
+ *
+ * @return bool False on timeout
+ */
+bool futexWait(std::atomic<uint32_t> *addr, uint32_t expected, uint64_t timeout_us);
+void futexWake(std::atomic<uint32_t> *addr, int n = INT32_MAX);
+
 class IPv4String {
    public:
     IPv4String() = default;
@@ -1,6 +1,10 @@
 #include <boost/fiber/operations.hpp>
+#include <chrono>
 #include <memory>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 
 #include "cmdline.h"
 #include "common.hpp"
@@ -12,6 +16,8 @@
 #include "proto/rpc_register.hpp"
 #include "rdma_rc.hpp"
 
+using namespace std::chrono_literals;
+
 void MasterContext::InitCluster() {
     m_cluster_manager.mac_id_allocator = std::make_unique<IDGenerator>();
     m_cluster_manager.mac_id_allocator->Expand(m_options.max_cluster_mac_num);
@@ -19,11 +25,14 @@ void MasterContext::InitCluster() {
     DLOG_ASSERT(id == master_id, "Can't alloc master mac id");
     m_master_id = master_id;
 
+    m_page_directory.Init(m_options.shard_num);
     m_page_directory.page_id_allocator = std::make_unique<IDGenerator>();
     m_page_directory.page_id_allocator->Expand(1);
     id = m_page_directory.page_id_allocator->Gen();
     // Ensures that the page id is not 0, which ensures that the allocated GAddr is non-null
     DLOG_ASSERT(id == 0, "Can't init page id");
+
+    m_placement = PlacementPolicy::Create(m_options);
 }
 
 void MasterContext::InitRDMARC() {
@@ -63,6 +72,16 @@ void MasterContext::InitRDMARC() {
     });
 
     m_listen_conn.listen(m_options.master_ip);
+
+    // Latches of the slot table are taken by rdma atomics of daemons and cpu atomics of the
+    // master, which only exclude each other on devices with global atomicity.
+    if (m_listen_conn.m_atomic_glob_) {
+        m_dir_slot_mr = m_listen_conn.register_memory(
+            m_page_directory.DirSlots(), PageDirectory::dir_slot_num * sizeof(DirSlot));
+        DLOG_ASSERT(m_dir_slot_mr != nullptr, "Can't register dir slot table");
+    } else {
+        DLOG_WARNING("No global rdma atomicity, refs are resolved by rpc only");
+    }
 }
 
 void MasterContext::InitRPCNexus() {
@@ -81,34 +100,81 @@ void MasterContext::InitRPCNexus() {
                                         bind_erpc_func<false>(rpc_master::latchRemotePage));
     m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::unLatchRemotePage)::rpc_type,
                                         bind_erpc_func<false>(rpc_master::unLatchRemotePage));
+    m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::resolvePageRDMARef)::rpc_type,
+                                        bind_erpc_func<false>(rpc_master::resolvePageRDMARef));
     m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::tryMigratePage)::rpc_type,
                                         bind_erpc_func<false>(rpc_master::tryMigratePage));
     m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::MigratePageDone)::rpc_type,
                                         bind_erpc_func<false>(rpc_master::MigratePageDone));
+    m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::leasePageID)::rpc_type,
+                                        bind_erpc_func<false>(rpc_master::leasePageID));
+    m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::returnPageID)::rpc_type,
+                                        bind_erpc_func<false>(rpc_master::returnPageID));
+    m_erpc_ctx.nexus->register_req_func(RPC_TYPE_STRUCT(rpc_master::reportRackLoad)::rpc_type,
+                                        bind_erpc_func<false>(rpc_master::reportRackLoad));
+
+    for (int i = 0; i < m_options.shard_num; ++i) {
+        auto shard = std::make_unique<MasterShard>();
+        shard->shard_id = i;
+        m_shards.push_back(std::move(shard));
+    }
 
-    erpc::SMHandlerWrap smhw;
-    smhw.set_empty();
-
-    erpc::IBRpcWrap rpc(m_erpc_ctx.nexus.get(), &MasterContext::getInstance(), 0, smhw);
-    m_erpc_ctx.rpc_set.push_back(std::move(rpc));
-    DLOG_ASSERT(m_erpc_ctx.rpc_set.size() == 1);
+    // The main thread runs shard 0
+    bindShard(0);
 }
 
 void MasterContext::InitFiberPool() {
     boost::fibers::use_scheduling_algorithm<priority_scheduler>();
-    m_fiber_pool_.AddFiber(m_options.prealloc_fiber_num);
+    GetFiberPool().AddFiber(m_options.prealloc_fiber_num);
+}
+
+void MasterContext::InitShards() {
+    // Rpcs of all shards are up before any daemon connects to them
+    Barrier bound(m_shards.size());
+    for (size_t i = 1; i < m_shards.size(); ++i) {
+        m_shards[i]->thread = std::thread([this, i, &bound]() {
+            bindShard(i);
+            bound.wait();
+            InitFiberPool();
+
+            while (true) {
+                ShardPollOnce();
+                boost::this_fiber::yield();
+            }
+        });
+    }
+    bound.wait();
+}
+
+void MasterContext::ShardPollOnce() { GetShard().rpc->run_event_loop_once(); }
+
+void MasterContext::bindShard(size_t shard_id) {
+    MasterShard &shard = *m_shards[shard_id];
+
+    // An erpc Rpc is owned by the thread creating it
+    erpc::SMHandlerWrap smhw;
+    smhw.set_empty();
+    shard.rpc = std::make_unique<erpc::IBRpcWrap>(m_erpc_ctx.nexus.get(), this, shard_id, smhw);
+
+    m_local_shard = &shard;
 }
 
 int main(int argc, char *argv[]) {
     cmdline::parser cmd;
     cmd.add<std::string>("master_ip");
     cmd.add<uint16_t>("master_port");
+    cmd.add<int>("shard_num", 0, "", false, 1);
+    cmd.add<std::string>("placement_policy", 0, "", false, "weighted");
+    cmd.add<size_t>("rack_group_size", 0, "", false, 0);
     bool ret = cmd.parse(argc, argv);
     DLOG_ASSERT(ret);
 
     rcmp::MasterOptions options;
     options.master_ip = cmd.get<std::string>("master_ip");
     options.master_port = cmd.get<uint16_t>("master_port");
+    options.shard_num = cmd.get<int>("shard_num");
+    options.placement_policy = cmd.get<std::string>("placement_policy");
+    options.rack_group_size = cmd.get<size_t>("rack_group_size");
 
     MasterContext &master_context = MasterContext::getInstance();
     master_context.m_options = options;
@@ -117,13 +183,63 @@ int main(int argc, char *argv[]) {
     master_context.InitRPCNexus();
     master_context.InitRDMARC();
     master_context.InitFiberPool();
+    master_context.InitShards();
 
     DLOG("START OK");
 
+    std::thread stat_worker = std::thread([&master_context]() {
+        size_t shard_num = master_context.m_shards.size();
+        std::vector<uint64_t> rpc_opn(shard_num, 0);
+        std::vector<uint64_t> rpc_exec_time(shard_num, 0);
+        std::unordered_map<rack_id_t, uint64_t> rack_dio_bytes;
+        std::unordered_map<rack_id_t, uint64_t> rack_swap_cnt;
+
+        while (true) {
+            std::this_thread::sleep_for(5s);
+
+            // A shard busy for most of the window while others idle calls for more shards
+            for (size_t i = 0; i < shard_num; ++i) {
+                MasterShard &shard = *master_context.m_shards[i];
+                uint64_t new_rpc_opn = shard.rpc_opn.load(std::memory_order_relaxed);
+                uint64_t new_rpc_exec_time = shard.rpc_exec_time.load(std::memory_order_relaxed);
+                uint64_t diff_rpc_opn = new_rpc_opn - rpc_opn[i];
+                uint64_t diff_rpc_exec_time = new_rpc_exec_time - rpc_exec_time[i];
+                rpc_opn[i] = new_rpc_opn;
+                rpc_exec_time[i] = new_rpc_exec_time;
+
+                DLOG("shard %lu: rpc %lu op/s, exec %.2lf us/op", i, diff_rpc_opn / 5,
+                     1.0 * diff_rpc_exec_time / (diff_rpc_opn + 1) / 1e3);
+            }
+            DLOG("page directory: %lu extents", master_context.m_page_directory.ExtentNum());
+
+            // Rates of the racks for the placement of new pages
+            master_context.m_cluster_manager.cluster_rack_table.foreach_all(
+                [&](std::pair<const rack_id_t, RackMacTable *> &p) {
+                    RackMacTable *rack_table = p.second;
+                    uint64_t new_dio_bytes = rack_table->dio_bytes;
+                    uint64_t new_swap_cnt = rack_table->swap_cnt;
+                    float dio_rate = (new_dio_bytes - rack_dio_bytes[p.first]) / 5.0;
+                    float swap_rate = (new_swap_cnt - rack_swap_cnt[p.first]) / 5.0;
+                    rack_dio_bytes[p.first] = new_dio_bytes;
+                    rack_swap_cnt[p.first] = new_swap_cnt;
+                    rack_table->dio_rate.store(dio_rate, std::memory_order_relaxed);
+                    rack_table->swap_rate.store(swap_rate, std::memory_order_relaxed);
+
+                    DLOG("rack %u: %lu free pages, %lu leased, dio %.2f MB/s, swap %.2f page/s",
+                         p.first, rack_table->GetFreePageNum(rcmp::PAGE_4K),
+                         rack_table->leased_page_num.load(std::memory_order_relaxed),
+                         dio_rate / 1e6, swap_rate);
+                    return true;
+                });
+        }
+    });
+
     while (true) {
-        master_context.GetErpc().run_event_loop_once();
+        master_context.ShardPollOnce();
         boost::this_fiber::yield();
     }
 
+    stat_worker.join();
+
     return 0;
 }
\ No newline at end of file
@@ -21,7 +21,63 @@ void MsgQueueNexus::register_req_func(uint8_t rpc_type, msgq_handler_t handler)
 
 MsgQueueRPC::MsgQueueRPC(MsgQueueNexus* nexus, MsgQueue* send_queue, MsgQueue* recv_queue,
                          void* ctx)
-    : m_nexus(nexus), m_ctx(ctx), m_recv_queue(recv_queue), m_send_queue(send_queue) {}
+    : m_nexus(nexus),
+      m_ctx(ctx),
+      m_recv_queue(recv_queue),
+      m_send_queue(send_queue),
+      m_credits(std::make_shared<MsgQueueCredits>()) {}
+
+bool MsgQueueCredits::try_acquire() {
+    int avail = m_avail.load(std::memory_order_acquire);
+    while (avail > 0) {
+        if (m_avail.compare_exchange_weak(avail, avail - 1, std::memory_order_acquire)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MsgQueueDoorbell::ring() {
+    // Paired with the fence of the receiver announcing its sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed) == 0 ||
+        m_sleeping.exchange(0, std::memory_order_relaxed) == 0) {
+        return;
+    }
+    m_ring_ts.store(getNsTimestamp(), std::memory_order_relaxed);
+    m_seq.fetch_add(1, std::memory_order_release);
+    futexWake(&m_seq);
+}
+
+void MsgQueueCredits::resize(int window) {
+    int old_window = m_window.exchange(window, std::memory_order_relaxed);
+    if (old_window != window) {
+        // A shrunk window may leave the credits in debt, paid back by the responses in flight
+        m_avail.fetch_add(window - old_window, std::memory_order_release);
+    }
+}
+
+void MsgQueueRPC::set_credit_window(int window) {
+    DLOG_ASSERT(window > 0, "Invalid msgq credit window %d", window);
+    m_credits->resize(window);
+}
+
+void MsgQueueRPC::set_peer_credit_window(int window) {
+    DLOG_ASSERT(window > 0, "Invalid msgq credit window %d", window);
+    m_credits->m_peer_window.store(window, std::memory_order_relaxed);
+}
+
+void MsgQueueRPC::acquire_credit() {
+    if (LIKELY(m_credits->try_acquire())) {
+        return;
+    }
+    m_nexus->m_stats.credit_stall.fetch_add(1, std::memory_order_relaxed);
+    // Wait for the responses of this sender, instead of spinning on the receiver's queue
+    do {
+        boost::this_fiber::yield();
+        std::this_thread::yield();
+    } while (!m_credits->try_acquire());
+}
 
 #if MSGQ_SINGLE_FIFO_ON == 1
 
@@ -36,6 +92,12 @@ MsgBuffer MsgQueueRPC::alloc_msg_buffer(size_t size) {
     return buf;
 }
 
+// The single FIFO reserves its ring in order, so it can't back off
+bool MsgQueueRPC::try_alloc_msg_buffer(size_t size, MsgBuffer& msg_buf) {
+    msg_buf = alloc_msg_buffer(size);
+    return true;
+}
+
 void MsgQueueRPC::free_msg_buffer(MsgBuffer& msg_buf) { msg_buf.m_q->free_msg_buffer(); }
 
 void MsgQueueRPC::enqueue_request(uint8_t rpc_type, MsgBuffer& msg_buf, msgq_callback_t cb,
@@ -43,6 +105,7 @@ void MsgQueueRPC::enqueue_request(uint8_t rpc_type, MsgBuffer& msg_buf, msgq_cal
     msg_buf.m_msg->msg_type = MsgHeader::REQ;
     msg_buf.m_msg->cb = cb;
     msg_buf.m_msg->arg = arg;
+    msg_buf.m_msg->credits = m_credits.get();
     msg_buf.m_msg->rpc_type = rpc_type;
     m_send_queue->enqueue_msg();
 }
@@ -51,10 +114,12 @@ void MsgQueueRPC::enqueue_response(MsgBuffer& req_buf, MsgBuffer& resp_buf) {
     resp_buf.m_msg->msg_type = MsgHeader::RESP;
     resp_buf.m_msg->cb = req_buf.m_msg->cb;
     resp_buf.m_msg->arg = req_buf.m_msg->arg;
+    resp_buf.m_msg->credits = req_buf.m_msg->credits;
+    resp_buf.m_msg->credit_window = m_credits->m_peer_window.load(std::memory_order_relaxed);
     resp_buf.m_q->enqueue_msg();
 }
 
-void MsgQueueRPC::run_event_loop_once() {
+uint32_t MsgQueueRPC::run_event_loop_once() {
     std::vector<MsgHeader*> hv;
     m_recv_queue->dequeue_msg(hv);
     for (auto& h : hv) {
@@ -65,9 +130,14 @@ void MsgQueueRPC::run_event_loop_once() {
         if (h->msg_type == MsgHeader::REQ) {
             MsgQueueNexus::__handlers[h->rpc_type](buf, m_ctx);
         } else {
+            if (h->credit_window != 0) {
+                h->credits->resize(h->credit_window);
+            }
+            h->credits->release();
             h->cb(buf, h->arg);
         }
     }
+    return hv.size();
 }
 
 MsgQueue::MsgQueue() {
@@ -130,7 +200,10 @@ retry:
     return h;
 }
 
-void MsgQueue::enqueue_msg() { update_ht(&m_prod_head, &m_prod_tail); }
+void MsgQueue::enqueue_msg() {
+    update_ht(&m_prod_head, &m_prod_tail);
+    m_doorbell.ring();
+}
 
 void MsgQueue::dequeue_msg(std::vector<MsgHeader*>& hv) {
     size_t s;
@@ -195,6 +268,12 @@ MsgBuffer MsgQueueRPC::alloc_msg_buffer(size_t size) {
     return buf;
 }
 
+bool MsgQueueRPC::try_alloc_msg_buffer(size_t size, MsgBuffer& msg_buf) {
+    msg_buf.m_q = m_send_queue;
+    msg_buf.m_msg.size = size;
+    return m_send_queue->try_alloc_msg_buffer(size, msg_buf.m_msg.buf_offset);
+}
+
 void MsgQueueRPC::free_msg_buffer(MsgBuffer& msg_buf) { msg_buf.m_q->free_msg_buffer(msg_buf); }
 
 void MsgQueueRPC::enqueue_request(uint8_t rpc_type, MsgBuffer& msg_buf, msgq_callback_t cb,
@@ -202,6 +281,7 @@ void MsgQueueRPC::enqueue_request(uint8_t rpc_type, MsgBuffer& msg_buf, msgq_cal
     msg_buf.m_msg.msg_type = MsgHeader::REQ;
     msg_buf.m_msg.cb = cb;
     msg_buf.m_msg.arg = arg;
+    msg_buf.m_msg.credits = m_credits.get();
     msg_buf.m_msg.rpc_type = rpc_type;
     m_nexus->m_stats.start_sample(msg_buf.m_msg.send_ts);
     m_send_queue->enqueue_msg(msg_buf);
@@ -211,11 +291,13 @@ void MsgQueueRPC::enqueue_response(MsgBuffer& req_buf, MsgBuffer& resp_buf) {
     resp_buf.m_msg.msg_type = MsgHeader::RESP;
     resp_buf.m_msg.cb = req_buf.m_msg.cb;
     resp_buf.m_msg.arg = req_buf.m_msg.arg;
+    resp_buf.m_msg.credits = req_buf.m_msg.credits;
+    resp_buf.m_msg.credit_window = m_credits->m_peer_window.load(std::memory_order_relaxed);
     m_nexus->m_stats.start_sample(resp_buf.m_msg.send_ts);
     resp_buf.m_q->enqueue_msg(resp_buf);
 }
 
-void MsgQueueRPC::run_event_loop_once() {
+uint32_t MsgQueueRPC::run_event_loop_once() {
     MsgHeader hv[64];
     uint32_t s = m_recv_queue->dequeue_msg(hv, 64);
     for (uint32_t i = 0; i < s; ++i) {
@@ -229,29 +311,43 @@ void MsgQueueRPC::run_event_loop_once() {
             MsgQueueNexus::__handlers[h.rpc_type](buf, m_ctx);
         } else {
             m_nexus->m_stats.recv_sample(h.size, h.send_ts);
+            if (h.credit_window != 0) {
+                h.credits->resize(h.credit_window);
+            }
+            h.credits->release();
             h.cb(buf, h.arg);
         }
     }
+    return s;
 }
 
 offset_t MsgQueue::alloc_msg_buffer(size_t size) {
-    void* ptr;
+    offset_t off;
     bool noticed = false;
-    do {
-        ptr = m_ra.allocate(size);
-        if (!ptr) {
-            if (!noticed) {
-                DLOG_WARNING("msg queue full");
-                noticed = true;
-            }
-            boost::this_fiber::yield();
-            std::this_thread::yield();
+    while (!try_alloc_msg_buffer(size, off)) {
+        if (!noticed) {
+            DLOG_WARNING("msg queue full");
+            noticed = true;
         }
-    } while (ptr == nullptr);
-    return reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(m_ra.base());
+        boost::this_fiber::yield();
+        std::this_thread::yield();
+    }
+    return off;
 }
 
-void MsgQueue::enqueue_msg(MsgBuffer& msg_buf) { msgq_q.ForceEnqueue(msg_buf.m_msg); }
+bool MsgQueue::try_alloc_msg_buffer(size_t size, offset_t& off) {
+    void* ptr = m_ra.allocate(size);
+    if (UNLIKELY(ptr == nullptr)) {
+        return false;
+    }
+    off = reinterpret_cast<uintptr_t>(ptr) - reinterpret_cast<uintptr_t>(m_ra.base());
+    return true;
+}
+
+void MsgQueue::enqueue_msg(MsgBuffer& msg_buf) {
+    msgq_q.ForceEnqueue(msg_buf.m_msg);
+    m_doorbell.ring();
+}
 
 uint32_t MsgQueue::dequeue_msg(MsgHeader* hv, size_t max_deq) {
     return msgq_q.TryDequeue(hv, hv + max_deq);
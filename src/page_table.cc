@@ -1,36 +1,337 @@
 #include "page_table.hpp"
 
+#include <algorithm>
+#include <boost/fiber/operations.hpp>
+
 #include "impl.hpp"
 
-PageRackMetadata *PageDirectory::FindPage(page_id_t page_id) {
-    auto it = table.find(page_id);
-    if (it == table.end()) {
-        return nullptr;
+PageLatchTable::~PageLatchTable() {
+    for (Bucket &bucket : m_buckets) {
+        for (auto &p : bucket.latches) {
+            delete p.second;
+        }
     }
-    return it->second;
 }
 
-PageRackMetadata *PageDirectory::AddPage(RackMacTable *rack_table, page_id_t page_id) {
-    PageRackMetadata *page_meta = new PageRackMetadata();
-    page_meta->rack_id = rack_table->daemon_connect->rack_id;
-    page_meta->daemon_id = rack_table->daemon_connect->daemon_id;
-    table.insert(page_id, page_meta);
-    rack_table->current_allocated_page_num++;
+PageLatchTable::Latch *PageLatchTable::pin(page_id_t page_id) {
+    Bucket &bucket = bucketOf(page_id);
+    std::lock_guard<SpinMutex> lck(bucket.lck);
+    Latch *&latch = bucket.latches[page_id];
+    if (latch == nullptr) {
+        latch = new Latch();
+    }
+    latch->pins++;
+    return latch;
+}
 
-    // DLOG("Add page %lu --> rack %u", page_id, page_meta->rack_id);
+void PageLatchTable::unpin(page_id_t page_id) {
+    Bucket &bucket = bucketOf(page_id);
+    std::lock_guard<SpinMutex> lck(bucket.lck);
+    auto it = bucket.latches.find(page_id);
+    DLOG_ASSERT(it != bucket.latches.end(), "Page %lu isn't latched", page_id);
+    if (--it->second->pins == 0) {
+        delete it->second;
+        bucket.latches.erase(it);
+    }
+}
 
-    return page_meta;
+void PageLatchTable::Lock(page_id_t page_id) { pin(page_id)->mtx.lock(); }
+
+bool PageLatchTable::TryLock(page_id_t page_id) {
+    if (pin(page_id)->mtx.try_lock()) {
+        return true;
+    }
+    unpin(page_id);
+    return false;
 }
 
-void PageDirectory::RemovePage(RackMacTable *rack_table, page_id_t page_id) {
-    auto it = table.find(page_id);
-    PageRackMetadata *page_meta = it->second;
-    table.erase(it);
+void PageLatchTable::Unlock(page_id_t page_id) {
+    // The pin of the holder keeps the latch alive while it wakes the waiters
+    Latch *latch;
+    {
+        Bucket &bucket = bucketOf(page_id);
+        std::lock_guard<SpinMutex> lck(bucket.lck);
+        latch = bucket.latches.at(page_id);
+    }
+    latch->mtx.unlock();
+    unpin(page_id);
+}
+
+void PageLatchTable::LockShared(page_id_t page_id) { pin(page_id)->mtx.lock_shared(); }
+
+void PageLatchTable::UnlockShared(page_id_t page_id) {
+    Latch *latch;
+    {
+        Bucket &bucket = bucketOf(page_id);
+        std::lock_guard<SpinMutex> lck(bucket.lck);
+        latch = bucket.latches.at(page_id);
+    }
+    latch->mtx.unlock_shared();
+    unpin(page_id);
+}
+
+PageDirectory::PageDirectory()
+    : m_partitions(new Partition[1]), m_dir_slots(new DirSlot[dir_slot_num]()) {}
+
+PageDirectory::~PageDirectory() {
+    m_ref_caches.foreach_all([](std::pair<const page_id_t, PageRefCache *> &p) {
+        delete p.second;
+        return true;
+    });
+}
+
+void PageDirectory::Init(size_t shard_num) {
+    DLOG_ASSERT(shard_num > 0 && shard_num <= max_master_shard_num, "Invalid shard num %lu",
+                shard_num);
+    m_partition_num = shard_num;
+    m_partitions.reset(new Partition[shard_num]);
+}
+
+bool PageDirectory::FindPage(page_id_t page_id, PageExtent *extent) {
+    Partition &part = partitionOf(page_id);
+    std::shared_lock<SharedMutex> lck(part.lck);
+    auto it = findExtentLocked(part.extents, page_id);
+    if (it == part.extents.end()) {
+        return false;
+    }
+    *extent = it->second;
+    return true;
+}
+
+void PageDirectory::AddPages(RackMacTable *rack_table, page_id_t start_page_id, size_t count,
+                             rcmp::PageSizeClass page_class) {
+    size_t units = GetPageUnits(page_class);
+    forEachRange(start_page_id, count * units, [&](page_id_t start, size_t n) {
+        PageExtent extent = {
+            .start = start,
+            .count = n,
+            .rack_id = rack_table->daemon_connect->rack_id,
+            .daemon_id = rack_table->daemon_connect->daemon_id,
+            .page_class = page_class,
+        };
+
+        Partition &part = partitionOf(start);
+        std::unique_lock<SharedMutex> lck(part.lck);
+        auto p = part.extents.emplace(start, extent);
+        DLOG_ASSERT(p.second, "Page %lu exists", start);
+        mergePrevLocked(part.extents, p.first);
+    });
+    rack_table->current_allocated_page_num.fetch_add(count * units, std::memory_order_relaxed);
+
+    // DLOG("Add page %lu +%lu --> rack %u", start_page_id, count,
+    //      rack_table->daemon_connect->rack_id);
+}
+
+void PageDirectory::RemovePages(RackMacTable *rack_table, page_id_t start_page_id, size_t count,
+                                rcmp::PageSizeClass page_class) {
+    size_t units = GetPageUnits(page_class);
+    page_id_t end_page_id = start_page_id + count * units;
+    forEachRange(start_page_id, count * units, [&](page_id_t start, size_t n) {
+        Partition &part = partitionOf(start);
+        std::unique_lock<SharedMutex> lck(part.lck);
+        auto it = findExtentLocked(part.extents, start);
+        DLOG_ASSERT(it != part.extents.end(), "Can't find page %lu", start);
+        it = splitLocked(part.extents, it, start);
+
+        auto last = findExtentLocked(part.extents, start + n - 1);
+        DLOG_ASSERT(last != part.extents.end(), "Can't find page %lu", start + n - 1);
+        auto end = splitLocked(part.extents, last, start + n);
+
+        for (auto e = it; e != end; ++e) {
+            DLOG_ASSERT(e->second.daemon_id == rack_table->daemon_connect->daemon_id,
+                        "Page %lu isn't on daemon %u", e->first,
+                        rack_table->daemon_connect->daemon_id);
+        }
+        part.extents.erase(it, end);
+    });
+
+    // DLOG("Del page %lu +%lu --> rack %u", start_page_id, count,
+    //      rack_table->daemon_connect->rack_id);
+
+    rack_table->current_allocated_page_num.fetch_sub(count * units, std::memory_order_relaxed);
+
+    if (m_ref_caches.empty()) {
+        return;
+    }
+    for (page_id_t page_id = start_page_id; page_id < end_page_id; page_id += units) {
+        auto it = m_ref_caches.find(page_id);
+        if (it != m_ref_caches.end()) {
+            PageRefCache *ref_cache = it->second;
+            m_ref_caches.erase(it);
+            delete ref_cache;
+            UnpublishRef(page_id);
+        }
+    }
+}
+
+void PageDirectory::MovePage(page_id_t page_id, uint32_t rack_id, mac_id_t daemon_id) {
+    Partition &part = partitionOf(page_id);
+    std::unique_lock<SharedMutex> lck(part.lck);
+    auto it = findExtentLocked(part.extents, page_id);
+    DLOG_ASSERT(it != part.extents.end(), "Can't find page %lu", page_id);
+    if (it->second.daemon_id == daemon_id) {
+        return;
+    }
+
+    size_t units = GetPageUnits(it->second.page_class);
+    it = splitLocked(part.extents, it, page_id);
+    auto next = splitLocked(part.extents, it, page_id + units);
+    it->second.rack_id = rack_id;
+    it->second.daemon_id = daemon_id;
+
+    // The page may join its neighbours on the new daemon
+    if (next != part.extents.end()) {
+        mergePrevLocked(part.extents, next);
+    }
+    mergePrevLocked(part.extents, it);
+}
+
+PageRefCache *PageDirectory::GetRefCache(page_id_t page_id, bool create) {
+    if (!create) {
+        auto it = m_ref_caches.find(page_id);
+        return (it == m_ref_caches.end()) ? nullptr : it->second;
+    }
+    return m_ref_caches.find_or_emplace(page_id, []() { return new PageRefCache(); })
+        .first->second;
+}
+
+void PageDirectory::PublishRef(page_id_t page_id, mac_id_t daemon_id, uintptr_t addr,
+                               uint32_t rkey) {
+    DirSlot &slot = m_dir_slots[page_id % dir_slot_num];
+    lockSlot(slot);
+    slot.tag = DirSlot::Tag(page_id);
+    slot.ref_addr = addr;
+    slot.ref_rkey = rkey;
+    slot.daemon_id = daemon_id;
+    unlockSlot(slot);
+}
+
+void PageDirectory::UnpublishRef(page_id_t page_id) {
+    DirSlot &slot = m_dir_slots[page_id % dir_slot_num];
+    // The page itself is latched, only other pages of the slot may be published meanwhile
+    if (__atomic_load_n(&slot.tag, __ATOMIC_RELAXED) != DirSlot::Tag(page_id)) {
+        return;
+    }
+    lockSlot(slot);
+    if (slot.tag == DirSlot::Tag(page_id)) {
+        slot.tag = 0;
+    }
+    unlockSlot(slot);
+}
+
+void PageDirectory::lockSlot(DirSlot &slot) {
+    while (__atomic_fetch_or(&slot.latch, DirSlot::exclusive_bit, __ATOMIC_ACQUIRE) &
+           DirSlot::exclusive_bit) {
+        boost::this_fiber::yield();
+    }
+    // Readers latching after the exclusive bit leave at once, wait for those before it
+    while ((__atomic_load_n(&slot.latch, __ATOMIC_ACQUIRE) & ~DirSlot::exclusive_bit) != 0) {
+        boost::this_fiber::yield();
+    }
+}
+
+void PageDirectory::unlockSlot(DirSlot &slot) {
+    __atomic_fetch_and(&slot.latch, ~DirSlot::exclusive_bit, __ATOMIC_RELEASE);
+}
+
+size_t PageDirectory::ExtentNum() {
+    size_t num = 0;
+    for (size_t i = 0; i < m_partition_num; ++i) {
+        std::shared_lock<SharedMutex> lck(m_partitions[i].lck);
+        num += m_partitions[i].extents.size();
+    }
+    return num;
+}
+
+PageDirectory::ExtentMap::iterator PageDirectory::findExtentLocked(ExtentMap &extents,
+                                                                   page_id_t page_id) {
+    auto it = extents.upper_bound(page_id);
+    if (it == extents.begin()) {
+        return extents.end();
+    }
+    --it;
+    if (page_id >= it->second.start + it->second.count) {
+        return extents.end();
+    }
+    return it;
+}
+
+PageDirectory::ExtentMap::iterator PageDirectory::splitLocked(ExtentMap &extents,
+                                                              ExtentMap::iterator it,
+                                                              page_id_t page_id) {
+    PageExtent &extent = it->second;
+    if (page_id == extent.start) {
+        return it;
+    }
+    if (page_id == extent.start + extent.count) {
+        return std::next(it);
+    }
+
+    PageExtent back = extent;
+    back.start = page_id;
+    back.count = extent.start + extent.count - page_id;
+    extent.count = page_id - extent.start;
+    return extents.emplace_hint(std::next(it), page_id, back);
+}
+
+PageDirectory::ExtentMap::iterator PageDirectory::mergePrevLocked(ExtentMap &extents,
+                                                                  ExtentMap::iterator it) {
+    if (it == extents.begin()) {
+        return it;
+    }
+    auto prev = std::prev(it);
+    PageExtent &a = prev->second;
+    PageExtent &b = it->second;
+    if (a.start + a.count != b.start || a.daemon_id != b.daemon_id ||
+        a.page_class != b.page_class) {
+        return it;
+    }
+    a.count += b.count;
+    extents.erase(it);
+    return prev;
+}
+
+PageMetadata *PageTableManager::AllocPageMeta() {
+    {
+        std::lock_guard<SpinMutex> lck(page_meta_pool_lck);
+        if (!page_meta_pool.empty()) {
+            PageMetadata *page_meta = page_meta_pool.back();
+            page_meta_pool.pop_back();
+            return page_meta;
+        }
+    }
+    return new PageMetadata();
+}
+
+PageMetadata *PageTableManager::insertPageMeta(page_id_t page_id, PageMetadata *page_meta) {
+    auto p = table.insert(page_id, page_meta);
+    if (!p.second) {
+        // Never published, reuse it directly
+        std::lock_guard<SpinMutex> lck(page_meta_pool_lck);
+        page_meta_pool.push_back(page_meta);
+    }
+    return p.first;
+}
+
+void PageTableManager::ErasePageMeta(page_id_t page_id, PageMetadata *page_meta) {
+    DLOG_ASSERT(page_meta->vm_meta == nullptr && page_meta->remote_ref_meta == nullptr,
+                "Can't erase page %lu in use", page_id);
+
+    if (!table.erase(page_id, page_meta)) {
+        return;
+    }
 
-    // DLOG("Del page %lu --> rack %u", page_id, page_meta->rack_id);
+    // Stale hints mismatch from now on
+    page_meta->version++;
 
-    delete page_meta;
-    rack_table->current_allocated_page_num--;
+    epoch.Retire([this, page_meta]() {
+        page_meta->page_class = rcmp::PAGE_4K;
+        page_meta->dir_lease_daemon_id = master_id;
+        page_meta->dir_lease_expire_us = 0;
+
+        std::lock_guard<SpinMutex> lck(page_meta_pool_lck);
+        page_meta_pool.push_back(page_meta);
+    });
 }
 
 void PageTableManager::EraseRemotePageRefMeta(PageMetadata *page_meta) {
@@ -41,42 +342,95 @@ void PageTableManager::EraseRemotePageRefMeta(PageMetadata *page_meta) {
     }
 }
 
-PageVMMapMetadata *PageTableManager::AllocPageMemory() {
-    DLOG_ASSERT(TestAllocPageMemory(), "Can't allocate more page memory");
+PageVMMapMetadata *PageTableManager::AllocPageMemory(rcmp::PageSizeClass page_class) {
+    size_t units = GetPageUnits(page_class);
+    if (!TestAllocPageMemory(units)) {
+        return nullptr;
+    }
 
-    offset_t cxl_memory_offset = page_allocator->allocate(1);
-    DLOG_ASSERT(cxl_memory_offset != -1, "Can't allocate cxl memory");
+    // A large page needs contiguous frames, which a fragmented pool may not have
+    offset_t cxl_memory_offset = page_allocator->allocate(units);
+    if (cxl_memory_offset == -1) {
+        return nullptr;
+    }
 
     PageVMMapMetadata *page_vm_meta = new PageVMMapMetadata();
     page_vm_meta->cxl_memory_offset = cxl_memory_offset;
+    page_vm_meta->page_class = page_class;
 
     return page_vm_meta;
 }
 
 void PageTableManager::FreePageMemory(PageVMMapMetadata *page_vm_meta) {
-    page_allocator->deallocate(page_vm_meta->cxl_memory_offset, 1);
-    current_used_page_num--;
+    size_t units = GetPageUnits(page_vm_meta->page_class);
+    page_allocator->deallocate(page_vm_meta->cxl_memory_offset, units);
+    current_used_page_num -= units;
     delete page_vm_meta;
 }
 
-void PageTableManager::ApplyPageMemory(PageMetadata *page_meta, PageVMMapMetadata *page_vm_meta) {
+void PageTableManager::ApplyPageMemory(page_id_t page_id, PageMetadata *page_meta,
+                                       PageVMMapMetadata *page_vm_meta) {
     DLOG_ASSERT(page_meta->vm_meta == nullptr, "Can't cover existed page vm meta");
     page_meta->vm_meta = page_vm_meta;
-    current_used_page_num++;
+    // Pins of daemons finding the frame moved may still be there, and are dropped by themselves
+    volatile uint64_t *tag = &GetPageSlot(page_vm_meta->cxl_memory_offset)->tag;
+    uint64_t old_tag = __atomic_load_n(tag, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(tag, &old_tag,
+                                        (old_tag & ~PageSlot::tag_mask) | PageSlot::Tag(page_id),
+                                        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    current_used_page_num += GetPageUnits(page_vm_meta->page_class);
+}
+
+void PageTableManager::SealPageMemory(PageMetadata *page_meta) {
+    volatile uint64_t *tag = &GetPageSlot(page_meta->vm_meta->cxl_memory_offset)->tag;
+    while (true) {
+        uint64_t old_tag = __atomic_load_n(tag, __ATOMIC_ACQUIRE);
+        if ((old_tag & ~PageSlot::tag_mask) != 0) {
+            // A pinned CAS is in flight, which takes a round trip at most
+            boost::this_fiber::yield();
+            continue;
+        }
+        if (__atomic_compare_exchange_n(tag, &old_tag, PageSlot::moved_tag, false,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
 }
 
-void PageTableManager::CancelPageMemory(PageMetadata *page_meta) {
+void PageTableManager::CancelPageMemory(
+    PageMetadata *page_meta, std::vector<boost::fibers::shared_future<void>> ref_del_fu_vec) {
     auto tmp = page_meta->vm_meta;
     page_meta->vm_meta = nullptr;
-    FreePageMemory(tmp);
+    if (ref_del_fu_vec.empty()) {
+        FreePageMemory(tmp);
+        return;
+    }
+
+    boost::fibers::fiber([this, tmp, ref_del_fu_vec = std::move(ref_del_fu_vec)]() {
+        for (auto &fu : ref_del_fu_vec) {
+            fu.get();
+        }
+        FreePageMemory(tmp);
+    }).detach();
 }
 
-bool PageTableManager::PickUnvisitPage(page_id_t &page_id, PageMetadata *&page_meta) {
-    while (!unvisited_pages.empty()) {
+bool PageTableManager::PickUnvisitPage(page_id_t &page_id, PageMetadata *&page_meta,
+                                       rcmp::PageSizeClass page_class) {
+    std::lock_guard<SpinMutex> lck(unvisited_pages_lck);
+
+    // Pages of other classes are kept for later, each visited at most once
+    for (size_t n = unvisited_pages.size(); n > 0; --n) {
         auto p = unvisited_pages.front();
         unvisited_pages.pop();
+        if (p.second->page_class != page_class) {
+            unvisited_pages.push(p);
+            continue;
+        }
         if (p.second->page_ref_lock.try_lock()) {
-            if (p.second->vm_meta != nullptr && p.second->vm_meta->ref_client.empty()) {
+            // The page meta may have been reclaimed and reused by another page
+            if (table.find(p.first) == p.second && p.second->vm_meta != nullptr &&
+                p.second->vm_meta->ref_client.Empty()) {
                 page_id = p.first;
                 page_meta = p.second;
                 return true;
@@ -88,10 +442,11 @@ bool PageTableManager::PickUnvisitPage(page_id_t &page_id, PageMetadata *&page_m
     return false;
 }
 
-std::vector<std::pair<page_id_t, PageMetadata *>> PageTableManager::RandomPickVMPage(size_t n) {
+std::vector<std::pair<page_id_t, PageMetadata *>> PageTableManager::RandomPickVMPage(
+    size_t n, rcmp::PageSizeClass page_class) {
     thread_local std::mt19937 eng(rand());
-    return table.getRandomN(eng, n, [](const std::pair<page_id_t, PageMetadata *> p) {
-        return p.second->vm_meta != nullptr;
+    return table.getRandomN(eng, n, [&](const std::pair<page_id_t, PageMetadata *> &p) {
+        return p.second->vm_meta != nullptr && p.second->page_class == page_class;
     });
 }
 
@@ -144,4 +499,38 @@ void PageThreadCacheManager::erase(PageThreadLocalCache *tcache) {
     std::unique_lock<std::shared_mutex> lck(mutex_);
     auto it = std::find(tcache_list_.begin(), tcache_list_.end(), tcache);
     tcache_list_.erase(it);
-}
\ No newline at end of file
+}
+page_id_t PageIDLease::Take(size_t count) {
+    std::lock_guard<SpinMutex> lck(m_lck);
+    // The remainders of older blocks still serve smaller allocations
+    auto it = std::find_if(m_blocks.begin(), m_blocks.end(),
+                           [count](const std::pair<page_id_t, size_t> &block) {
+                               return block.second >= count;
+                           });
+    if (it == m_blocks.end()) {
+        return invalid_page_id;
+    }
+
+    page_id_t start_page_id = it->first;
+    it->first += count;
+    it->second -= count;
+    if (it->second == 0) {
+        m_blocks.erase(it);
+    }
+    m_remaining.fetch_sub(count, std::memory_order_relaxed);
+    return start_page_id;
+}
+
+std::deque<std::pair<page_id_t, size_t>> PageIDLease::TakeAll() {
+    std::lock_guard<SpinMutex> lck(m_lck);
+    std::deque<std::pair<page_id_t, size_t>> blocks;
+    blocks.swap(m_blocks);
+    m_remaining.store(0, std::memory_order_relaxed);
+    return blocks;
+}
+
+void PageIDLease::Add(page_id_t start_page_id, size_t count) {
+    std::lock_guard<SpinMutex> lck(m_lck);
+    m_blocks.push_back({start_page_id, count});
+    m_remaining.fetch_add(count, std::memory_order_relaxed);
+}
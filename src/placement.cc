@@ -0,0 +1,92 @@
+#include "placement.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include "log.hpp"
+
+std::unique_ptr<PlacementPolicy> PlacementPolicy::Create(const rcmp::MasterOptions &options) {
+    if (options.placement_policy == "first_fit") {
+        return std::make_unique<FirstFitPlacement>(options);
+    }
+    if (options.placement_policy == "weighted") {
+        return std::make_unique<WeightedPlacement>(options);
+    }
+    DLOG_FATAL("Unknown placement policy %s", options.placement_policy.c_str());
+    return nullptr;
+}
+
+size_t FirstFitPlacement::Place(std::vector<Candidate> &candidates, size_t count) {
+    size_t placed = 0;
+    for (auto &c : candidates) {
+        c.alloc_cnt = std::min(count - placed, c.free_page_num);
+        placed += c.alloc_cnt;
+        if (placed == count) {
+            break;
+        }
+    }
+    return placed;
+}
+
+double WeightedPlacement::weight(const Candidate &c) {
+    if (c.free_page_num == 0) {
+        return 0;
+    }
+    return c.free_page_num / ((1 + c.dio_rate / dio_rate_ref) *
+                              (1 + c.swap_rate / swap_rate_ref) * c.distance);
+}
+
+size_t WeightedPlacement::Place(std::vector<Candidate> &candidates, size_t count) {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+
+    std::vector<double> weights;
+    for (auto &c : candidates) {
+        weights.push_back(weight(c));
+    }
+
+    size_t placed = 0;
+    while (placed < count) {
+        // Racks filled up drop out, their shares go to the others in the next round
+        double total = 0;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (candidates[i].alloc_cnt < candidates[i].free_page_num) {
+                total += weights[i];
+            }
+        }
+        if (total == 0) {
+            break;
+        }
+
+        size_t rest = count - placed;
+        size_t progress = 0;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            Candidate &c = candidates[i];
+            if (c.alloc_cnt < c.free_page_num) {
+                size_t share = std::min<size_t>(c.free_page_num - c.alloc_cnt,
+                                                rest * (weights[i] / total));
+                c.alloc_cnt += share;
+                progress += share;
+            }
+        }
+
+        if (progress == 0) {
+            // Fewer pages left than the racks have shares, draw one by weight
+            double r = std::uniform_real_distribution<double>(0, total)(rng);
+            size_t pick = candidates.size();
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                if (candidates[i].alloc_cnt < candidates[i].free_page_num && weights[i] > 0) {
+                    // The last open rack takes the draw if rounding leaves `r` positive
+                    pick = i;
+                    r -= weights[i];
+                    if (r < 0) {
+                        break;
+                    }
+                }
+            }
+            candidates[pick].alloc_cnt++;
+            progress = 1;
+        }
+        placed += progress;
+    }
+    return placed;
+}
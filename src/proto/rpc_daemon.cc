@@ -17,24 +17,75 @@ RemotePageRefMeta* get_remote_page_ref(DaemonContext& daemon_context, page_id_t
                                        PageMetadata* page_meta);
 
 /**
- * @brief Broadcast the DN that has the ref of the current page, delete its ref; and notify all
- * clients that have accessed the page under the current rack to delete the corresponding caches.
+ * @brief Seal the page slot, broadcast the DN that has the ref of the current page to delete its
+ * ref; and notify all clients that have accessed the page under the current rack to delete the
+ * corresponding caches.
  *
  * @param daemon_context
  * @param page_id
  * @param page_meta
- * @return void
+ * @return std::vector<boost::fibers::shared_future<void>> The ref deletions on DNs, which are not
+ * waited for since their direct io validates the page slot. The page memory can be reused after
+ * them.
  */
-void broadcast_del_page_ref_cache(DaemonContext& daemon_context, page_id_t page_id,
-                                  PageMetadata* page_meta, mac_id_t unless_daemon = -1);
+std::vector<boost::fibers::shared_future<void>> broadcast_del_page_ref_cache(
+    DaemonContext& daemon_context, page_id_t page_id, PageMetadata* page_meta,
+    mac_id_t unless_daemon = -1, mac_id_t new_daemon_id = master_id);
+
+/**
+ * @brief Enqueue the deletion of the ref of `page_id` on `daemon_conn`. Pages enqueued to the same
+ * daemon within `del_page_ref_batch_window_us` are sent by one `delPageRDMARef` request.
+ *
+ * @param daemon_context
+ * @param daemon_conn
+ * @param page_id
+ * @param new_daemon_id
+ * @return boost::fibers::shared_future<void> The completion of the whole batch
+ */
+boost::fibers::shared_future<void> enqueue_del_page_ref(DaemonContext& daemon_context,
+                                                        DaemonToDaemonConnection* daemon_conn,
+                                                        page_id_t page_id, mac_id_t new_daemon_id);
 
 void do_page_direct_io(DaemonContext& daemon_context, DaemonToClientConnection& client_connection,
                        GetPageCXLRefOrProxyRequest& req,
                        ResponseHandle<GetPageCXLRefOrProxyReply>& resp_handle,
+                       PageMetadata* page_meta, std::shared_lock<CortSharedMutex>& page_ref_lock,
                        RemotePageRefMeta* remote_page_ref_meta);
 
-void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
-                     PageMetadata*& swapout_page_meta);
+/**
+ * @brief Stream io through the bounce slot of the client, in chunks of RDMA io each followed by a
+ * read of the page slot, with up to `stream_window` chunks in flight. Write chunks go as the
+ * client stages them, and read chunks are published to the client once validated.
+ */
+void do_page_stream_io(DaemonContext& daemon_context, GetPageCXLRefOrProxyRequest& req,
+                       PageMetadata* page_meta, std::shared_lock<CortSharedMutex>& page_ref_lock,
+                       RemotePageRefMeta* remote_page_ref_meta);
+
+/**
+ * @brief Drop the stale ref of a page that has left the peer, and find where the page is now.
+ *
+ * @param read_only Whether the new ref only serves reads, otherwise it's tracked by the owner
+ * @return RemotePageRefMeta* The new ref, or nullptr if the page has migrated to this rack
+ */
+RemotePageRefMeta* refresh_remote_page_ref(DaemonContext& daemon_context, page_id_t page_id,
+                                           PageMetadata* page_meta,
+                                           std::shared_lock<CortSharedMutex>& page_ref_lock,
+                                           RemotePageRefMeta* remote_page_ref_meta,
+                                           bool read_only);
+
+/**
+ * @brief Register an untracked ref on its owner before io other than reads, since a write through
+ * it may land on a frame reused after the page left.
+ *
+ * @return RemotePageRefMeta* The tracked ref, or nullptr if the page has migrated to this rack
+ */
+RemotePageRefMeta* track_remote_page_ref(DaemonContext& daemon_context, page_id_t page_id,
+                                         PageMetadata* page_meta,
+                                         std::shared_lock<CortSharedMutex>& page_ref_lock,
+                                         RemotePageRefMeta* remote_page_ref_meta);
+
+bool pick_evict_page(DaemonContext& daemon_context, rcmp::PageSizeClass page_class,
+                     page_id_t& swapout_page_id, PageMetadata*& swapout_page_meta);
 
 bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
                   PageMetadata* swapin_page_meta, int remote_page_ref_meta_version);
@@ -48,7 +99,7 @@ void joinRack(DaemonContext& daemon_context, DaemonToClientConnection& client_co
                 daemon_context.m_options.rack_id);
 
     /* 1. Notify master to get mac id */
-    auto fu = daemon_context.m_conn_manager.GetMasterConnection().erpc_conn->call<CortPromise>(
+    auto fu = daemon_context.m_conn_manager.GetMasterConnection().GetErpcConn().call<CortPromise>(
         rpc_master::joinClient, {
                                     .rack_id = daemon_context.m_options.rack_id,
                                 });
@@ -59,16 +110,37 @@ void joinRack(DaemonContext& daemon_context, DaemonToClientConnection& client_co
 
     daemon_context.m_conn_manager.AddConnection(client_connection.client_id, &client_connection);
 
-    /* 2. Allocate msg queue */
+    /* 2. Allocate msg queue, and spread clients over the lanes of workers */
     msgq::MsgQueue* q = daemon_context.m_msgq_manager.allocQueue();
+    auto& lane_worker =
+        *daemon_context.m_workers[client_connection.ref_idx % daemon_context.m_workers.size()];
     client_connection.msgq_conn = std::make_unique<MsgQClient>(
         msgq::MsgQueueRPC{daemon_context.m_msgq_manager.nexus.get(), q,
-                          daemon_context.m_msgq_manager.nexus->GetPublicMsgQ(), &daemon_context});
+                          lane_worker.msgq_rpc->m_recv_queue, &daemon_context});
+
+    // Half of the lane queue takes the requests of its clients, the other half their replies to
+    // the daemon. Both halves are shared by the clients connected to the lane, which learn their
+    // shrunk windows from the next responses. The daemon's window for a client also fits its
+    // requests into the half of the client's queue left by the responses to the client.
+    int credit_window;
+    {
+        std::lock_guard<Mutex> lck(lane_worker.lane_lck);
+        lane_worker.lane_clients.push_back(&client_connection);
+        credit_window = std::max<int>(1, msgq_ring_depth / 2 / lane_worker.lane_clients.size());
+        for (DaemonToClientConnection* conn : lane_worker.lane_clients) {
+            conn->msgq_conn->rpc.set_peer_credit_window(credit_window);
+            conn->msgq_conn->rpc.set_credit_window(credit_window);
+        }
+    }
 
     /* 3. Notify client via UDP to create msgq */
+    uintptr_t msgq_zone_start_addr =
+        reinterpret_cast<uintptr_t>(daemon_context.m_cxl_format.msgq_zone_start_addr);
     msgq::MsgUDPConnPacket pkt;
     pkt.recv_q_off = reinterpret_cast<uintptr_t>(client_connection.msgq_conn->rpc.m_send_queue) -
-                     reinterpret_cast<uintptr_t>(daemon_context.m_cxl_format.msgq_zone_start_addr);
+                     msgq_zone_start_addr;
+    pkt.send_q_off = reinterpret_cast<uintptr_t>(client_connection.msgq_conn->rpc.m_recv_queue) -
+                     msgq_zone_start_addr;
     UDPClient<msgq::MsgUDPConnPacket> udp_cli;
     udp_cli.send(req.client_ipv4.get_string(), req.client_port, pkt);
 
@@ -80,6 +152,13 @@ void joinRack(DaemonContext& daemon_context, DaemonToClientConnection& client_co
     reply.client_mac_id = client_connection.client_id;
     reply.daemon_mac_id = daemon_context.m_daemon_id;
     reply.half_life_us = daemon_context.m_options.heat_half_life_us;
+    reply.msgq_credit_window = credit_window;
+    DLOG_ASSERT(client_connection.ref_idx < daemon_context.m_options.max_client_limit,
+                "Too many clients for the stream bounce regions");
+    reply.stream_bounce_offset =
+        reinterpret_cast<uintptr_t>(daemon_context.m_stream_zone_addr) -
+        reinterpret_cast<uintptr_t>(daemon_context.m_cxl_format.start_addr) +
+        client_connection.ref_idx * stream_bounce_slot_num * sizeof(StreamBounceSlot);
 }
 
 void crossRackConnect(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon_connection,
@@ -93,8 +172,14 @@ void crossRackConnect(DaemonContext& daemon_context, DaemonToDaemonConnection& d
     daemon_connection.rack_id = req.rack_id;
     daemon_connection.ip = req.ip.get_string();
     daemon_connection.port = req.port;
-    daemon_connection.erpc_conn = std::make_unique<ErpcClient>(
-        daemon_context.GetErpc(), daemon_connection.ip, daemon_connection.port);
+    daemon_connection.swap_stats = daemon_context.m_swap_ctrl.AddRack(req.rack_id);
+    daemon_connection.page_slot_table_addr = req.page_slot_table_addr;
+    daemon_connection.page_slot_table_rkey = req.page_slot_table_rkey;
+    daemon_connection.page_data_start_addr = req.page_data_start_addr;
+    DLOG_ASSERT(req.worker_num == daemon_context.m_options.worker_num,
+                "Daemon %d runs %d workers, but %d here", req.mac_id, req.worker_num,
+                daemon_context.m_options.worker_num);
+    daemon_connection.peer_worker_num = req.worker_num;
 
     DLOG("Connect with daemon [rack:%d --- id:%d], port = %d", daemon_connection.rack_id,
          daemon_connection.daemon_id, daemon_connection.port);
@@ -105,12 +190,21 @@ void crossRackConnect(DaemonContext& daemon_context, DaemonToDaemonConnection& d
     auto& reply = resp_handle.Get();
     reply.daemon_mac_id = daemon_context.m_daemon_id;
     reply.rdma_port = local_addr.second;
+    reply.page_slot_table_addr =
+        reinterpret_cast<uintptr_t>(daemon_context.m_page_table.page_slot_table);
+    reply.page_slot_table_rkey =
+        daemon_context.GetMR(daemon_context.m_page_table.page_slot_table)->rkey;
+    reply.page_data_start_addr =
+        reinterpret_cast<uintptr_t>(daemon_context.m_cxl_format.page_data_start_addr);
+    reply.worker_num = daemon_context.m_options.worker_num;
 }
 
 void getPageCXLRefOrProxy(DaemonContext& daemon_context,
                           DaemonToClientConnection& client_connection,
                           GetPageCXLRefOrProxyRequest& req,
                           ResponseHandle<GetPageCXLRefOrProxyReply>& resp_handle) {
+    // Shared with the background swap, which keeps the page meta after this returns
+    auto epoch_guard = std::make_shared<EpochGuard>(daemon_context.m_page_table.epoch);
     PageMetadata* page_meta;
     page_id_t page_id = GetPageID(req.gaddr);
     offset_t page_offset = GetPageOffset(req.gaddr);
@@ -120,6 +214,11 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
     } else {
     retry:
         page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(page_id);
+        // The page may be first known by a ref invalidation, which doesn't carry its class
+        rcmp::PageSizeClass page_class = GetPageClass(req.gaddr);
+        if (page_meta->page_class != page_class) {
+            page_meta->page_class = page_class;
+        }
     }
     std::shared_lock<CortSharedMutex> page_ref_lock(page_meta->page_ref_lock);
 
@@ -129,7 +228,7 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
         daemon_context.m_stats.page_hit_sample();
 
         // DLOG("insert ref_client for page %lu", page_id);
-        page_vm_meta->ref_client.insert(&client_connection);
+        page_vm_meta->ref_client.Insert(client_connection.ref_idx);
 
         resp_handle.Init();
         auto& reply = resp_handle.Get();
@@ -149,6 +248,15 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
     DaemonToDaemonConnection* dest_daemon_conn;
     RemotePageRefMeta* remote_page_ref_meta =
         get_remote_page_ref(daemon_context, page_id, page_meta);
+    if (req.type != GetPageCXLRefOrProxyRequest::READ &&
+        req.type != GetPageCXLRefOrProxyRequest::STREAM_READ) {
+        remote_page_ref_meta = track_remote_page_ref(daemon_context, page_id, page_meta,
+                                                     page_ref_lock, remote_page_ref_meta);
+        if (remote_page_ref_meta == nullptr) {
+            // The page has been migrated to this rack
+            goto retry;
+        }
+    }
 
     auto calc_heat = [&]() {
         FreqStats::Heatness remote_page_current_hot;
@@ -162,8 +270,11 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
         return remote_page_current_hot.last_heat;
     };
 
+    auto swap_stats = remote_page_ref_meta->remote_page_daemon_conn->swap_stats;
+
     // Swap only when over the watermark
-    if (remote_page_ref_meta->swapping || calc_heat() < daemon_context.m_options.hot_swap_watermark)
+    if (remote_page_ref_meta->swapping ||
+        calc_heat() < daemon_context.m_swap_ctrl.GetWatermark(swap_stats))
     /*
      * ---------------------------------------------
      *                PAGE DIRECT IO
@@ -171,9 +282,34 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
      */
     {
         daemon_context.m_stats.page_dio_sample();
+        switch (req.type) {
+            case GetPageCXLRefOrProxyRequest::READ:
+                daemon_context.m_swap_ctrl.RecordDirectIO(swap_stats, req.u.read.cn_read_size);
+                break;
+            case GetPageCXLRefOrProxyRequest::WRITE:
+                daemon_context.m_swap_ctrl.RecordDirectIO(swap_stats, req.u.write.cn_write_size);
+                break;
+            case GetPageCXLRefOrProxyRequest::WRITE_RAW:
+                daemon_context.m_swap_ctrl.RecordDirectIO(swap_stats,
+                                                          req.u.write_raw.cn_write_raw_size);
+                break;
+            case GetPageCXLRefOrProxyRequest::CAS:
+                daemon_context.m_swap_ctrl.RecordDirectIO(swap_stats, sizeof(uint64_t));
+                break;
+            case GetPageCXLRefOrProxyRequest::STREAM_READ:
+            case GetPageCXLRefOrProxyRequest::STREAM_WRITE:
+                daemon_context.m_swap_ctrl.RecordDirectIO(swap_stats, req.u.stream.size);
+                break;
+        }
 
-        do_page_direct_io(daemon_context, client_connection, req, resp_handle,
-                          remote_page_ref_meta);
+        if (req.type == GetPageCXLRefOrProxyRequest::STREAM_READ ||
+            req.type == GetPageCXLRefOrProxyRequest::STREAM_WRITE) {
+            resp_handle.Init();
+            do_page_stream_io(daemon_context, req, page_meta, page_ref_lock, remote_page_ref_meta);
+        } else {
+            do_page_direct_io(daemon_context, client_connection, req, resp_handle, page_meta,
+                              page_ref_lock, remote_page_ref_meta);
+        }
 
         auto& reply = resp_handle.Get();
         reply.refs = false;
@@ -195,7 +331,8 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
         page_ref_lock.unlock();
 
         // Execute in background.
-        daemon_context.GetFiberPool().EnqueueTask([=, &daemon_context]() {
+        daemon_context.GetFiberPool().EnqueueStealableTask([=, &daemon_context]() {
+            (void)epoch_guard;
             do_page_swap(daemon_context, page_id, page_meta, remote_page_ref_meta_version);
         });
     }
@@ -203,56 +340,147 @@ void getPageCXLRefOrProxy(DaemonContext& daemon_context,
     goto retry;
 }
 
+/**
+ * @brief Allocate the memory of up to `count` pages, fewer if the memory is full or has no
+ * contiguous frames for more large pages.
+ */
+static std::vector<PageVMMapMetadata*> alloc_local_page_memory(DaemonContext& daemon_context,
+                                                               size_t count,
+                                                               rcmp::PageSizeClass page_class) {
+    std::vector<PageVMMapMetadata*> page_vm_metas;
+    while (page_vm_metas.size() < count) {
+        PageVMMapMetadata* page_vm_meta = daemon_context.m_page_table.AllocPageMemory(page_class);
+        if (page_vm_meta == nullptr) {
+            break;
+        }
+        page_vm_metas.push_back(page_vm_meta);
+    }
+    return page_vm_metas;
+}
+
+/**
+ * @brief Free the page memory in `page_vm_metas` from index `from`, which no page was applied to.
+ */
+static void free_local_page_memory(DaemonContext& daemon_context,
+                                   std::vector<PageVMMapMetadata*>& page_vm_metas, size_t from) {
+    for (size_t c = from; c < page_vm_metas.size(); ++c) {
+        daemon_context.m_page_table.FreePageMemory(page_vm_metas[c]);
+    }
+    page_vm_metas.resize(from);
+}
+
+/**
+ * @brief Map the pages just allocated to this rack into the first of `page_vm_metas`.
+ */
+static void apply_local_pages(DaemonContext& daemon_context, page_id_t start_page_id,
+                              std::vector<PageVMMapMetadata*>& page_vm_metas,
+                              rcmp::PageSizeClass page_class, size_t count = -1) {
+    size_t units = GetPageUnits(page_class);
+    count = std::min(count, page_vm_metas.size());
+    for (size_t c = 0; c < count; ++c) {
+        page_id_t page_id = start_page_id + c * units;
+        PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(page_id);
+        page_meta->page_class = page_class;
+        daemon_context.m_page_table.ApplyPageMemory(page_id, page_meta, page_vm_metas[c]);
+        daemon_context.m_page_table.AddUnvisitPage(page_id, page_meta);
+    }
+}
+
 void allocPageMemory(DaemonContext& daemon_context, DaemonToMasterConnection& master_connection,
                      AllocPageMemoryRequest& req,
                      ResponseHandle<AllocPageMemoryReply>& resp_handle) {
-    DLOG_ASSERT(daemon_context.m_page_table.TestAllocPageMemory(req.count),
-                "Can't allocate more page memory");
-
-    for (size_t c = 0; c < req.count; ++c) {
-        PageVMMapMetadata* page_vm_meta = daemon_context.m_page_table.AllocPageMemory();
-        PageMetadata* page_meta =
-            daemon_context.m_page_table.FindOrCreatePageMeta(req.start_page_id + c);
-        daemon_context.m_page_table.ApplyPageMemory(page_meta, page_vm_meta);
-        daemon_context.m_page_table.unvisited_pages.push({req.start_page_id + c, page_meta});
+    // All or none, so the master can place the pages elsewhere
+    std::vector<PageVMMapMetadata*> page_vm_metas =
+        alloc_local_page_memory(daemon_context, req.count, req.page_class);
+    bool ret = page_vm_metas.size() == req.count;
+    if (ret) {
+        apply_local_pages(daemon_context, req.start_page_id, page_vm_metas, req.page_class);
+    } else {
+        free_local_page_memory(daemon_context, page_vm_metas, 0);
     }
 
     resp_handle.Init();
     auto& reply = resp_handle.Get();
-    reply.ret = true;
+    reply.ret = ret;
+}
+
+/**
+ * @brief Ask the master for a new lease of page ids in background, once the leases run low.
+ */
+static void refill_page_id_lease(DaemonContext& daemon_context) {
+    size_t lease_size = daemon_context.m_options.page_id_lease_size;
+    if (lease_size == 0 || daemon_context.m_page_id_lease.Remaining() >= lease_size / 2 ||
+        daemon_context.m_page_id_lease.refilling.exchange(true)) {
+        return;
+    }
+
+    daemon_context.GetFiberPool().EnqueueStealableTask([&daemon_context, lease_size]() {
+        auto fu =
+            daemon_context.m_conn_manager.GetMasterConnection().GetErpcConn().call<CortPromise>(
+                rpc_master::leasePageID, {
+                                             .mac_id = daemon_context.m_daemon_id,
+                                             .count = lease_size,
+                                         });
+
+        auto& resp = fu.get();
+        if (resp.count > 0) {
+            daemon_context.m_page_id_lease.Add(resp.start_page_id, resp.count);
+        }
+        daemon_context.m_page_id_lease.refilling.store(false);
+    });
 }
 
 void allocPage(DaemonContext& daemon_context, DaemonToClientConnection& client_connection,
                AllocPageRequest& req, ResponseHandle<AllocPageReply>& resp_handle) {
     DLOG("alloc %lu new pages", req.count);
 
+    // The memory is taken first, so the master places on this rack only the pages it can hold
+    std::vector<PageVMMapMetadata*> page_vm_metas =
+        alloc_local_page_memory(daemon_context, req.count, req.page_class);
+
+    // Base pages are allocated from the lease if it holds enough ids, and the rack enough memory
+    if (req.page_class == rcmp::PAGE_4K && page_vm_metas.size() == req.count) {
+        page_id_t start_page_id = daemon_context.m_page_id_lease.Take(req.count);
+        refill_page_id_lease(daemon_context);
+        if (start_page_id != invalid_page_id) {
+            apply_local_pages(daemon_context, start_page_id, page_vm_metas, req.page_class);
+
+            resp_handle.Init();
+            auto& reply = resp_handle.Get();
+            reply.start_page_id = start_page_id;
+            return;
+        }
+    }
+
     // Calling allocPage to the MN
-    auto fu = daemon_context.m_conn_manager.GetMasterConnection().erpc_conn->call<CortPromise>(
+    auto fu = daemon_context.m_conn_manager.GetMasterConnection().GetErpcConn().call<CortPromise>(
         rpc_master::allocPage, {
                                    .mac_id = daemon_context.m_daemon_id,
                                    .count = req.count,
+                                   .page_class = req.page_class,
+                                   .local_page_num = page_vm_metas.size(),
                                });
 
     // A page swap may occur due to insufficient local pages during the wait period.
     auto& resp = fu.get();
 
     page_id_t start_page_id = resp.current_start_page_id;
+    rcmp::PageSizeClass page_class = req.page_class;
+    size_t units = GetPageUnits(page_class);
 
-    for (size_t c = 0; c < resp.current_page_count; ++c) {
-        PageVMMapMetadata* page_vm_meta = daemon_context.m_page_table.AllocPageMemory();
-        PageMetadata* page_meta =
-            daemon_context.m_page_table.FindOrCreatePageMeta(start_page_id + c);
-        daemon_context.m_page_table.ApplyPageMemory(page_meta, page_vm_meta);
-        daemon_context.m_page_table.unvisited_pages.push({start_page_id + c, page_meta});
-    }
+    apply_local_pages(daemon_context, start_page_id, page_vm_metas, page_class,
+                      resp.current_page_count);
+    free_local_page_memory(daemon_context, page_vm_metas, resp.current_page_count);
 
     if (resp.other_page_count > 0) {
         // Get remote ref in background, avoid blocking when accessing remote memory.
-        daemon_context.GetFiberPool().EnqueueTask([&, resp]() {
+        daemon_context.GetFiberPool().EnqueueStealableTask([&, resp, page_class, units]() {
+            EpochGuard epoch_guard(daemon_context.m_page_table.epoch);
             for (size_t i = 0; i < resp.other_page_count; ++i) {
-                page_id_t remote_page_id = resp.current_start_page_id + i;
+                page_id_t remote_page_id = resp.other_start_page_id + i * units;
                 PageMetadata* page_meta =
                     daemon_context.m_page_table.FindOrCreatePageMeta(remote_page_id);
+                page_meta->page_class = page_class;
                 std::shared_lock<CortSharedMutex> page_ref_lock(page_meta->page_ref_lock);
 
                 if (page_meta->vm_meta) {
@@ -273,14 +501,16 @@ void allocPage(DaemonContext& daemon_context, DaemonToClientConnection& client_c
 void freePage(DaemonContext& daemon_context, DaemonToClientConnection& client_connection,
               FreePageRequest& req, ResponseHandle<FreePageReply>& resp_handle) {
     // Free page in background
-    daemon_context.GetFiberPool().EnqueueTask([&, req]() {
+    daemon_context.GetFiberPool().EnqueueStealableTask([&, req]() {
         // Calling freePage to the MN
-        auto fu = daemon_context.m_conn_manager.GetMasterConnection().erpc_conn->call<CortPromise>(
-            rpc_master::freePage, {
-                                      .mac_id = daemon_context.m_daemon_id,
-                                      .start_page_id = req.start_page_id,
-                                      .count = req.count,
-                                  });
+        auto fu =
+            daemon_context.m_conn_manager.GetMasterConnection().GetErpcConn().call<CortPromise>(
+                rpc_master::freePage, {
+                                          .mac_id = daemon_context.m_daemon_id,
+                                          .start_page_id = req.start_page_id,
+                                          .count = req.count,
+                                          .page_class = req.page_class,
+                                      });
 
         auto& resp = fu.get();
     });
@@ -302,42 +532,60 @@ void free(DaemonContext& daemon_context, DaemonToClientConnection& client_connec
 
 void getPageRDMARef(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon_connection,
                     GetPageRDMARefRequest& req, ResponseHandle<GetPageRDMARefReply>& resp_handle) {
+    EpochGuard epoch_guard(daemon_context.m_page_table.epoch);
     PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(req.page_id);
-    DLOG_ASSERT(page_meta->vm_meta != nullptr, "Can't find page %lu", req.page_id);
 
     std::shared_lock<CortSharedMutex> page_ref_lock(page_meta->page_ref_lock);
 
+    resp_handle.Init();
+    auto& reply = resp_handle.Get();
+
+    // The page has migrated away since the requester learned its owner
+    if (page_meta->vm_meta == nullptr) {
+        reply.ret = false;
+        return;
+    }
+
     uintptr_t local_addr = daemon_context.GetVirtualAddr(page_meta->vm_meta->cxl_memory_offset);
     ibv_mr* mr = daemon_context.GetMR(reinterpret_cast<void*>(local_addr));
 
     DLOG_ASSERT(mr->addr != nullptr, "The page %lu isn't registered to rdma memory", req.page_id);
 
-    page_meta->vm_meta->ref_daemon.insert(&daemon_connection);
+    page_meta->vm_meta->ref_daemon.Insert(daemon_connection.ref_idx);
 
     // DLOG("get page %lu rdma ref [%#lx, %u], local [%#lx, %u],  peer_session = %d, daemon_id =
     // %u",
     //      req.page_id, local_addr, mr->rkey, local_addr, mr->lkey, daemon_connection.peer_session,
     //      daemon_connection.daemon_id);
 
-    resp_handle.Init();
-    auto& reply = resp_handle.Get();
+    reply.ret = true;
     reply.addr = local_addr;
     reply.rkey = mr->rkey;
 }
 
-void delPageRDMARef(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon_connection,
+void delPageRDMARef(DaemonContext& daemon_context, DaemonConnection& peer_connection,
                     DelPageRDMARefRequest& req, ResponseHandle<DelPageRDMARefReply>& resp_handle) {
-    PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(req.page_id);
-
-    std::unique_lock<CortSharedMutex> ref_lock(page_meta->page_ref_lock);
-    RemotePageRefMeta* remote_page_ref_meta = page_meta->remote_ref_meta;
-
-    DLOG_ASSERT(remote_page_ref_meta != nullptr, "Can't find page %lu's ref", req.page_id);
-
-    // Clear the ref of this page
-    daemon_context.m_page_table.EraseRemotePageRefMeta(page_meta);
+    EpochGuard epoch_guard(daemon_context.m_page_table.epoch);
+    uint64_t now_us = getUsTimestamp();
+    for (size_t i = 0; i < req.page_num; ++i) {
+        page_id_t page_id = req.pages[i].page_id;
+        PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(page_id);
+
+        std::unique_lock<CortSharedMutex> ref_lock(page_meta->page_ref_lock);
+
+        // Follow the page to its new daemon, unless it's migrating to this daemon
+        mac_id_t new_daemon_id = req.pages[i].new_daemon_id;
+        page_meta->dir_lease_daemon_id =
+            (new_daemon_id == daemon_context.m_daemon_id) ? master_id : new_daemon_id;
+        page_meta->dir_lease_expire_us = now_us + daemon_context.m_options.dir_lease_us;
+
+        // Clear the ref of this page. Both the owner and the master may delete the same ref.
+        if (page_meta->remote_ref_meta != nullptr) {
+            daemon_context.m_page_table.EraseRemotePageRefMeta(page_meta);
+        }
 
-    // DLOG("DN %u: Del page %ld rdma ref", daemon_context.m_daemon_id, req.page_id);
+        // DLOG("DN %u: Del page %ld rdma ref", daemon_context.m_daemon_id, page_id);
+    }
 
     resp_handle.Init();
     auto& reply = resp_handle.Get();
@@ -348,6 +596,7 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
                  MigratePageRequest& req, ResponseHandle<MigratePageReply>& resp_handle) {
     daemon_context.m_stats.page_swap_sample();
 
+    EpochGuard epoch_guard(daemon_context.m_page_table.epoch);
     PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(req.page_id);
 
     std::unique_lock<CortSharedMutex> ref_lock(page_meta->page_ref_lock);
@@ -361,8 +610,9 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
 
     // DLOG("DN %u: delPageRefBroadcast page %lu", daemon_context.m_daemon_id, req.page_id);
 
-    broadcast_del_page_ref_cache(daemon_context, req.page_id, page_meta,
-                                 daemon_connection.daemon_id);
+    auto ref_del_fu_vec =
+        broadcast_del_page_ref_cache(daemon_context, req.page_id, page_meta,
+                                     daemon_connection.daemon_id, daemon_connection.daemon_id);
 
     // Use RDMA one-side reads and writes to swap the data of pages.
 
@@ -376,10 +626,14 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
     DaemonToDaemonConnection* daemon_conn = dynamic_cast<DaemonToDaemonConnection*>(
         daemon_context.m_conn_manager.GetConnection(req.mac_id));
 
+    // The swapped pages are of the same class
+    rcmp::PageSizeClass page_class = page_meta->vm_meta->page_class;
+
     rdma_rc::SgeWr sge_wrs[2];
     int sge_wrs_cnt = 1;
-    daemon_conn->rdma_conn->prep_write(&sge_wrs[0], local_addr, lkey, page_size,
-                                       req.swapin_page_addr, req.swapin_page_rkey, false);
+    daemon_conn->GetRDMAConn()->prep_write(&sge_wrs[0], local_addr, lkey,
+                                           GetPageSize(page_class), req.swapin_page_addr,
+                                           req.swapin_page_rkey, false);
 
     // DLOG(
     //     "DN %u: rdma write submit. local_addr = %ld, lkey = %u, req.swapin_page_addr = %ld,  "
@@ -395,19 +649,19 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
     } else {
         is_swap = true;
         // The case of swapping requires reading each other's pages locally
-        while (!daemon_context.m_page_table.TestAllocPageMemory(1)) {
-            // Current swap area is full, waiting for completion.
+        while ((local_page_vm_meta = daemon_context.m_page_table.AllocPageMemory(page_class)) ==
+               nullptr) {
+            // Current swap area is full or too fragmented, waiting for completion.
             boost::this_fiber::yield();
         }
 
-        local_page_vm_meta = daemon_context.m_page_table.AllocPageMemory();
-
         uintptr_t swapin_addr =
             daemon_context.GetVirtualAddr(local_page_vm_meta->cxl_memory_offset);
         mr = daemon_context.GetMR(reinterpret_cast<void*>(swapin_addr));
         lkey = mr->lkey;
-        daemon_conn->rdma_conn->prep_read(&sge_wrs[1], swapin_addr, lkey, page_size,
-                                          req.swapout_page_addr, req.swapout_page_rkey, false);
+        daemon_conn->GetRDMAConn()->prep_read(&sge_wrs[1], swapin_addr, lkey,
+                                              GetPageSize(page_class), req.swapout_page_addr,
+                                              req.swapout_page_rkey, false);
         sge_wrs_cnt++;
 
         // DLOG(
@@ -417,21 +671,24 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
         //     req.swapout_page_rkey);
     }
 
-    auto fu = daemon_conn->rdma_conn->submit(sge_wrs, sge_wrs_cnt);
+    auto fu = daemon_conn->GetRDMAConn()->submit(sge_wrs, sge_wrs_cnt);
 
     fu.get();
 
     // DLOG("DN %u: reply", daemon_context.m_daemon_id);
 
     // Recycling of migrated pages
-    daemon_context.m_page_table.CancelPageMemory(page_meta);
+    daemon_context.m_page_table.CancelPageMemory(page_meta, std::move(ref_del_fu_vec));
+    daemon_context.m_swap_ctrl.RecordSwapOut(req.page_id);
 
     if (is_swap) {
         // If there are no pages left, migrated to the swap area, now moving to the page area
         PageMetadata* swap_page_meta =
             daemon_context.m_page_table.FindOrCreatePageMeta(req.swap_page_id);
-        daemon_context.m_page_table.ApplyPageMemory(swap_page_meta, local_page_vm_meta);
-        daemon_context.m_page_table.unvisited_pages.push({req.swap_page_id, swap_page_meta});
+        swap_page_meta->page_class = page_class;
+        daemon_context.m_page_table.ApplyPageMemory(req.swap_page_id, swap_page_meta,
+                                                    local_page_vm_meta);
+        daemon_context.m_page_table.AddUnvisitPage(req.swap_page_id, swap_page_meta);
     }
 
     resp_handle.Init();
@@ -442,25 +699,87 @@ void migratePage(DaemonContext& daemon_context, DaemonToDaemonConnection& daemon
 
 void tryDelPage(DaemonContext& daemon_context, DaemonToMasterConnection& master_connection,
                 TryDelPageRequest& req, ResponseHandle<TryDelPageReply>& resp_handle) {
-    PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(req.page_id);
-    DLOG_ASSERT(page_meta->vm_meta != nullptr, "Can't find page %lu", req.page_id);
+    resp_handle.Init(req.page_num * sizeof(bool));
+    auto& reply = resp_handle.Get();
+    reply.page_num = req.page_num;
+
+    EpochGuard epoch_guard(daemon_context.m_page_table.epoch);
+    for (size_t i = 0; i < req.page_num; ++i) {
+        page_id_t page_id = req.page_ids[i];
+        PageMetadata* page_meta = daemon_context.m_page_table.FindOrCreatePageMeta(page_id);
+        DLOG_ASSERT(page_meta->vm_meta != nullptr, "Can't find page %lu", page_id);
+
+        std::unique_lock<CortSharedMutex> page_ref_lock(page_meta->page_ref_lock,
+                                                        std::try_to_lock);
+        if (!page_ref_lock.owns_lock()) {
+            reply.rets[i] = false;
+            continue;
+        }
 
-    std::unique_lock<CortSharedMutex> page_ref_lock(page_meta->page_ref_lock, std::try_to_lock);
-    if (!page_ref_lock.owns_lock()) {
-        resp_handle.Init();
-        auto& reply = resp_handle.Get();
-        reply.ret = false;
-        return;
+        auto ref_del_fu_vec = broadcast_del_page_ref_cache(daemon_context, page_id, page_meta, -1);
+
+        daemon_context.m_page_table.CancelPageMemory(page_meta, std::move(ref_del_fu_vec));
+        daemon_context.m_swap_ctrl.RecordPageFree(page_id);
+        page_ref_lock.unlock();
+        daemon_context.m_page_table.ErasePageMeta(page_id, page_meta);
+        reply.rets[i] = true;
     }
+}
 
-    broadcast_del_page_ref_cache(daemon_context, req.page_id, page_meta, -1);
+/**
+ * @brief Read the ref of a page published in its directory slot on mn, without the master cpu.
+ * The slot is latched shared by an rdma fetch-and-add, read, and unlatched in one doorbell, which
+ * runs in order on mn. Refs got this way aren't tracked by mn, their direct io is validated by the
+ * page slot of the peer like any ref.
+ *
+ * @return false if the slot is being written or holds another page
+ */
+static bool read_published_page_ref(DaemonContext& daemon_context, page_id_t page_id,
+                                    RemotePageRefMeta* remote_page_ref_meta) {
+    DaemonToMasterConnection& master_conn = daemon_context.m_conn_manager.GetMasterConnection();
+    DaemonWorker& worker = daemon_context.GetWorker();
+    if (master_conn.dir_slot_table_rkey == 0 || worker.dir_read_bufs.empty()) {
+        return false;
+    }
 
-    daemon_context.m_page_table.CancelPageMemory(page_meta);
+    DirSlotRead* buf = worker.dir_read_bufs.back();
+    worker.dir_read_bufs.pop_back();
+
+    uint32_t lkey = worker.dir_read_mr->lkey;
+    uint32_t rkey = master_conn.dir_slot_table_rkey;
+    uintptr_t slot_addr = master_conn.dir_slot_table_addr +
+                          (page_id % PageDirectory::dir_slot_num) * sizeof(DirSlot);
+
+    rdma_rc::RDMAConnection* rdma_conn = master_conn.GetRDMAConn();
+    rdma_rc::SgeWr sge_wrs[3];
+    rdma_conn->prep_fetch_add(&sge_wrs[0], reinterpret_cast<uintptr_t>(&buf->latch), lkey,
+                              slot_addr, rkey, 1);
+    rdma_conn->prep_read(&sge_wrs[1], reinterpret_cast<uintptr_t>(&buf->slot), lkey,
+                         sizeof(DirSlot), slot_addr, rkey, false);
+    rdma_conn->prep_fetch_add(&sge_wrs[2], reinterpret_cast<uintptr_t>(&buf->unlatch), lkey,
+                              slot_addr, rkey, -1ul);
+    auto fu = rdma_conn->submit(sge_wrs, 3);
+    int ret = fu.get();
+
+    bool hit = ret == 0 && (buf->latch & DirSlot::exclusive_bit) == 0 &&
+               buf->slot.tag == DirSlot::Tag(page_id) &&
+               buf->slot.daemon_id != daemon_context.m_daemon_id;
+    DaemonToDaemonConnection* dest_daemon_conn = nullptr;
+    if (hit) {
+        // The slot may name a daemon not connected yet
+        dest_daemon_conn = dynamic_cast<DaemonToDaemonConnection*>(
+            daemon_context.m_conn_manager.FindConnection(buf->slot.daemon_id));
+        hit = dest_daemon_conn != nullptr;
+    }
+    if (hit) {
+        remote_page_ref_meta->remote_page_addr = buf->slot.ref_addr;
+        remote_page_ref_meta->remote_page_rkey = buf->slot.ref_rkey;
+        remote_page_ref_meta->remote_page_daemon_conn = dest_daemon_conn;
+        remote_page_ref_meta->tracked = false;
+    }
 
-    resp_handle.Init();
-    auto& reply = resp_handle.Get();
-    reply.ret = true;
-    return;
+    worker.dir_read_bufs.push_back(buf);
+    return hit;
 }
 
 RemotePageRefMeta* get_remote_page_ref(DaemonContext& daemon_context, page_id_t page_id,
@@ -471,48 +790,106 @@ RemotePageRefMeta* get_remote_page_ref(DaemonContext& daemon_context, page_id_t
             // If it is the first time the page is accessed, go through the DirectIO process
             // (when remote_page_ref_meta does not exist, it means it must be the first time)
 
-            /* 2. Get the daemon for the page on mn and latch the page */
+            /* 1. With a directory lease, get the ref from the owner directly */
+            if (page_meta->dir_lease_daemon_id != master_id &&
+                getUsTimestamp() < page_meta->dir_lease_expire_us) {
+                dest_daemon_conn = dynamic_cast<DaemonToDaemonConnection*>(
+                    daemon_context.m_conn_manager.FindConnection(page_meta->dir_lease_daemon_id));
+            } else {
+                dest_daemon_conn = nullptr;
+            }
+            // The owner may have left, then the lease is useless
+            if (dest_daemon_conn != nullptr) {
+                auto rref_fu = dest_daemon_conn->GetErpcConn().call<CortPromise>(
+                    rpc_daemon::getPageRDMARef, {
+                                                    .mac_id = daemon_context.m_daemon_id,
+                                                    .page_id = page_id,
+                                                });
+
+                auto& rref_resp = rref_fu.get();
+                if (rref_resp.ret) {
+                    remote_page_ref_meta->remote_page_addr = rref_resp.addr;
+                    remote_page_ref_meta->remote_page_rkey = rref_resp.rkey;
+                    remote_page_ref_meta->remote_page_daemon_conn = dest_daemon_conn;
+                    return;
+                }
+            }
+            // The lease is stale, fall back to the directory
+            page_meta->dir_lease_daemon_id = master_id;
+
+            /* 2. Read the ref published by mn, or resolve it on mn, which latches the page if
+             * the ref isn't cached */
+            if (read_published_page_ref(daemon_context, page_id, remote_page_ref_meta)) {
+                page_meta->dir_lease_daemon_id =
+                    remote_page_ref_meta->remote_page_daemon_conn->daemon_id;
+                page_meta->dir_lease_expire_us =
+                    getUsTimestamp() + daemon_context.m_options.dir_lease_us;
+                return;
+            }
+
+            bool cached;
             {
-                auto latch_fu =
+                auto resolve_fu =
                     daemon_context.m_conn_manager.GetMasterConnection()
-                        .erpc_conn->call<CortPromise>(rpc_master::latchRemotePage,
-                                                      {
-                                                          .mac_id = daemon_context.m_daemon_id,
-                                                          .exclusive = false,
-                                                          .page_id = page_id,
-                                                      });
+                        .GetErpcConn(page_id)
+                        .call<CortPromise>(rpc_master::resolvePageRDMARef,
+                                           {
+                                               .mac_id = daemon_context.m_daemon_id,
+                                               .page_id = page_id,
+                                           });
 
-                auto& latch_resp = latch_fu.get();
+                auto& resolve_resp = resolve_fu.get();
 
                 // Getting the peer connection
                 dest_daemon_conn = dynamic_cast<DaemonToDaemonConnection*>(
-                    daemon_context.m_conn_manager.GetConnection(latch_resp.dest_daemon_id));
+                    daemon_context.m_conn_manager.GetConnection(resolve_resp.dest_daemon_id));
+
+                cached = resolve_resp.cached;
+                if (cached) {
+                    remote_page_ref_meta->remote_page_addr = resolve_resp.addr;
+                    remote_page_ref_meta->remote_page_rkey = resolve_resp.rkey;
+                    remote_page_ref_meta->remote_page_daemon_conn = dest_daemon_conn;
+                }
+            }
+
+            page_meta->dir_lease_daemon_id = dest_daemon_conn->daemon_id;
+            page_meta->dir_lease_expire_us =
+                getUsTimestamp() + daemon_context.m_options.dir_lease_us;
+
+            if (cached) {
+                return;
             }
 
             /* 3. Get remote memory rdma ref */
             {
-                auto rref_fu = dest_daemon_conn->erpc_conn->call<CortPromise>(
+                auto rref_fu = dest_daemon_conn->GetErpcConn().call<CortPromise>(
                     rpc_daemon::getPageRDMARef, {
                                                     .mac_id = daemon_context.m_daemon_id,
                                                     .page_id = page_id,
                                                 });
 
                 auto& rref_resp = rref_fu.get();
+                DLOG_ASSERT(rref_resp.ret, "Can't find page %lu on latched daemon %u", page_id,
+                            dest_daemon_conn->daemon_id);
                 remote_page_ref_meta->remote_page_addr = rref_resp.addr;
                 remote_page_ref_meta->remote_page_rkey = rref_resp.rkey;
                 remote_page_ref_meta->remote_page_daemon_conn = dest_daemon_conn;
             }
 
-            /* 4. unlatch */
+            /* 4. unlatch, and fill the ref into the directory cache */
             {
                 auto unlatch_fu =
                     daemon_context.m_conn_manager.GetMasterConnection()
-                        .erpc_conn->call<CortPromise>(rpc_master::unLatchRemotePage,
-                                                      {
-                                                          .mac_id = daemon_context.m_daemon_id,
-                                                          .exclusive = false,
-                                                          .page_id = page_id,
-                                                      });
+                        .GetErpcConn(page_id)
+                        .call<CortPromise>(
+                            rpc_master::unLatchRemotePage,
+                            {
+                                .mac_id = daemon_context.m_daemon_id,
+                                .exclusive = false,
+                                .page_id = page_id,
+                                .page_addr = remote_page_ref_meta->remote_page_addr,
+                                .page_rkey = remote_page_ref_meta->remote_page_rkey,
+                            });
 
                 auto& resp = unlatch_fu.get();
             }
@@ -527,35 +904,56 @@ RemotePageRefMeta* get_remote_page_ref(DaemonContext& daemon_context, page_id_t
  * @param page_meta
  * @param unless_daemon For page swap, the relocated page has already removed the ref on the
  * requesting daemon's end, so there is no need to initiate another `delPageRDMARef` request.
+ * @param new_daemon_id The daemon the page is migrating to, which the deleters take as a lease
  */
-void broadcast_del_page_ref_cache(DaemonContext& daemon_context, page_id_t page_id,
-                                  PageMetadata* page_meta, mac_id_t unless_daemon) {
+std::vector<boost::fibers::shared_future<void>> broadcast_del_page_ref_cache(
+    DaemonContext& daemon_context, page_id_t page_id, PageMetadata* page_meta,
+    mac_id_t unless_daemon, mac_id_t new_daemon_id) {
     // DLOG("DN %u: delPageRefBroadcast page %lu", daemon_context.m_daemon_id, page_id);
 
-    std::vector<ErpcFuture<rpc_daemon::DelPageRDMARefReply, CortPromise<void>>> del_ref_fu_vec;
+    // From now on, the direct io of DNs on this page fails the validation
+    daemon_context.m_page_table.SealPageMemory(page_meta);
+
+    std::vector<boost::fibers::shared_future<void>> del_ref_fu_vec;
     std::vector<MsgQFuture<rpc_client::RemovePageCacheReply, CortPromise<msgq::MsgBuffer>>>
         remove_cache_fu_vec;
 
-    for (auto daemon_conn : page_meta->vm_meta->ref_daemon) {
+    page_meta->vm_meta->ref_daemon.ForEach([&](uint32_t ref_idx) {
+        DaemonToDaemonConnection* daemon_conn =
+            daemon_context.m_conn_manager.GetDaemonByRefIdx(ref_idx);
         if (daemon_conn->daemon_id == unless_daemon) {
-            continue;
+            return;
         }
         // DLOG("DN %u: delPageRefBroadcast for i = %ld, peer_session = %d, daemon_id = %u",
         //      daemon_context.m_daemon_id, i, daemon_conn->peer_session, daemon_conn->daemon_id);
 
-        auto fu = daemon_conn->erpc_conn->call<CortPromise>(
-            rpc_daemon::delPageRDMARef, {
-                                            .mac_id = daemon_context.m_daemon_id,
-                                            .page_id = page_id,
-                                        });
-
-        del_ref_fu_vec.push_back(std::move(fu));
-    }
+        del_ref_fu_vec.push_back(
+            enqueue_del_page_ref(daemon_context, daemon_conn, page_id, new_daemon_id));
+    });
 
-    for (auto client_conn : page_meta->vm_meta->ref_client) {
+    // Clients whose credit window is used up are requeued after the others, so that one busy
+    // client doesn't hold back the invalidation of the rest
+    std::vector<DaemonToClientConnection*> busy_clients;
+    page_meta->vm_meta->ref_client.ForEach([&](uint32_t ref_idx) {
+        DaemonToClientConnection* client_conn =
+            daemon_context.m_conn_manager.GetClientByRefIdx(ref_idx);
         // DLOG("DN %u: delPageCacheBroadcast client_id = %u", daemon_context.m_daemon_id,
         //      client_conn->client_id);
 
+        auto fu = client_conn->msgq_conn->try_call<CortPromise>(
+            rpc_client::removePageCache, {
+                                             .mac_id = daemon_context.m_daemon_id,
+                                             .page_id = page_id,
+                                         });
+        if (!fu) {
+            busy_clients.push_back(client_conn);
+            return;
+        }
+
+        remove_cache_fu_vec.push_back(std::move(*fu));
+    });
+
+    for (auto client_conn : busy_clients) {
         auto fu = client_conn->msgq_conn->call<CortPromise>(
             rpc_client::removePageCache, {
                                              .mac_id = daemon_context.m_daemon_id,
@@ -565,26 +963,80 @@ void broadcast_del_page_ref_cache(DaemonContext& daemon_context, page_id_t page_
         remove_cache_fu_vec.push_back(std::move(fu));
     }
 
-    for (auto& fu : del_ref_fu_vec) {
-        fu.get();
-    }
-    // DLOG("Finish delPageRefBroadcast");
-
     for (auto& fu : remove_cache_fu_vec) {
         fu.get();
     }
     // DLOG("Finish delPageCacheBroadcast");
+
+    return del_ref_fu_vec;
+}
+
+static void flush_del_page_ref(DaemonContext& daemon_context, DaemonToDaemonConnection* daemon_conn,
+                               std::shared_ptr<DelPageRefBatch> batch) {
+    size_t page_num = batch->pages.size();
+    auto fu = daemon_conn->GetErpcConn().call<CortPromise>(
+        rpc_daemon::delPageRDMARef,
+        sizeof(DelPageRDMARefRequest) + page_num * sizeof(PageRefInvalidation),
+        [&](DelPageRDMARefRequest* req_buf) {
+            req_buf->mac_id = daemon_context.m_daemon_id;
+            req_buf->page_num = page_num;
+            memcpy(req_buf->pages, batch->pages.data(), page_num * sizeof(PageRefInvalidation));
+        });
+
+    fu.get();
+    batch->done.set_value();
+}
+
+boost::fibers::shared_future<void> enqueue_del_page_ref(DaemonContext& daemon_context,
+                                                        DaemonToDaemonConnection* daemon_conn,
+                                                        page_id_t page_id, mac_id_t new_daemon_id) {
+    std::unique_lock<CortMutex> lck(daemon_conn->del_ref_batch_lock);
+
+    std::shared_ptr<DelPageRefBatch> batch = daemon_conn->del_ref_batch;
+    if (batch == nullptr) {
+        batch = std::make_shared<DelPageRefBatch>();
+        daemon_conn->del_ref_batch = batch;
+
+        // Flush the batch when the window closes, unless it has been full before. Use a dedicated
+        // fiber so that handlers waiting for the batch can't starve the worker fibers.
+        boost::fibers::fiber([&daemon_context, daemon_conn, batch]() {
+            boost::this_fiber::sleep_for(std::chrono::microseconds(
+                daemon_context.m_options.del_page_ref_batch_window_us));
+
+            {
+                std::unique_lock<CortMutex> lck(daemon_conn->del_ref_batch_lock);
+                if (daemon_conn->del_ref_batch != batch) {
+                    return;
+                }
+                daemon_conn->del_ref_batch.reset();
+            }
+
+            flush_del_page_ref(daemon_context, daemon_conn, batch);
+        }).detach();
+    }
+
+    batch->pages.push_back({page_id, new_daemon_id});
+
+    if (batch->pages.size() == del_page_ref_batch_max_num) {
+        daemon_conn->del_ref_batch.reset();
+        boost::fibers::fiber([&daemon_context, daemon_conn, batch]() {
+            flush_del_page_ref(daemon_context, daemon_conn, batch);
+        }).detach();
+    }
+
+    return batch->done_fu;
 }
 
 void do_page_direct_io(DaemonContext& daemon_context, DaemonToClientConnection& client_connection,
                        GetPageCXLRefOrProxyRequest& req,
                        ResponseHandle<GetPageCXLRefOrProxyReply>& resp_handle,
+                       PageMetadata* page_meta, std::shared_lock<CortSharedMutex>& page_ref_lock,
                        RemotePageRefMeta* remote_page_ref_meta) {
     page_id_t page_id = GetPageID(req.gaddr);
     offset_t page_offset = GetPageOffset(req.gaddr);
 
     // Starting the DirectIO Process
-    DaemonToDaemonConnection* dest_daemon_conn = remote_page_ref_meta->remote_page_daemon_conn;
+    DaemonToDaemonConnection* dest_daemon_conn;
 
     // printf("freq = %ld, rkey = %d, addr = %ld\n", current_hot,
     //    remote_page_ref_meta->remote_page_rkey, remote_page_ref_meta->remote_page_addr);
@@ -646,54 +1098,277 @@ void do_page_direct_io(DaemonContext& daemon_context, DaemonToClientConnection&
         }
     }
 
-    /* 6. Calling one-side RDMA operation to read/write remote memory */
+    // The page slot is read into the hint of reply, which is overwritten after io.
+    auto& reply = resp_handle.Get();
+    uint32_t tag_lkey = daemon_context.GetMR(&reply.hint)->lkey;
+
+    while (true) {
+        dest_daemon_conn = remote_page_ref_meta->remote_page_daemon_conn;
+        rdma_rc::RDMAConnection* rdma_conn = dest_daemon_conn->GetRDMAConn();
+        uintptr_t remote_addr = remote_page_ref_meta->remote_page_addr + page_offset;
+        uint32_t remote_rkey = remote_page_ref_meta->remote_page_rkey;
+        uintptr_t slot_addr = dest_daemon_conn->page_slot_table_addr +
+                              (remote_page_ref_meta->remote_page_addr -
+                               dest_daemon_conn->page_data_start_addr) /
+                                  page_size * sizeof(PageSlot);
+
+        if (req.type == GetPageCXLRefOrProxyRequest::CAS) {
+            /* 6. A CAS isn't idempotent, so it's never redone. Pin the page in its slot first,
+             * which holds off the seal, and only CAS on the page pinned. */
+            rdma_rc::SgeWr sge_wrs[2];
+            rdma_conn->prep_fetch_add(&sge_wrs[0], reinterpret_cast<uintptr_t>(&reply.hint),
+                                      tag_lkey, slot_addr, dest_daemon_conn->page_slot_table_rkey,
+                                      PageSlot::pin_unit);
+            // A failed fetch add took no pin, and left the hint as it was before
+            if (rdma_conn->submit(sge_wrs, 1).get() == 0) {
+                bool pinned = PageSlot::Match(reply.hint, page_id);
+
+                size_t sge_wrs_cnt = 0;
+                if (pinned) {
+                    rdma_conn->prep_cas(&sge_wrs[sge_wrs_cnt++], my_data_buf, my_lkey,
+                                        remote_addr, remote_rkey, req.u.cas.expected,
+                                        req.u.cas.desired);
+                }
+                rdma_conn->prep_fetch_add(&sge_wrs[sge_wrs_cnt++],
+                                          reinterpret_cast<uintptr_t>(&reply.hint), tag_lkey,
+                                          slot_addr, dest_daemon_conn->page_slot_table_rkey,
+                                          -PageSlot::pin_unit);
+                int ret = rdma_conn->submit(sge_wrs, sge_wrs_cnt).get();
+                // The pin would be left taken, and the CAS may have taken effect, so it can't
+                // be redone
+                DLOG_ASSERT(ret == 0, "CAS or unpin on the slot of page %lu failed", page_id);
+                if (pinned) {
+                    return;
+                }
+            }
+        } else {
+            /* 6. Calling one-side RDMA operation to read/write remote memory */
+            rdma_rc::SgeWr sge_wrs[2];
+            size_t sge_wrs_cnt = 0;
+            switch (req.type) {
+                case GetPageCXLRefOrProxyRequest::READ:
+                    rdma_conn->prep_read(&sge_wrs[sge_wrs_cnt++], my_data_buf, my_lkey, my_size,
+                                         remote_addr, remote_rkey, false);
+                    break;
+                case GetPageCXLRefOrProxyRequest::WRITE_RAW:
+                    rdma_conn->prep_write(&sge_wrs[sge_wrs_cnt++], my_data_buf, my_lkey, my_size,
+                                          remote_addr, remote_rkey, false);
+                    break;
+                default:
+                    break;
+            }
+
+            /* 7. Read the page slot after the io in the same doorbell. The peer seals the slot
+             * before the page data leaves, so a valid tag means the io was done on the page. A
+             * read or write found late is simply redone. */
+            rdma_conn->prep_read(&sge_wrs[sge_wrs_cnt++], reinterpret_cast<uintptr_t>(&reply.hint),
+                                 tag_lkey, sizeof(PageSlot), slot_addr,
+                                 dest_daemon_conn->page_slot_table_rkey, false);
+            // A failed io is redone like a late one, whatever tag the reply holds
+            if (rdma_conn->submit(sge_wrs, sge_wrs_cnt).get() == 0 &&
+                PageSlot::Match(reply.hint, page_id)) {
+                return;
+            }
+        }
+
+        /* 8. The page has left the peer, drop the stale ref and redo the io on the page */
+        remote_page_ref_meta = refresh_remote_page_ref(
+            daemon_context, page_id, page_meta, page_ref_lock, remote_page_ref_meta,
+            req.type == GetPageCXLRefOrProxyRequest::READ);
+        if (remote_page_ref_meta == nullptr) {
+            // The page has been migrated to this rack
+            uintptr_t local_addr =
+                daemon_context.GetVirtualAddr(page_meta->vm_meta->cxl_memory_offset) + page_offset;
+            switch (req.type) {
+                case GetPageCXLRefOrProxyRequest::READ:
+                    memcpy(reinterpret_cast<void*>(my_data_buf),
+                           reinterpret_cast<void*>(local_addr), my_size);
+                    break;
+                case GetPageCXLRefOrProxyRequest::WRITE:
+                    break;
+                case GetPageCXLRefOrProxyRequest::WRITE_RAW:
+                    memcpy(reinterpret_cast<void*>(local_addr),
+                           reinterpret_cast<void*>(my_data_buf), my_size);
+                    break;
+                case GetPageCXLRefOrProxyRequest::CAS: {
+                    uint64_t old_val = req.u.cas.expected;
+                    __atomic_compare_exchange_n(reinterpret_cast<uint64_t*>(local_addr), &old_val,
+                                                req.u.cas.desired, false, __ATOMIC_SEQ_CST,
+                                                __ATOMIC_SEQ_CST);
+                    reply.old_val = old_val;
+                    break;
+                }
+            }
+            return;
+        }
+    }
+}
+
+void do_page_stream_io(DaemonContext& daemon_context, GetPageCXLRefOrProxyRequest& req,
+                       PageMetadata* page_meta, std::shared_lock<CortSharedMutex>& page_ref_lock,
+                       RemotePageRefMeta* remote_page_ref_meta) {
+    page_id_t page_id = GetPageID(req.gaddr);
+    offset_t page_offset = GetPageOffset(req.gaddr);
+    bool is_read = (req.type == GetPageCXLRefOrProxyRequest::STREAM_READ);
+    size_t size = req.u.stream.size;
+    DLOG_ASSERT(size <= stream_bounce_size, "Stream io %lu is over the bounce slot", size);
+
+    StreamBounceSlot* slot = reinterpret_cast<StreamBounceSlot*>(
+        reinterpret_cast<uintptr_t>(daemon_context.m_cxl_format.start_addr) +
+        req.u.stream.bounce_offset);
+    uint32_t lkey = daemon_context.GetMR(slot)->lkey;
+
+    // The prefix of the stream done on the page, which the page slots validated
+    size_t done = 0;
+    while (done < size) {
+        DaemonToDaemonConnection* dest_daemon_conn = remote_page_ref_meta->remote_page_daemon_conn;
+        rdma_rc::RDMAConnection* rdma_conn = dest_daemon_conn->GetRDMAConn();
+        uintptr_t slot_addr = dest_daemon_conn->page_slot_table_addr +
+                              (remote_page_ref_meta->remote_page_addr -
+                               dest_daemon_conn->page_data_start_addr) /
+                                  page_size * sizeof(PageSlot);
+
+        // A ring of the chunks in flight, completed in order
+        rdma_rc::SgeWr sge_wrs[stream_window][2];
+        rdma_rc::RDMAFuture fus[stream_window];
+        size_t chunk_end[stream_window];
+        size_t head = 0, inflight = 0;
+        size_t issued = done;
+        bool moved = false;
+
+        while (inflight > 0 || (!moved && issued < size)) {
+            while (!moved && inflight < stream_window && issued < size) {
+                size_t end = std::min(issued + stream_chunk_size, size);
+                if (!is_read && slot->ready_size.load(std::memory_order_acquire) < end) {
+                    if (inflight > 0) {
+                        break;
+                    }
+                    // Wait for the client to stage the chunk
+                    boost::this_fiber::yield();
+                    continue;
+                }
+
+                size_t w = (head + inflight) % stream_window;
+                uintptr_t local_addr = reinterpret_cast<uintptr_t>(slot->data + issued);
+                uintptr_t remote_addr =
+                    remote_page_ref_meta->remote_page_addr + page_offset + issued;
+                if (is_read) {
+                    rdma_conn->prep_read(&sge_wrs[w][0], local_addr, lkey, end - issued,
+                                         remote_addr, remote_page_ref_meta->remote_page_rkey,
+                                         false);
+                } else {
+                    rdma_conn->prep_write(&sge_wrs[w][0], local_addr, lkey, end - issued,
+                                          remote_addr, remote_page_ref_meta->remote_page_rkey,
+                                          false);
+                }
+                rdma_conn->prep_read(&sge_wrs[w][1], reinterpret_cast<uintptr_t>(&slot->tags[w]),
+                                     lkey, sizeof(PageSlot), slot_addr,
+                                     dest_daemon_conn->page_slot_table_rkey, false);
+                fus[w] = rdma_conn->submit(sge_wrs[w], 2);
+                chunk_end[w] = end;
+                issued = end;
+                ++inflight;
+            }
+
+            int ret = fus[head].get();
+            // Chunks after a failed one are drained, and redone on where the page is now. A
+            // chunk whose wrs failed is redone too, whatever tag it read.
+            if (!moved && ret == 0 && PageSlot::Match(slot->tags[head], page_id)) {
+                done = chunk_end[head];
+                if (is_read) {
+                    slot->ready_size.store(done, std::memory_order_release);
+                }
+            } else {
+                moved = true;
+            }
+            head = (head + 1) % stream_window;
+            --inflight;
+        }
+
+        if (!moved) {
+            break;
+        }
+
+        remote_page_ref_meta = refresh_remote_page_ref(
+            daemon_context, page_id, page_meta, page_ref_lock, remote_page_ref_meta, is_read);
+        if (remote_page_ref_meta == nullptr) {
+            // The page has been migrated to this rack, the rest is done on it
+            void* local_addr = reinterpret_cast<void*>(
+                daemon_context.GetVirtualAddr(page_meta->vm_meta->cxl_memory_offset) +
+                page_offset + done);
+            if (is_read) {
+                memcpy(slot->data + done, local_addr, size - done);
+                slot->ready_size.store(size, std::memory_order_release);
+            } else {
+                while (slot->ready_size.load(std::memory_order_acquire) < size) {
+                    boost::this_fiber::yield();
+                }
+                memcpy(local_addr, slot->data + done, size - done);
+            }
+            return;
+        }
+    }
+}
+
+RemotePageRefMeta* refresh_remote_page_ref(DaemonContext& daemon_context, page_id_t page_id,
+                                           PageMetadata* page_meta,
+                                           std::shared_lock<CortSharedMutex>& page_ref_lock,
+                                           RemotePageRefMeta* remote_page_ref_meta,
+                                           bool read_only) {
+    int remote_page_ref_meta_version = remote_page_ref_meta->version;
+    page_ref_lock.unlock();
     {
-        rdma_rc::SgeWr sge_wr;
-        switch (req.type) {
-            case GetPageCXLRefOrProxyRequest::READ:
-                dest_daemon_conn->rdma_conn->prep_read(
-                    &sge_wr, my_data_buf, my_lkey, my_size,
-                    (remote_page_ref_meta->remote_page_addr + page_offset),
-                    remote_page_ref_meta->remote_page_rkey, false);
-                // DLOG("read size %u remote addr [%#lx, %u] to local addr [%#lx, %u]", my_size,
-                //      remote_page_ref_meta->remote_page_addr,
-                //      remote_page_ref_meta->remote_page_rkey, my_data_buf, my_lkey);
-                break;
-            case GetPageCXLRefOrProxyRequest::WRITE:
-                // dest_daemon_conn->rdma_conn->prep_write(
-                //     &sge_wr, my_data_buf, my_lkey, my_size,
-                //     (remote_page_ref_meta->remote_page_addr + page_offset),
-                //     remote_page_ref_meta->remote_page_rkey, false);
-                // client_connection.msgq_rpc->free_msg_buffer(wd_resp_raw);
-                break;
-            case GetPageCXLRefOrProxyRequest::WRITE_RAW:
-                dest_daemon_conn->rdma_conn->prep_write(
-                    &sge_wr, my_data_buf, my_lkey, my_size,
-                    (remote_page_ref_meta->remote_page_addr + page_offset),
-                    remote_page_ref_meta->remote_page_rkey, false);
-                // DLOG("write size %u remote addr [%#lx, %u] from local addr [%#lx, %u]",
-                // my_size,
-                //      remote_page_ref_meta->remote_page_addr + page_offset,
-                //      remote_page_ref_meta->remote_page_rkey, my_data_buf, my_lkey);
-                break;
-            case GetPageCXLRefOrProxyRequest::CAS:
-                dest_daemon_conn->rdma_conn->prep_cas(
-                    &sge_wr, my_data_buf, my_lkey,
-                    (remote_page_ref_meta->remote_page_addr + page_offset),
-                    remote_page_ref_meta->remote_page_rkey, req.u.cas.expected, req.u.cas.desired);
+        std::unique_lock<CortSharedMutex> ref_lock(page_meta->page_ref_lock);
+        if (page_meta->remote_ref_meta != nullptr &&
+            page_meta->remote_ref_meta->version == remote_page_ref_meta_version) {
+            daemon_context.m_page_table.EraseRemotePageRefMeta(page_meta);
+            page_meta->dir_lease_daemon_id = master_id;
         }
-        auto fu = dest_daemon_conn->rdma_conn->submit(&sge_wr, 1);
+    }
+    page_ref_lock.lock();
 
-        fu.get();
+    if (page_meta->vm_meta != nullptr) {
+        return nullptr;
+    }
+    remote_page_ref_meta = get_remote_page_ref(daemon_context, page_id, page_meta);
+    if (read_only) {
+        return remote_page_ref_meta;
+    }
+    return track_remote_page_ref(daemon_context, page_id, page_meta, page_ref_lock,
+                                 remote_page_ref_meta);
+}
+
+RemotePageRefMeta* track_remote_page_ref(DaemonContext& daemon_context, page_id_t page_id,
+                                         PageMetadata* page_meta,
+                                         std::shared_lock<CortSharedMutex>& page_ref_lock,
+                                         RemotePageRefMeta* remote_page_ref_meta) {
+    if (remote_page_ref_meta->tracked) {
+        return remote_page_ref_meta;
+    }
+
+    auto rref_fu =
+        remote_page_ref_meta->remote_page_daemon_conn->GetErpcConn().call<CortPromise>(
+            rpc_daemon::getPageRDMARef, {
+                                            .mac_id = daemon_context.m_daemon_id,
+                                            .page_id = page_id,
+                                        });
+    auto& rref_resp = rref_fu.get();
+    if (rref_resp.ret && rref_resp.addr == remote_page_ref_meta->remote_page_addr) {
+        remote_page_ref_meta->tracked = true;
+        return remote_page_ref_meta;
     }
+
+    // The published ref was stale
+    return refresh_remote_page_ref(daemon_context, page_id, page_meta, page_ref_lock,
+                                   remote_page_ref_meta, false);
 }
 
-void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
-                     PageMetadata*& swapout_page_meta) {
+bool pick_evict_page(DaemonContext& daemon_context, rcmp::PageSizeClass page_class,
+                     page_id_t& swapout_page_id, PageMetadata*& swapout_page_meta) {
     // Randomly select a page that has not been accessed by a client in this cabinet for
     // exchange Example: Exchange recipient's move-in pages, or requested but unused pages
-    bool has_unvisited_page =
-        daemon_context.m_page_table.PickUnvisitPage(swapout_page_id, swapout_page_meta);
+    bool has_unvisited_page = daemon_context.m_page_table.PickUnvisitPage(
+        swapout_page_id, swapout_page_meta, page_class);
 
     // If all pages are referenced by the client, get the oldest page as a swap page from
     // the client.
@@ -708,15 +1383,37 @@ void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
             // random sample pages to swapout
             auto rand_pick_vm_pages = daemon_context.m_page_table.RandomPickVMPage(
                 std::min((size_t)(daemon_context.m_page_table.current_used_page_num * 0.1),
-                         max_num_detect_pages));
+                         max_num_detect_pages),
+                page_class);
+            if (rand_pick_vm_pages.empty()) {
+                // No local page of this class to exchange
+                return false;
+            }
 
-            std::set<DaemonToClientConnection*> broadcast_clients;
+            // Union the referencing clients of the sampled pages, word by word when possible
+            uint64_t client_bits = 0;
+            std::set<uint32_t> overflow_client_idxs;
             for (auto& pagep : rand_pick_vm_pages) {
-                if (pagep.second->vm_meta != nullptr) {
-                    broadcast_clients.merge(pagep.second->vm_meta->ref_client);
+                PageVMMapMetadata* vm_meta = pagep.second->vm_meta;
+                if (vm_meta != nullptr && !vm_meta->ref_client.MergeInline(client_bits)) {
+                    vm_meta->ref_client.ForEach([&](uint32_t ref_idx) {
+                        if (ref_idx >= RefBitmap::inline_bits) {
+                            overflow_client_idxs.insert(ref_idx);
+                        }
+                    });
                 }
             }
 
+            std::vector<DaemonToClientConnection*> broadcast_clients;
+            auto add_broadcast_client = [&](uint32_t ref_idx) {
+                broadcast_clients.push_back(
+                    daemon_context.m_conn_manager.GetClientByRefIdx(ref_idx));
+            };
+            RefBitmap::ForEachBit(client_bits, add_broadcast_client);
+            for (uint32_t ref_idx : overflow_client_idxs) {
+                add_broadcast_client(ref_idx);
+            }
+
             if (broadcast_clients.empty()) {
                 for (auto& pagep : rand_pick_vm_pages) {
                     auto meta = pagep.second;
@@ -726,7 +1423,7 @@ void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
                         if (meta->vm_meta) {
                             swapout_page_id = pagep.first;
                             swapout_page_meta = meta;
-                            return;
+                            return true;
                         } else {
                             meta->page_ref_lock.unlock();
                         }
@@ -745,12 +1442,27 @@ void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
                 MsgQFuture<rpc_client::GetPagePastAccessFreqReply, CortPromise<msgq::MsgBuffer>>>
                 fu_vec;
 
-            for (auto& client_conn : broadcast_clients) {
-                auto fu = client_conn->msgq_conn->call<CortPromise>(
+            // The heat is only a hint, so busy clients are skipped unless all of them are
+            std::vector<DaemonToClientConnection*> busy_clients;
+            for (auto client_conn : broadcast_clients) {
+                auto fu = client_conn->msgq_conn->try_call<CortPromise>(
                     rpc_client::getPagePastAccessFreq,
                     (rpc_client::GetPagePastAccessFreqRequest)req);
+                if (!fu) {
+                    busy_clients.push_back(client_conn);
+                    continue;
+                }
+
+                fu_vec.push_back(std::move(*fu));
+            }
+            if (fu_vec.empty()) {
+                for (auto client_conn : busy_clients) {
+                    auto fu = client_conn->msgq_conn->call<CortPromise>(
+                        rpc_client::getPagePastAccessFreq,
+                        (rpc_client::GetPagePastAccessFreqRequest)req);
 
-                fu_vec.push_back(std::move(fu));
+                    fu_vec.push_back(std::move(fu));
+                }
             }
 
             for (auto& fu : fu_vec) {
@@ -772,10 +1484,10 @@ void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
                 if (meta->page_ref_lock.try_lock()) {
                     // Maybe the vm_meta is deleted after other worker swapping, so here we must
                     // lock at first.
-                    if (meta->vm_meta) {
+                    if (meta->vm_meta && meta->page_class == page_class) {
                         swapout_page_id = p.second;
                         swapout_page_meta = meta;
-                        return;
+                        return true;
                     } else {
                         meta->page_ref_lock.unlock();
                     }
@@ -786,14 +1498,18 @@ void pick_evict_page(DaemonContext& daemon_context, page_id_t& swapout_page_id,
             // If sampled pages are all locked by other worker, we need re-sampling pages.
         }
     }
+    return true;
 }
 
 bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
                   PageMetadata* swapin_page_meta, int remote_page_ref_meta_version) {
     std::unique_lock<CortSharedMutex> swapin_page_ref_lock(swapin_page_meta->page_ref_lock,
                                                            std::try_to_lock);
-    RemotePageRefMeta* remote_page_ref_meta =
-        daemon_context.m_page_table.FindOrCreateRemotePageRefMeta(swapin_page_meta);
+    // The ref may have been deleted for the page has left its daemon, don't create an empty one.
+    RemotePageRefMeta* remote_page_ref_meta = swapin_page_meta->remote_ref_meta;
+    if (remote_page_ref_meta == nullptr) {
+        return false;
+    }
 
     // First worker gets lock, does page-swaping work. Otherwise retry.
     if (!swapin_page_ref_lock.owns_lock()) {
@@ -802,8 +1518,7 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
     }
 
     // Determining whether a remote ref is invalid (ABA)
-    if (remote_page_ref_meta_version !=
-        daemon_context.m_page_table.FindOrCreateRemotePageRefMeta(swapin_page_meta)->version) {
+    if (remote_page_ref_meta_version != remote_page_ref_meta->version) {
         remote_page_ref_meta->swapping = false;
         return false;
     }
@@ -811,6 +1526,8 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
     /* 1. Prepare memory for the area of the page swap and determine if a page swap is required
      */
     DaemonToDaemonConnection* dest_daemon_conn = remote_page_ref_meta->remote_page_daemon_conn;
+    float swapin_page_heat =
+        (remote_page_ref_meta->ReadHeat() + remote_page_ref_meta->WriteHeat()).last_heat;
 
     // In the case of swapping, you need to swap one of your own pages to the other, and this
     // read/write process is done by the other party.
@@ -824,16 +1541,27 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
     PageMetadata* swapout_page_meta;
     PageVMMapMetadata* reserve_page_vm_meta;
     std::unique_lock<CortSharedMutex> swapout_page_ref_lock;
+    std::vector<boost::fibers::shared_future<void>> swapout_ref_del_fu_vec;
 
-    // First request memory for the page that will be migrated locally
-    if (!daemon_context.m_page_table.TestAllocPageMemory(1)) {
+    // A large page is swapped as a whole, in exchange for a local page of the same class
+    rcmp::PageSizeClass page_class = swapin_page_meta->page_class;
+    size_t units = GetPageUnits(page_class);
+
+    // First request memory for the page that will be migrated locally. A large page may find no
+    // contiguous frames, then it stays remote.
+    reserve_page_vm_meta = daemon_context.m_page_table.AllocPageMemory(page_class);
+    if (reserve_page_vm_meta == nullptr) {
         remote_page_ref_meta->swapping = false;
         return false;
     }
 
     // Not enough local, swap out page
-    if (daemon_context.m_page_table.NearlyFull()) {
-        pick_evict_page(daemon_context, swapout_page_id, swapout_page_meta);
+    if (daemon_context.m_page_table.NearlyFull(units)) {
+        if (!pick_evict_page(daemon_context, page_class, swapout_page_id, swapout_page_meta)) {
+            daemon_context.m_page_table.FreePageMemory(reserve_page_vm_meta);
+            remote_page_ref_meta->swapping = false;
+            return false;
+        }
 
         need_swapout = true;
         DLOG_ASSERT(swapout_page_id != invalid_page_id);
@@ -855,22 +1583,24 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
      */
     {
         auto latch_fu =
-            daemon_context.m_conn_manager.GetMasterConnection().erpc_conn->call<CortPromise>(
-                rpc_master::tryMigratePage, {
-                                                .mac_id = daemon_context.m_daemon_id,
-                                                .exclusive = true,
-                                                .page_id = swapin_page_id,
-                                                .page_heat = (remote_page_ref_meta->ReadHeat() +
-                                                              remote_page_ref_meta->WriteHeat())
-                                                                 .last_heat,
-                                                .page_id_swap = swapout_page_id,
-                                            });
+            daemon_context.m_conn_manager.GetMasterConnection()
+                .GetErpcConn(swapin_page_id)
+                .call<CortPromise>(rpc_master::tryMigratePage,
+                                   {
+                                       .mac_id = daemon_context.m_daemon_id,
+                                       .exclusive = true,
+                                       .page_id = swapin_page_id,
+                                       .page_daemon_id = dest_daemon_conn->daemon_id,
+                                       .page_heat = swapin_page_heat,
+                                       .page_id_swap = swapout_page_id,
+                                   });
 
         /* 2.1 Waiting for latch to finish */
         auto& try_resp = latch_fu.get();
         if (!try_resp.ret) {
             // If migrate failed, which means other DN is swapping same page, we clear the page
             // heat to delay the next swap.
+            daemon_context.m_page_table.FreePageMemory(reserve_page_vm_meta);
             swapin_page_meta->remote_ref_meta->ClearHeat();
             return false;
         }
@@ -885,11 +1615,10 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
      */
     if (need_swapout) {
         // DLOG("swap delPageRefAndCacheBroadcast");
-        broadcast_del_page_ref_cache(daemon_context, swapout_page_id, swapout_page_meta);
+        swapout_ref_del_fu_vec = broadcast_del_page_ref_cache(
+            daemon_context, swapout_page_id, swapout_page_meta, -1, dest_daemon_conn->daemon_id);
     }
 
-    // Alloc swapping page area
-    reserve_page_vm_meta = daemon_context.m_page_table.AllocPageMemory();
     // DLOG("reserve_page_vm_meta->offset = %#lx", reserve_page_vm_meta->cxl_memory_offset);
     swapin_addr = daemon_context.GetVirtualAddr(reserve_page_vm_meta->cxl_memory_offset);
     swapin_mr = daemon_context.GetMR(reinterpret_cast<void*>(swapin_addr));
@@ -910,7 +1639,7 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
     /* 3. Send page migration to daemon (tryMigratePage), wait for it to complete migration,
      * return to RPC */
     {
-        auto migrate_fu = dest_daemon_conn->erpc_conn->call<CortPromise>(
+        auto migrate_fu = dest_daemon_conn->GetErpcConn().call<CortPromise>(
             rpc_daemon::migratePage, {
                                          .mac_id = daemon_context.m_daemon_id,
                                          .page_id = swapin_page_id,  // Expectation migration page
@@ -930,8 +1659,11 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
     {
         if (is_swap) {
             // Recovery of migrated pages
-            daemon_context.m_page_table.ApplyPageMemory(swapin_page_meta, reserve_page_vm_meta);
-            daemon_context.m_page_table.CancelPageMemory(swapout_page_meta);
+            daemon_context.m_page_table.ApplyPageMemory(swapin_page_id, swapin_page_meta,
+                                                        reserve_page_vm_meta);
+            daemon_context.m_page_table.CancelPageMemory(swapout_page_meta,
+                                                         std::move(swapout_ref_del_fu_vec));
+            daemon_context.m_swap_ctrl.RecordSwapOut(swapout_page_id);
         } else {
             // remote server reject swap
             // TODO: maybe erase remote ref will call more rpc
@@ -950,20 +1682,27 @@ bool do_page_swap(DaemonContext& daemon_context, page_id_t swapin_page_id,
     /* 5. Send unLatchPageAndSwap to MN, change page dir, return RPC */
     {
         auto unlatch_fu =
-            daemon_context.m_conn_manager.GetMasterConnection().erpc_conn->call<CortPromise>(
-                rpc_master::MigratePageDone, {
-                                                 .mac_id = daemon_context.m_daemon_id,
-                                                 .page_id = swapin_page_id,
-                                                 .new_daemon_id = daemon_context.m_daemon_id,
-                                                 .new_rack_id = daemon_context.m_options.rack_id,
-                                                 .page_id_swap = swapout_page_id,
-                                                 .new_daemon_id_swap = dest_daemon_conn->daemon_id,
-                                                 .new_rack_id_swap = dest_daemon_conn->rack_id,
-                                             });
+            daemon_context.m_conn_manager.GetMasterConnection()
+                .GetErpcConn(swapin_page_id)
+                .call<CortPromise>(rpc_master::MigratePageDone,
+                                   {
+                                       .mac_id = daemon_context.m_daemon_id,
+                                       .page_id = swapin_page_id,
+                                       .new_daemon_id = daemon_context.m_daemon_id,
+                                       .new_rack_id = daemon_context.m_options.rack_id,
+                                       .page_id_swap = swapout_page_id,
+                                       .new_daemon_id_swap = dest_daemon_conn->daemon_id,
+                                       .new_rack_id_swap = dest_daemon_conn->rack_id,
+                                       .new_page_addr = is_swap ? swapin_addr : 0,
+                                       .new_page_rkey = swapin_key,
+                                   });
 
         unlatch_fu.get();
     }
 
+    daemon_context.m_swap_ctrl.RecordSwapIn(dest_daemon_conn->swap_stats, swapin_page_id,
+                                            swapin_page_heat, GetPageSize(page_class), is_swap);
+
     // DLOG("DN %u: Expect inPage %lu (from DN: %u) swap page finished!",
     // daemon_context.m_daemon_id,
     //      swapin_page_id, dest_daemon_conn->daemon_id);
@@ -1,7 +1,10 @@
 #include "proto/rpc_master.hpp"
 
+#include <algorithm>
 #include <boost/fiber/operations.hpp>
+#include <map>
 #include <mutex>
+#include <unordered_map>
 
 #include "lock.hpp"
 #include "promise.hpp"
@@ -12,6 +15,64 @@ using namespace std::literals;
 
 namespace rpc_master {
 
+// Leases are capped at this share of the free capacity of the rack
+constexpr static size_t lease_capacity_div = 4;
+
+// Pages freed under the latches at once, which bounds the pages a free holds across tryDelPage
+constexpr static size_t free_page_batch = 64;
+
+/**
+ * @brief Delete the refs handed out from the directory cache of the pages, and clear the cache. The
+ * pages must be exclusive latched.
+ *
+ * @param master_context
+ * @param pages The pages with the daemon they are migrating to
+ * @param unless_daemon The daemon which has already deleted its refs by itself
+ */
+static void invalidate_page_ref_cache(MasterContext& master_context,
+                                      const std::vector<PageRefInvalidation>& pages,
+                                      mac_id_t unless_daemon = master_id) {
+    std::unordered_map<mac_id_t, std::vector<PageRefInvalidation>> daemon_pages;
+    for (auto& p : pages) {
+        PageRefCache* ref_cache = master_context.m_page_directory.GetRefCache(p.page_id, false);
+        if (ref_cache == nullptr) {
+            continue;
+        }
+        {
+            std::lock_guard<SpinMutex> ref_lck(ref_cache->ref_lck);
+            for (mac_id_t daemon_id : ref_cache->ref_daemons) {
+                if (daemon_id != unless_daemon) {
+                    daemon_pages[daemon_id].push_back(p);
+                }
+            }
+            ref_cache->ref_daemons.clear();
+            ref_cache->ref_cached = false;
+        }
+        // Readers of the slot aren't tracked, and find the page gone by its page slot
+        master_context.m_page_directory.UnpublishRef(p.page_id);
+    }
+
+    std::vector<decltype(((ErpcClient*)0)->call<CortPromise>(rpc_daemon::delPageRDMARef, {}))>
+        fu_vec;
+    for (auto& p : daemon_pages) {
+        MasterToDaemonConnection* daemon_conn =
+            dynamic_cast<MasterToDaemonConnection*>(master_context.GetConnection(p.first));
+        size_t page_num = p.second.size();
+        fu_vec.push_back(daemon_conn->GetErpcConn().call<CortPromise>(
+            rpc_daemon::delPageRDMARef,
+            sizeof(rpc_daemon::DelPageRDMARefRequest) + page_num * sizeof(PageRefInvalidation),
+            [&](rpc_daemon::DelPageRDMARefRequest* req_buf) {
+                req_buf->mac_id = master_context.m_master_id;
+                req_buf->page_num = page_num;
+                memcpy(req_buf->pages, p.second.data(), page_num * sizeof(PageRefInvalidation));
+            }));
+    }
+
+    for (auto& fu : fu_vec) {
+        fu.get();
+    }
+}
+
 void joinDaemon(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
                 JoinDaemonRequest& req, ResponseHandle<JoinDaemonReply>& resp_handle) {
     mac_id_t mac_id = master_context.m_cluster_manager.mac_id_allocator->Gen();
@@ -25,6 +86,14 @@ void joinDaemon(MasterContext& master_context, MasterToDaemonConnection& daemon_
     reply.daemon_mac_id = mac_id;
     reply.master_mac_id = master_context.m_master_id;
     reply.rdma_port = local_addr.second;
+    reply.shard_num = master_context.m_shards.size();
+    if (master_context.m_dir_slot_mr != nullptr) {
+        reply.dir_slot_table_addr = reinterpret_cast<uintptr_t>(master_context.m_dir_slot_mr->addr);
+        reply.dir_slot_table_rkey = master_context.m_dir_slot_mr->rkey;
+    } else {
+        reply.dir_slot_table_addr = 0;
+        reply.dir_slot_table_rkey = 0;
+    }
 
     reply.other_rack_count = old_rack_count;
     master_context.m_cluster_manager.cluster_rack_table.foreach_all(
@@ -50,6 +119,10 @@ void joinDaemon(MasterContext& master_context, MasterToDaemonConnection& daemon_
     rack_table->with_cxl = req.with_cxl;
     rack_table->max_free_page_num = req.free_page_num;
     rack_table->current_allocated_page_num = 0;
+    for (size_t c = 0; c < page_class_num; ++c) {
+        rack_table->free_run_num[c] =
+            req.free_page_num / GetPageUnits(static_cast<rcmp::PageSizeClass>(c));
+    }
 
     rack_table->daemon_connect = &daemon_connection;
     rack_table->daemon_connect->rack_id = req.rack_id;
@@ -57,9 +130,6 @@ void joinDaemon(MasterContext& master_context, MasterToDaemonConnection& daemon_
     rack_table->daemon_connect->ip = req.ip.get_string();
     rack_table->daemon_connect->port = req.port;
 
-    rack_table->daemon_connect->erpc_conn = std::make_unique<ErpcClient>(
-        master_context.GetErpc(), rack_table->daemon_connect->ip, rack_table->daemon_connect->port);
-
     master_context.m_cluster_manager.cluster_rack_table.insert(req.rack_id, rack_table);
     master_context.m_cluster_manager.connect_table.insert(daemon_connection.daemon_id,
                                                           &daemon_connection);
@@ -94,74 +164,107 @@ void allocPage(MasterContext& master_context, MasterToDaemonConnection& daemon_c
     RackMacTable* rack_table =
         master_context.m_cluster_manager.cluster_rack_table[daemon_connection.rack_id];
 
-    page_id_t new_page_id = master_context.m_page_directory.page_id_allocator->MultiGen(req.count);
+    // Page ids of a large page are aligned, so that any address in it maps to its first page id
+    size_t units = GetPageUnits(req.page_class);
+    page_id_t new_page_id =
+        master_context.m_page_directory.page_id_allocator->MultiGen(req.count * units, units);
     DLOG_ASSERT(new_page_id != invalid_page_id, "no unusable page");
 
+    // The requesting daemon has already taken the memory of the pages it can hold
     size_t current_rack_alloc_page_num = std::min(
-        req.count, rack_table->GetMaxFreePageNum() - rack_table->GetCurrentAllocatedPageNum());
+        {req.count, rack_table->GetFreePageNum(req.page_class), req.local_page_num});
     size_t other_rack_alloc_page_num = req.count - current_rack_alloc_page_num;
 
     // ID of the allocated page
     size_t alloced_page_idx = 0;
     // Adopt the proximity principle to allocate pages to the rack where the daemon is located.
-    while (alloced_page_idx < current_rack_alloc_page_num) {
-        master_context.m_page_directory.AddPage(rack_table, new_page_id + alloced_page_idx);
-        alloced_page_idx++;
+    if (current_rack_alloc_page_num > 0) {
+        master_context.m_page_directory.AddPages(rack_table, new_page_id,
+                                                 current_rack_alloc_page_num, req.page_class);
+        alloced_page_idx = current_rack_alloc_page_num;
     }
 
     if (other_rack_alloc_page_num > 0) {
         // If the current daemon does not have a spare page, register allocPageMemory with the other
-        // rack daemon.
+        // rack daemons chosen by the placement policy.
 
-        struct CTX {
-            decltype(((ErpcClient*)0)->call<CortPromise>(rpc_daemon::allocPageMemory, {})) fu;
-            RackMacTable* rack_table;
-            page_id_t alloc_start_page_id;
-            size_t alloc_cnt;
-        };
-
-        std::vector<CTX> ctx_vec;
-
-        // Iterate through the rack table to find the rack allocation with free pages
+        PlacementPolicy& placement = *master_context.m_placement;
+        std::vector<PlacementPolicy::Candidate> candidates;
         master_context.m_cluster_manager.cluster_rack_table.foreach_all(
             [&](std::pair<const rack_id_t, RackMacTable*>& p) {
                 RackMacTable* rack_table = p.second;
-                size_t rack_alloc_page_num = std::min(
-                    other_rack_alloc_page_num,
-                    rack_table->GetMaxFreePageNum() - rack_table->GetCurrentAllocatedPageNum());
-
-                if (rack_alloc_page_num == 0) {
+                if (p.first == daemon_connection.rack_id) {
                     return true;
                 }
-
-                CTX ctx;
-                ctx.alloc_start_page_id = new_page_id + alloced_page_idx;
-                ctx.rack_table = rack_table;
-                ctx.alloc_cnt = rack_alloc_page_num;
-                ctx.fu = rack_table->daemon_connect->erpc_conn->call<CortPromise>(
-                    rpc_daemon::allocPageMemory,
-                    {
-                        .mac_id = master_context.m_master_id,
-                        .start_page_id = new_page_id + alloced_page_idx,
-                        .count = rack_alloc_page_num,
-                    });
-
-                ctx_vec.push_back(std::move(ctx));
-
-                alloced_page_idx += rack_alloc_page_num;
-
-                other_rack_alloc_page_num -= rack_alloc_page_num;
-                // If it reaches 0, stop traversing
-                return other_rack_alloc_page_num != 0;
+                candidates.push_back({
+                    .rack_table = rack_table,
+                    .free_page_num = rack_table->GetFreePageNum(req.page_class),
+                    .dio_rate = rack_table->dio_rate.load(std::memory_order_relaxed),
+                    .swap_rate = rack_table->swap_rate.load(std::memory_order_relaxed),
+                    .distance = placement.RackDistance(daemon_connection.rack_id, p.first),
+                });
+                return true;
             });
 
-        // join all ctx
-        for (auto& ctx : ctx_vec) {
-            ctx.fu.get();
+        struct CTX {
+            decltype(((ErpcClient*)0)->call<CortPromise>(rpc_daemon::allocPageMemory, {})) fu;
+            PlacementPolicy::Candidate* candidate;
+            page_id_t alloc_start_page_id;
+            size_t alloc_cnt;
+        };
+
+        // Runs of page ids still to place. A daemon may lack the memory the master counted on,
+        // such as contiguous frames of a large page, then its run is placed again on the others.
+        std::vector<std::pair<page_id_t, size_t>> unplaced = {
+            {new_page_id + alloced_page_idx * units, other_rack_alloc_page_num}};
+        while (!unplaced.empty()) {
+            std::vector<CTX> ctx_vec;
+            for (auto& run : unplaced) {
+                for (auto& c : candidates) {
+                    c.alloc_cnt = 0;
+                }
+                size_t placed = placement.Place(candidates, run.second);
+                DLOG_ASSERT(placed == run.second, "no free page in cluster");
+
+                // Page ids stay contiguous across the racks, in the order of the candidates
+                page_id_t start_page_id = run.first;
+                for (auto& c : candidates) {
+                    if (c.alloc_cnt == 0) {
+                        continue;
+                    }
+
+                    CTX ctx;
+                    ctx.alloc_start_page_id = start_page_id;
+                    ctx.candidate = &c;
+                    ctx.alloc_cnt = c.alloc_cnt;
+                    ctx.fu = c.rack_table->daemon_connect->GetErpcConn().call<CortPromise>(
+                        rpc_daemon::allocPageMemory,
+                        {
+                            .mac_id = master_context.m_master_id,
+                            .start_page_id = ctx.alloc_start_page_id,
+                            .count = c.alloc_cnt,
+                            .page_class = req.page_class,
+                        });
+
+                    ctx_vec.push_back(std::move(ctx));
+
+                    // Held for the call, so the next run isn't placed on the same memory
+                    c.free_page_num -= c.alloc_cnt;
+                    start_page_id += c.alloc_cnt * units;
+                }
+            }
 
-            for (size_t i = 0; i < ctx.alloc_cnt; ++i) {
-                master_context.m_page_directory.AddPage(ctx.rack_table,
-                                                        ctx.alloc_start_page_id + i);
+            // join all ctx
+            unplaced.clear();
+            for (auto& ctx : ctx_vec) {
+                if (ctx.fu.get().ret) {
+                    master_context.m_page_directory.AddPages(ctx.candidate->rack_table,
+                                                             ctx.alloc_start_page_id,
+                                                             ctx.alloc_cnt, req.page_class);
+                } else {
+                    ctx.candidate->free_page_num = 0;
+                    unplaced.push_back({ctx.alloc_start_page_id, ctx.alloc_cnt});
+                }
             }
         }
     }
@@ -171,40 +274,158 @@ void allocPage(MasterContext& master_context, MasterToDaemonConnection& daemon_c
     reply.current_start_page_id = new_page_id;
     reply.current_page_count = current_rack_alloc_page_num;
     reply.other_start_page_id = (req.count - current_rack_alloc_page_num > 0)
-                                    ? (new_page_id + alloced_page_idx)
+                                    ? (new_page_id + current_rack_alloc_page_num * units)
                                     : invalid_page_id;
     reply.other_page_count = req.count - current_rack_alloc_page_num;
 }
 
 void freePage(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
               FreePageRequest& req, ResponseHandle<FreePageReply>& resp_handle) {
-    RackMacTable* rack_table;
-    PageRackMetadata* page_meta;
+    PageDirectory& page_directory = master_context.m_page_directory;
+    size_t units = GetPageUnits(req.page_class);
+
+    for (size_t b = 0; b < req.count; b += free_page_batch) {
+        page_id_t batch_start_page_id = req.start_page_id + b * units;
+        size_t batch_count = std::min(free_page_batch, req.count - b);
+
+        std::vector<page_id_t> pending(batch_count);
+        for (size_t i = 0; i < batch_count; ++i) {
+            pending[i] = batch_start_page_id + i * units;
+        }
+
+        while (!pending.empty()) {
+            // Only try to latch, so the latches held across tryDelPage never wait for others.
+            // Pages latched by a swap or a resolve are retried in the next round.
+            std::vector<page_id_t> latched;
+            std::vector<page_id_t> retry;
+            for (page_id_t page_id : pending) {
+                if (page_directory.TryLatchPage(page_id)) {
+                    latched.push_back(page_id);
+                } else {
+                    retry.push_back(page_id);
+                }
+            }
 
-    for (size_t i = 0; i < req.count; ++i) {
-        page_id_t page_id = req.start_page_id + i;
-    retry:
-        page_meta = master_context.m_page_directory.FindPage(page_id);
+            // Need to delete page meta, cache, and other metadata on the racks of the pages
+            std::map<rack_id_t, std::vector<page_id_t>> rack_pages;
+            for (page_id_t page_id : latched) {
+                PageExtent extent;
+                bool found = page_directory.FindPage(page_id, &extent);
+                DLOG_ASSERT(found, "Can't find page %lu", page_id);
+                rack_pages[extent.rack_id].push_back(page_id);
+            }
 
-        // Need to delete page meta, cache, and other metadata on a given rack
+            // Try to delete the pages on their racks at once, avoid dead lock when page swap
+            struct CTX {
+                decltype(((ErpcClient*)0)->call<CortPromise>(rpc_daemon::tryDelPage, {})) fu;
+                RackMacTable* rack_table;
+                std::vector<page_id_t>* page_ids;
+            };
+            std::vector<CTX> ctx_vec;
+            for (auto& p : rack_pages) {
+                RackMacTable* rack_table =
+                    master_context.m_cluster_manager.cluster_rack_table[p.first];
+                std::vector<page_id_t>& page_ids = p.second;
+                ctx_vec.push_back({
+                    .fu = rack_table->daemon_connect->GetErpcConn().call<CortPromise>(
+                        rpc_daemon::tryDelPage,
+                        sizeof(rpc_daemon::TryDelPageRequest) + page_ids.size() * sizeof(page_id_t),
+                        [&](rpc_daemon::TryDelPageRequest* req_buf) {
+                            req_buf->mac_id = master_context.m_master_id;
+                            req_buf->page_num = page_ids.size();
+                            memcpy(req_buf->page_ids, page_ids.data(),
+                                   page_ids.size() * sizeof(page_id_t));
+                        }),
+                    .rack_table = rack_table,
+                    .page_ids = &page_ids,
+                });
+            }
 
-        std::unique_lock<CortSharedMutex> page_lock(page_meta->latch);
-        rack_table = master_context.m_cluster_manager.cluster_rack_table[page_meta->rack_id];
+            std::vector<PageRefInvalidation> invalidations;
+            std::vector<std::pair<RackMacTable*, std::vector<page_id_t>>> deleted;
+            for (auto& ctx : ctx_vec) {
+                auto& reply = ctx.fu.get();
+                deleted.push_back({ctx.rack_table, {}});
+                for (size_t i = 0; i < reply.page_num; ++i) {
+                    page_id_t page_id = (*ctx.page_ids)[i];
+                    if (reply.rets[i]) {
+                        deleted.back().second.push_back(page_id);
+                        invalidations.push_back({page_id, master_id});
+                    } else {
+                        retry.push_back(page_id);
+                    }
+                }
+            }
 
-        // try delete page on rack, avoid dead lock when page swap
+            invalidate_page_ref_cache(master_context, invalidations);
 
-        auto fu = rack_table->daemon_connect->erpc_conn->call<CortPromise>(
-            rpc_daemon::tryDelPage, {.mac_id = master_context.m_master_id, .page_id = page_id});
+            // Remove the runs of deleted pages from the directory
+            for (auto& p : deleted) {
+                std::vector<page_id_t>& page_ids = p.second;
+                for (size_t i = 0, j; i < page_ids.size(); i = j) {
+                    for (j = i + 1; j < page_ids.size() && page_ids[j] == page_ids[j - 1] + units;
+                         ++j) {
+                    }
+                    page_directory.RemovePages(p.first, page_ids[i], j - i, req.page_class);
+                }
+            }
 
-        auto& reply = fu.get();
-        if (!reply.ret) {
-            page_lock.unlock();
-            boost::this_fiber::sleep_for(5us);
-            goto retry;
+            for (page_id_t page_id : latched) {
+                page_directory.UnlatchPage(page_id, true);
+            }
+
+            // In order, so the deleted pages of the next round form runs
+            std::sort(retry.begin(), retry.end());
+            pending = std::move(retry);
+            if (!pending.empty()) {
+                boost::this_fiber::sleep_for(5us);
+            }
         }
 
-        master_context.m_page_directory.RemovePage(rack_table, req.start_page_id);
-        master_context.m_page_directory.page_id_allocator->Recycle(req.start_page_id);
+        page_directory.page_id_allocator->MultiRecycle(batch_start_page_id, batch_count * units);
+    }
+
+    resp_handle.Init();
+    auto& reply = resp_handle.Get();
+    reply.ret = true;
+}
+
+void leasePageID(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                 LeasePageIDRequest& req, ResponseHandle<LeasePageIDReply>& resp_handle) {
+    RackMacTable* rack_table =
+        master_context.m_cluster_manager.cluster_rack_table[daemon_connection.rack_id];
+
+    // Leave most of the rack to the pages other racks place on it
+    size_t count =
+        std::min(req.count, rack_table->GetFreePageNum(rcmp::PAGE_4K) / lease_capacity_div);
+    page_id_t start_page_id = invalid_page_id;
+    if (count > 0) {
+        start_page_id = master_context.m_page_directory.page_id_allocator->MultiGen(count);
+        DLOG_ASSERT(start_page_id != invalid_page_id, "no unusable page");
+        master_context.m_page_directory.AddPages(rack_table, start_page_id, count,
+                                                 rcmp::PAGE_4K);
+        rack_table->leased_page_num.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    resp_handle.Init();
+    auto& reply = resp_handle.Get();
+    reply.start_page_id = start_page_id;
+    reply.count = count;
+}
+
+void returnPageID(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                  ReturnPageIDRequest& req, ResponseHandle<ReturnPageIDReply>& resp_handle) {
+    RackMacTable* rack_table =
+        master_context.m_cluster_manager.cluster_rack_table[daemon_connection.rack_id];
+
+    // The ids were never allocated, so no daemon holds a ref of them
+    master_context.m_page_directory.RemovePages(rack_table, req.start_page_id, req.count,
+                                                rcmp::PAGE_4K);
+    master_context.m_page_directory.page_id_allocator->MultiRecycle(req.start_page_id, req.count);
+
+    size_t leased = rack_table->leased_page_num.load(std::memory_order_relaxed);
+    while (!rack_table->leased_page_num.compare_exchange_weak(
+        leased, leased - std::min(leased, req.count), std::memory_order_relaxed)) {
     }
 
     resp_handle.Init();
@@ -212,38 +433,106 @@ void freePage(MasterContext& master_context, MasterToDaemonConnection& daemon_co
     reply.ret = true;
 }
 
+void reportRackLoad(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                    ReportRackLoadRequest& req, ResponseHandle<ReportRackLoadReply>& resp_handle) {
+    RackMacTable* rack_table =
+        master_context.m_cluster_manager.cluster_rack_table[daemon_connection.rack_id];
+    for (size_t c = 0; c < page_class_num; ++c) {
+        rack_table->free_run_num[c].store(req.free_run_num[c], std::memory_order_relaxed);
+    }
+    rack_table->leased_page_num.store(req.leased_page_num, std::memory_order_relaxed);
+
+    for (size_t i = 0; i < req.rack_num; ++i) {
+        RackLoad& load = req.racks[i];
+        auto it = master_context.m_cluster_manager.cluster_rack_table.find(load.rack_id);
+        if (it != master_context.m_cluster_manager.cluster_rack_table.end()) {
+            it->second->dio_bytes.fetch_add(load.dio_bytes, std::memory_order_relaxed);
+        }
+    }
+
+    resp_handle.Init();
+    auto& reply = resp_handle.Get();
+    reply.ret = true;
+    // Leases take capacity other racks could place on, ask for it back once they hold much of it
+    reply.return_lease = rack_table->leased_page_num.load(std::memory_order_relaxed) * 2 >
+                         rack_table->GetFreePageNum(rcmp::PAGE_4K);
+}
+
 void latchRemotePage(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
                      LatchRemotePageRequest& req,
                      ResponseHandle<LatchRemotePageReply>& resp_handle) {
     DLOG_ASSERT(req.page_id != invalid_page_id, "Invalid Page");
 
-    PageRackMetadata* page_meta = master_context.m_page_directory.FindPage(req.page_id);
+    master_context.m_page_directory.LatchPage(req.page_id, req.exclusive);
 
-    DLOG_ASSERT(page_meta != nullptr, "Can't find page %lu", req.page_id);
+    PageExtent extent;
+    bool found = master_context.m_page_directory.FindPage(req.page_id, &extent);
+    DLOG_ASSERT(found, "Can't find page %lu", req.page_id);
 
-    if (req.exclusive) {
-        page_meta->latch.lock();
-    } else {
-        page_meta->latch.lock_shared();
-    }
+    resp_handle.Init();
+    auto& reply = resp_handle.Get();
+    reply.dest_rack_id = extent.rack_id;
+    reply.dest_daemon_id = extent.daemon_id;
+}
+
+void resolvePageRDMARef(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
+                        ResolvePageRDMARefRequest& req,
+                        ResponseHandle<ResolvePageRDMARefReply>& resp_handle) {
+    DLOG_ASSERT(req.page_id != invalid_page_id, "Invalid Page");
+
+    // The shared latch keeps the page from migrating, which invalidates the cache.
+    master_context.m_page_directory.LatchPage(req.page_id, false);
+
+    PageExtent extent;
+    bool found = master_context.m_page_directory.FindPage(req.page_id, &extent);
+    DLOG_ASSERT(found, "Can't find page %lu", req.page_id);
 
     resp_handle.Init();
     auto& reply = resp_handle.Get();
-    reply.dest_rack_id = page_meta->rack_id;
-    reply.dest_daemon_id = page_meta->daemon_id;
+    reply.dest_rack_id = extent.rack_id;
+    reply.dest_daemon_id = extent.daemon_id;
+    {
+        PageRefCache* ref_cache = master_context.m_page_directory.GetRefCache(req.page_id, true);
+        std::lock_guard<SpinMutex> ref_lck(ref_cache->ref_lck);
+        reply.cached = ref_cache->ref_cached;
+        if (ref_cache->ref_cached) {
+            reply.addr = ref_cache->ref_addr;
+            reply.rkey = ref_cache->ref_rkey;
+            // A daemon resolves the page again after its ref is evicted
+            if (std::find(ref_cache->ref_daemons.begin(), ref_cache->ref_daemons.end(),
+                          req.mac_id) == ref_cache->ref_daemons.end()) {
+                ref_cache->ref_daemons.push_back(req.mac_id);
+            }
+        }
+    }
+
+    // On miss, keep the latch until `unLatchRemotePage`
+    if (reply.cached) {
+        master_context.m_page_directory.UnlatchPage(req.page_id, false);
+    }
 }
 
 void unLatchRemotePage(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
                        UnLatchRemotePageRequest& req,
                        ResponseHandle<UnLatchRemotePageReply>& resp_handle) {
-    PageRackMetadata* page_meta = master_context.m_page_directory.FindPage(req.page_id);
+    if (req.page_addr != 0) {
+        PageRefCache* ref_cache = master_context.m_page_directory.GetRefCache(req.page_id, true);
+        {
+            std::lock_guard<SpinMutex> ref_lck(ref_cache->ref_lck);
+            ref_cache->ref_cached = true;
+            ref_cache->ref_addr = req.page_addr;
+            ref_cache->ref_rkey = req.page_rkey;
+        }
 
-    if (req.exclusive) {
-        page_meta->latch.unlock();
-    } else {
-        page_meta->latch.unlock_shared();
+        PageExtent extent;
+        bool found = master_context.m_page_directory.FindPage(req.page_id, &extent);
+        DLOG_ASSERT(found, "Can't find page %lu", req.page_id);
+        master_context.m_page_directory.PublishRef(req.page_id, extent.daemon_id, req.page_addr,
+                                                   req.page_rkey);
     }
 
+    master_context.m_page_directory.UnlatchPage(req.page_id, req.exclusive);
+
     resp_handle.Init();
     auto& reply = resp_handle.Get();
     reply.ret = true;
@@ -255,35 +544,51 @@ void tryMigratePage(MasterContext& master_context, MasterToDaemonConnection& dae
     DLOG_ASSERT(req.page_id != req.page_id_swap, "Can't latch same page %lu", req.page_id);
 
     bool success = true;
-    PageRackMetadata* page_meta = master_context.m_page_directory.FindPage(req.page_id);
-
-    DLOG_ASSERT(page_meta != nullptr, "Can't find page %lu", req.page_id);
-
+    PageDirectory& page_directory = master_context.m_page_directory;
     if (req.page_id_swap == invalid_page_id) {
-        if (!page_meta->latch.try_lock()) {
+        if (!page_directory.TryLatchPage(req.page_id)) {
             success = false;
         }
     } else {
-        PageRackMetadata* page_swap_meta =
-            master_context.m_page_directory.FindPage(req.page_id_swap);
+        // Smaller ids are preferred for locking to avoid deadlocks.
+        page_id_t first = std::min(req.page_id, req.page_id_swap);
+        page_id_t second = std::max(req.page_id, req.page_id_swap);
+        if (!page_directory.TryLatchPage(first)) {
+            success = false;
+        } else if (!page_directory.TryLatchPage(second)) {
+            page_directory.UnlatchPage(first, true);
+            success = false;
+        }
+    }
 
-        DLOG_ASSERT(page_swap_meta != nullptr, "Can't find page %lu", req.page_id_swap);
+    PageExtent extent;
+    if (success) {
+        bool found = page_directory.FindPage(req.page_id, &extent);
+        DLOG_ASSERT(found, "Can't find page %lu", req.page_id);
+        if (req.page_id_swap != invalid_page_id) {
+            PageExtent swap_extent;
+            found = page_directory.FindPage(req.page_id_swap, &swap_extent);
+            DLOG_ASSERT(found, "Can't find page %lu", req.page_id_swap);
+        }
 
-        // Smaller ids are preferred for locking to avoid deadlocks.
-        if (req.page_id < req.page_id_swap) {
-            if (!page_meta->latch.try_lock()) {
-                success = false;
-            } else if (!page_swap_meta->latch.try_lock()) {
-                page_meta->latch.unlock();
-                success = false;
+        if (extent.daemon_id != req.page_daemon_id) {
+            // The ref of requester is stale
+            page_directory.UnlatchPage(req.page_id, true);
+            if (req.page_id_swap != invalid_page_id) {
+                page_directory.UnlatchPage(req.page_id_swap, true);
             }
+            success = false;
+        }
+    }
+
+    if (success) {
+        // The requester has deleted its ref of `page_id` before migration
+        if (req.page_id_swap == invalid_page_id) {
+            invalidate_page_ref_cache(master_context, {{req.page_id, req.mac_id}}, req.mac_id);
         } else {
-            if (!page_swap_meta->latch.try_lock()) {
-                success = false;
-            } else if (!page_meta->latch.try_lock()) {
-                page_swap_meta->latch.unlock();
-                success = false;
-            }
+            invalidate_page_ref_cache(
+                master_context,
+                {{req.page_id, req.mac_id}, {req.page_id_swap, extent.daemon_id}}, req.mac_id);
         }
     }
 
@@ -295,32 +600,50 @@ void tryMigratePage(MasterContext& master_context, MasterToDaemonConnection& dae
 void MigratePageDone(MasterContext& master_context, MasterToDaemonConnection& daemon_connection,
                      MigratePageDoneRequest& req,
                      ResponseHandle<MigratePageDoneReply>& resp_handle) {
-    PageRackMetadata* page_meta = master_context.m_page_directory.FindPage(req.page_id);
-
-    page_meta->rack_id = req.new_rack_id;
-    page_meta->daemon_id = req.new_daemon_id;
-
-    page_meta->latch.unlock();
-    // DLOG("Swap page %lu to rack: %u, DN:%u. This operation is initiated by DN %u", req.page_id,
-    //      req.new_rack_id, req.new_daemon_id, daemon_connection.daemon_id);
+    PageDirectory& page_directory = master_context.m_page_directory;
+
+    page_directory.MovePage(req.page_id, req.new_rack_id, req.new_daemon_id);
+    if (req.new_page_addr != 0) {
+        // Warm the cache with the ref on the new daemon
+        PageRefCache* ref_cache = page_directory.GetRefCache(req.page_id, true);
+        {
+            std::lock_guard<SpinMutex> ref_lck(ref_cache->ref_lck);
+            ref_cache->ref_cached = true;
+            ref_cache->ref_addr = req.new_page_addr;
+            ref_cache->ref_rkey = req.new_page_rkey;
+        }
+        page_directory.PublishRef(req.page_id, req.new_daemon_id, req.new_page_addr,
+                                  req.new_page_rkey);
+    }
 
     if (req.page_id_swap != invalid_page_id) {
-        page_meta = master_context.m_page_directory.FindPage(req.page_id_swap);
+        page_directory.MovePage(req.page_id_swap, req.new_rack_id_swap, req.new_daemon_id_swap);
 
-        page_meta->rack_id = req.new_rack_id_swap;
-        page_meta->daemon_id = req.new_daemon_id_swap;
-
-        page_meta->latch.unlock();
+        page_directory.UnlatchPage(req.page_id_swap, true);
         // DLOG("Swap page %lu to rack: %u, DN:%u. This operation is initiated by DN %u",
         //      req.page_id_swap, req.new_rack_id_swap, req.new_daemon_id_swap,
         //      daemon_connection.daemon_id);
     } else {
-        ++master_context.m_cluster_manager.cluster_rack_table[req.new_rack_id]
-              ->current_allocated_page_num;
-        --master_context.m_cluster_manager.cluster_rack_table[req.new_rack_id_swap]
-              ->current_allocated_page_num;
+        PageExtent extent;
+        page_directory.FindPage(req.page_id, &extent);
+        size_t units = GetPageUnits(extent.page_class);
+        master_context.m_cluster_manager.cluster_rack_table[req.new_rack_id]
+            ->current_allocated_page_num += units;
+        master_context.m_cluster_manager.cluster_rack_table[req.new_rack_id_swap]
+            ->current_allocated_page_num -= units;
     }
 
+    // Each rack sends one page and receives one on a swap
+    size_t swap_cnt = (req.page_id_swap != invalid_page_id) ? 2 : 1;
+    master_context.m_cluster_manager.cluster_rack_table[req.new_rack_id]->swap_cnt.fetch_add(
+        swap_cnt, std::memory_order_relaxed);
+    master_context.m_cluster_manager.cluster_rack_table[req.new_rack_id_swap]->swap_cnt.fetch_add(
+        swap_cnt, std::memory_order_relaxed);
+
+    page_directory.UnlatchPage(req.page_id, true);
+    // DLOG("Swap page %lu to rack: %u, DN:%u. This operation is initiated by DN %u", req.page_id,
+    //      req.new_rack_id, req.new_daemon_id, daemon_connection.daemon_id);
+
     resp_handle.Init();
     auto& reply = resp_handle.Get();
     reply.ret = true;
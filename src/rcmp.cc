@@ -9,6 +9,73 @@
 
 using namespace std::chrono_literals;
 
+/**
+ * @brief Direct io of a page through a slot of the stream bounce region of the client. The data
+ * is copied in or out chunk by chunk while the daemon streams the other chunks, and no message
+ * holds the payload.
+ *
+ * @return rpc_daemon::GetPageCXLRefOrProxyReply The reply, which is a ref when the page is local
+ */
+static rpc_daemon::GetPageCXLRefOrProxyReply streamPageIO(ClientContext &client_context,
+                                                          bool is_read, rcmp::GAddr gaddr,
+                                                          size_t size, void *buf,
+                                                          PageCacheMeta *page_cache_meta) {
+    IDGenerator::id_t slot_idx;
+    while ((slot_idx = client_context.m_stream_slots.Gen()) == -1) {
+        std::this_thread::yield();
+    }
+    offset_t bounce_offset =
+        client_context.m_stream_bounce_offset + slot_idx * sizeof(rpc_daemon::StreamBounceSlot);
+    auto *slot = reinterpret_cast<rpc_daemon::StreamBounceSlot *>(
+        reinterpret_cast<uintptr_t>(client_context.m_cxl_format.start_addr) + bounce_offset);
+    slot->ready_size.store(0, std::memory_order_relaxed);
+
+    auto fu = client_context.m_local_rack_daemon_connection.msgq_conn->call<SpinPromise>(
+        rpc_daemon::getPageCXLRefOrProxy,
+        {
+            .mac_id = client_context.m_client_id,
+            .type = is_read ? rpc_daemon::GetPageCXLRefOrProxyRequest::STREAM_READ
+                            : rpc_daemon::GetPageCXLRefOrProxyRequest::STREAM_WRITE,
+            .gaddr = gaddr,
+            .hint_version = page_cache_meta->hint.version,
+            .hint = page_cache_meta->hint.hint,
+            .u =
+                {
+                    .stream =
+                        {
+                            .size = size,
+                            .bounce_offset = bounce_offset,
+                        },
+                },
+        });
+
+    uint8_t *data = reinterpret_cast<uint8_t *>(buf);
+    size_t copied = 0;
+    if (is_read) {
+        // Copy out the chunks published by the daemon
+        do {
+            size_t ready = slot->ready_size.load(std::memory_order_acquire);
+            memcpy(data + copied, slot->data + copied, ready - copied);
+            copied = ready;
+        } while (fu.wait_for(0s) != std::future_status::ready);
+    } else {
+        // The daemon replies early only if it doesn't stream, e.g. with a ref to a local page
+        while (copied < size && fu.wait_for(0s) != std::future_status::ready) {
+            size_t end = std::min(copied + stream_chunk_size, size);
+            memcpy(slot->data + copied, data + copied, end - copied);
+            slot->ready_size.store(end, std::memory_order_release);
+            copied = end;
+        }
+    }
+
+    rpc_daemon::GetPageCXLRefOrProxyReply reply = fu.get();
+    if (is_read && !reply.refs) {
+        memcpy(data + copied, slot->data + copied, size - copied);
+    }
+    client_context.m_stream_slots.Recycle(slot_idx);
+    return reply;
+}
+
 namespace rcmp {
 
 PoolContext::PoolContext(ClientOptions options) {
@@ -25,6 +92,7 @@ PoolContext::PoolContext(ClientOptions options) {
 
 PoolContext::~PoolContext() {
     m_impl->m_msgq_stop = true;
+    m_impl->m_msgq_idler->wake();
     m_impl->m_msgq_worker.join();
     cxl_close_simulate(m_impl->m_cxl_devdax_fd, m_impl->m_cxl_format);
 }
@@ -63,28 +131,40 @@ Status PoolContext::Read(GAddr gaddr, size_t size, void *buf) {
     if (page_cache == nullptr) {
         m_impl->m_stats.local_page_miss_sample();
 
-        auto fu = m_impl->m_local_rack_daemon_connection.msgq_conn->call<SpinPromise>(
-            rpc_daemon::getPageCXLRefOrProxy,
-            {
-                .mac_id = m_impl->m_client_id,
-                .type = rpc_daemon::GetPageCXLRefOrProxyRequest::READ,
-                .gaddr = gaddr,
-                .hint_version = page_cache_meta->hint.version,
-                .hint = page_cache_meta->hint.hint,
-                .u =
-                    {
-                        .read =
-                            {
-                                .cn_read_size = size,
-                            },
-                    },
-            });
+        MsgQFuture<rpc_daemon::GetPageCXLRefOrProxyReply, SpinPromise<msgq::MsgBuffer>> fu;
+        rpc_daemon::GetPageCXLRefOrProxyReply stream_resp;
+        rpc_daemon::GetPageCXLRefOrProxyReply *resp_ptr;
 
-        auto &resp = fu.get();
+        if (size < stream_io_min_size) {
+            fu = m_impl->m_local_rack_daemon_connection.msgq_conn->call<SpinPromise>(
+                rpc_daemon::getPageCXLRefOrProxy,
+                {
+                    .mac_id = m_impl->m_client_id,
+                    .type = rpc_daemon::GetPageCXLRefOrProxyRequest::READ,
+                    .gaddr = gaddr,
+                    .hint_version = page_cache_meta->hint.version,
+                    .hint = page_cache_meta->hint.hint,
+                    .u =
+                        {
+                            .read =
+                                {
+                                    .cn_read_size = size,
+                                },
+                        },
+                });
+            resp_ptr = &fu.get();
+            if (!resp_ptr->refs) {
+                memcpy(buf, resp_ptr->read_data, size);
+            }
+        } else {
+            stream_resp = streamPageIO(*m_impl, true, gaddr, size, buf, page_cache_meta);
+            resp_ptr = &stream_resp;
+        }
+
+        auto &resp = *resp_ptr;
 
         if (!resp.refs) {
             m_impl->m_stats.page_cache_fault_sample(perf_stat_timer);
-            memcpy(buf, resp.read_data, size);
             page_cache_meta->hint.hint = resp.hint;
             page_cache_meta->hint.version = resp.hint_version;
             m_impl->m_stats.read_sample(perf_stat_timer_);
@@ -142,8 +222,10 @@ Status PoolContext::Write(GAddr gaddr, size_t size, const void *buf) {
         // DLOG("Write can't find page %ld m_page_table_cache.", page_id);
 
         MsgQFuture<rpc_daemon::GetPageCXLRefOrProxyReply, SpinPromise<msgq::MsgBuffer>> fu;
+        rpc_daemon::GetPageCXLRefOrProxyReply stream_resp;
+        rpc_daemon::GetPageCXLRefOrProxyReply *resp_ptr;
 
-        if (size <= get_page_cxl_ref_or_proxy_write_raw_max_size) {
+        if (size < stream_io_min_size) {
             fu = m_impl->m_local_rack_daemon_connection.msgq_conn->call<SpinPromise>(
                 rpc_daemon::getPageCXLRefOrProxy,
                 sizeof(rpc_daemon::GetPageCXLRefOrProxyRequest) + size,
@@ -156,27 +238,14 @@ Status PoolContext::Write(GAddr gaddr, size_t size, const void *buf) {
                     req_buf->u.write_raw.cn_write_raw_size = size;
                     memcpy(req_buf->u.write_raw.cn_write_raw_buf, buf, size);
                 });
+            resp_ptr = &fu.get();
         } else {
-            fu = m_impl->m_local_rack_daemon_connection.msgq_conn->call<SpinPromise>(
-                rpc_daemon::getPageCXLRefOrProxy,
-                {
-                    .mac_id = m_impl->m_client_id,
-                    .type = rpc_daemon::GetPageCXLRefOrProxyRequest::WRITE,
-                    .gaddr = gaddr,
-                    .hint_version = page_cache_meta->hint.version,
-                    .hint = page_cache_meta->hint.hint,
-                    .u =
-                        {
-                            .write =
-                                {
-                                    .cn_write_size = size,
-                                    .cn_write_buf = buf,
-                                },
-                        },
-                });
+            stream_resp = streamPageIO(*m_impl, false, gaddr, size, const_cast<void *>(buf),
+                                       page_cache_meta);
+            resp_ptr = &stream_resp;
         }
 
-        auto &resp = fu.get();
+        auto &resp = *resp_ptr;
 
         if (!resp.refs) {
             m_impl->m_stats.page_cache_fault_sample(perf_stat_timer);
@@ -287,16 +356,17 @@ GAddr PoolContext::Alloc(size_t size) { DLOG_FATAL("Not Support"); }
 
 Status PoolContext::Free(GAddr gaddr, size_t size) { DLOG_FATAL("Not Support"); }
 
-GAddr PoolContext::AllocPage(size_t count) {
+GAddr PoolContext::AllocPage(size_t count, PageSizeClass page_class) {
     auto fu = m_impl->m_local_rack_daemon_connection.msgq_conn->call<SpinPromise>(
         rpc_daemon::allocPage, {
                                    .mac_id = m_impl->m_client_id,
                                    .count = count,
+                                   .page_class = page_class,
                                });
 
     auto &resp = fu.get();
 
-    GAddr gaddr = GetGAddr(resp.start_page_id, 0);
+    GAddr gaddr = GetGAddr(resp.start_page_id, 0, page_class);
 
     return gaddr;
 }
@@ -310,6 +380,7 @@ Status PoolContext::FreePage(GAddr gaddr, size_t count) {
                                   .mac_id = m_impl->m_client_id,
                                   .start_page_id = page_id,
                                   .count = count,
+                                  .page_class = GetPageClass(gaddr),
                               });
 
     auto &resp = fu.get();
@@ -423,11 +494,11 @@ void ClientContext::ConnectWithDaemon() {
     msgq::MsgUDPConnPacket msg;
     m_udp_conn_recver->recv_blocking(msg);
 
+    uintptr_t msgq_zone_start_addr = reinterpret_cast<uintptr_t>(m_cxl_format.msgq_zone_start_addr);
     m_msgq_rpc = std::make_unique<msgq::MsgQueueRPC>(
-        m_msgq_nexus.get(), m_msgq_nexus->GetPublicMsgQ(),
-        reinterpret_cast<msgq::MsgQueue *>(
-            (reinterpret_cast<uintptr_t>(m_cxl_format.msgq_zone_start_addr) + msg.recv_q_off)),
-        this);
+        m_msgq_nexus.get(),
+        reinterpret_cast<msgq::MsgQueue *>(msgq_zone_start_addr + msg.send_q_off),
+        reinterpret_cast<msgq::MsgQueue *>(msgq_zone_start_addr + msg.recv_q_off), this);
 
     InitMsgQPooller();
 
@@ -436,6 +507,9 @@ void ClientContext::ConnectWithDaemon() {
 
     m_client_id = resp.client_mac_id;
     m_local_rack_daemon_connection.daemon_id = resp.daemon_mac_id;
+    m_msgq_rpc->set_credit_window(resp.msgq_credit_window);
+    m_stream_bounce_offset = resp.stream_bounce_offset;
+    m_stream_slots.Expand(stream_bounce_slot_num);
     m_local_rack_daemon_connection.msgq_conn = std::make_unique<MsgQClient>(*m_msgq_rpc);
     m_half_life_us = resp.half_life_us;
 
@@ -446,12 +520,17 @@ void ClientContext::ConnectWithDaemon() {
 void ClientContext::InitMsgQPooller() {
     // Launch of poll workers
     m_msgq_stop = false;
+    m_msgq_idler = std::make_unique<msgq::MsgQueueIdler>(
+        m_msgq_rpc->m_recv_queue, m_options.idle_spin_us, m_options.idle_sleep_us);
+    m_fiber_pool_.SetWakeFn([this]() { m_msgq_idler->wake(); });
     m_msgq_worker = std::thread([this]() {
         boost::fibers::use_scheduling_algorithm<priority_scheduler>();
         InitFiberPool();
 
+        auto pool_busy = [this]() { return !m_fiber_pool_.IsIdle(); };
         while (!m_msgq_stop) {
-            m_msgq_rpc->run_event_loop_once();
+            uint32_t msg_num = m_msgq_rpc->run_event_loop_once();
+            m_msgq_idler->poll_done(msg_num > 0 || pool_busy(), pool_busy);
             boost::this_fiber::yield();
         }
 
@@ -482,11 +561,18 @@ void PoolContext::__DumpStats() {
         1.0 * stats.local_cache_update_time / (total_local_cnt + 1),
         1.0 * msgq_stats.send_time / (msgq_stats.send_io + 1),
         1.0 * msgq_stats.recv_time / (msgq_stats.recv_io + 1));
+
+    auto &idle_stats = m_impl->m_msgq_idler->m_stats;
+    DLOG("msgq poller sleeps: %lu, doorbell wakeups: %lu, slept: %fns, wakeup lat: %fns",
+         idle_stats.sleeps.load(), idle_stats.doorbell_wakeups.load(),
+         1.0 * idle_stats.sleep_time.load(),
+         1.0 * idle_stats.wakeup_time.load() / (idle_stats.doorbell_wakeups.load() + 1));
 }
 
 void PoolContext::__ClearStats() {
     m_impl->m_stats = {};
-    m_impl->m_msgq_nexus->m_stats = {};
+    m_impl->m_msgq_nexus->m_stats.clear();
+    m_impl->m_msgq_idler->m_stats.clear();
 }
 
 Status PoolContext::__TestDataSend1(int *array, size_t size) {
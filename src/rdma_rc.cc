@@ -18,6 +18,7 @@ int RDMAConnection::RNR_RETRY_COUNT = 7;
 uint8_t RDMAConnection::INITIATOR_DEPTH = 2;
 int RDMAConnection::RESPONDER_RESOURCES = 2;
 int RDMAConnection::POLL_ENTRY_COUNT = 16;
+uint32_t RDMAConnection::MAX_INLINE_DATA = 256;
 bool RDMAConnection::RDMA_TIMEOUT_ENABLE = false;
 uint32_t RDMAConnection::RDMA_TIMEOUT_MS = 2000;
 
@@ -31,6 +32,7 @@ bool RDMAConnection::m_rdma_conn_param_valid_() {
         return false;
     }
     m_atomic_support_ = device_attr.atomic_cap != IBV_ATOMIC_NONE;
+    m_atomic_glob_ = device_attr.atomic_cap == IBV_ATOMIC_GLOB;
     m_inline_support_ = m_cm_ids_.back()->verbs->device->transport_type != IBV_TRANSPORT_UNKNOWN;
     return device_attr.max_cqe >= CQE_NUM && device_attr.max_qp_wr >= MAX_SEND_WR &&
            device_attr.max_sge >= MAX_SEND_SGE &&
@@ -161,7 +163,11 @@ int RDMAConnection::m_init_last_ibv_subconnection_() {
         return -1;
     }
 
-    m_cq_ = create_cq(cm_id->verbs, m_comp_chan_);
+    m_cq_ = m_engine_ ? m_engine_->GetCQ(cm_id->verbs, m_comp_chan_)
+                      : create_cq(cm_id->verbs, m_comp_chan_);
+    if (!m_cq_) {
+        return -1;
+    }
 
     ibv_qp_init_attr qp_attr = {};
     qp_attr.qp_type = IBV_QPT_RC;
@@ -169,15 +175,28 @@ int RDMAConnection::m_init_last_ibv_subconnection_() {
     qp_attr.cap.max_send_sge = MAX_SEND_SGE;
     qp_attr.cap.max_recv_wr = MAX_SEND_WR;
     qp_attr.cap.max_recv_sge = MAX_SEND_SGE;
-    qp_attr.cap.max_inline_data = 64;  // TODO
     qp_attr.send_cq = m_cq_;
     qp_attr.recv_cq = m_cq_;
 
-    if (rdma_create_qp(cm_id, m_pd_, &qp_attr)) {
-        DLOG_ERROR("rdma_create_qp fail");
-        return -1;
+    // Devices cap the inline size differently, fall back to smaller ones until the QP is created
+    uint32_t max_inline = m_inline_support_ ? MAX_INLINE_DATA : 0;
+    while (true) {
+        qp_attr.cap.max_inline_data = max_inline;
+        if (rdma_create_qp(cm_id, m_pd_, &qp_attr) == 0) {
+            break;
+        }
+        if (max_inline == 0) {
+            DLOG_ERROR("rdma_create_qp fail");
+            return -1;
+        }
+        max_inline /= 2;
     }
 
+    // The device may grant more than asked
+    max_inline = std::min(qp_attr.cap.max_inline_data, MAX_INLINE_DATA);
+    m_max_inline_data_ =
+        (m_cm_ids_.size() == 1) ? max_inline : std::min(m_max_inline_data_, max_inline);
+
     return 0;
 }
 
@@ -220,6 +239,15 @@ int RDMAConnection::listen(const std::string &ip) {
         return -1;
     }
 
+    // Memory registered on the listener is accessed by all its connections
+    ibv_device_attr device_attr;
+    if (ibv_query_device(cm_id->verbs, &device_attr) != 0) {
+        DLOG_ERROR("ibv_query_device fail");
+        return -1;
+    }
+    m_atomic_support_ = device_attr.atomic_cap != IBV_ATOMIC_NONE;
+    m_atomic_glob_ = device_attr.atomic_cap == IBV_ATOMIC_GLOB;
+
     m_conn_handler_ = new std::thread(&RDMAConnection::m_handle_connection_, this);
     if (!m_conn_handler_) {
         DLOG_ERROR("rdma connect fail");
@@ -463,7 +491,7 @@ int RDMAConnection::prep_write(SgeWr *sge_wr, uint64_t local_addr, uint32_t lkey
                ibv_send_wr{.num_sge = 1,
                            .opcode = IBV_WR_RDMA_WRITE,
                            .wr = {.rdma = {.remote_addr = remote_addr, .rkey = rkey}}}};
-    if (inline_data) sge_wr->wr.send_flags = IBV_SEND_INLINE;
+    if (inline_data || length <= m_max_inline_data_) sge_wr->wr.send_flags = IBV_SEND_INLINE;
     return 0;
 }
 
@@ -554,70 +582,25 @@ RDMAFuture RDMAConnection::m_submit_impl(SgeWr *sge_wrs, size_t n) {
         sge_wrs[i].wr.sg_list = &sge_wrs[i].sge;
         sge_wrs[i].wr.next = &sge_wrs[i + 1].wr;
     }
+    sge_wrs[n - 1].wr.next = nullptr;
 
-    // std::unique_lock<Mutex> lck(m_mu_);
-
-    auto &m_current_sd_ = fu.m_sd_;
-    if (m_current_sd_ == nullptr) {
-        m_current_sd_ = std::make_unique<SyncData>();
-        m_current_sd_->conn = this;
-        m_current_sd_->timeout = false;
-        m_current_sd_->inflight = n;
-        m_current_sd_->wc_finish = false;
-        m_current_sd_->props_size = 1;
-        m_current_sd_->props[0] = &boost::this_fiber::properties<priority_props>();
-
-        m_sw_head_ = sge_wrs;
-        m_sw_tail_ = sge_wrs + n - 1;
-    } else {
-        DLOG_FATAL("Not Support for multi thread submit");
-
-        // DLOG_ASSERT(m_current_sd_->props_size <= m_current_sd_->props.size());
-
-        // fu.m_sd_ = m_current_sd_;
-        // fu.m_sd_->inflight += n;
-        // fu.m_sd_->props[fu.m_sd_->props_size](boost::this_fiber::properties<priority_props>());
-        // fu.m_sd_->props_size++;
-
-        // DLOG_ASSERT(m_sw_tail_ != nullptr);
-        // m_sw_tail_->wr.next = &sge_wrs->wr;
-        // m_sw_tail_ = sge_wrs + n - 1;
-
-        // boost::this_fiber::properties<priority_props>().set_low_priority();
-
-        // return fu;
-    }
-
-    // fu.m_sd_.swap(m_current_sd_);
-
-    SgeWr *sge_wr_list = nullptr;
-    SgeWr *sge_wr_list_tail = nullptr;
-
-    std::swap(sge_wr_list, m_sw_head_);
-    std::swap(sge_wr_list_tail, m_sw_tail_);
-
-    // Select a qp transfer that needs to be thread-safe
-    auto cm_id = m_cm_ids_.front();
-    m_cm_ids_.pop_front();
-    m_cm_ids_.push_back(cm_id);
-
-    // lck.unlock();
-
-    // It's now thread-safe to handle send wr
+    fu.m_sd_ = std::make_unique<SyncData>();
+    SyncData *sd = fu.m_sd_.get();
+    sd->conn = this;
+    sd->timeout = false;
+    sd->inflight = n;
+    sd->wc_finish = false;
+    sd->props_size = 1;
+    sd->props[0] = &boost::this_fiber::properties<priority_props>();
+    sd->wr_head = &sge_wrs[0].wr;
+    sd->wr_tail = &sge_wrs[n - 1].wr;
 
     boost::this_fiber::properties<priority_props>().set_low_priority();
 
-    uint64_t wr_id = reinterpret_cast<uint64_t>(fu.m_sd_.get());
-
-    ibv_send_wr *wr_head = &sge_wr_list->wr;
-    sge_wr_list_tail->wr.wr_id = wr_id;
-    sge_wr_list_tail->wr.next = nullptr;
-    sge_wr_list_tail->wr.send_flags |= IBV_SEND_SIGNALED;
-
     // Detecting the number of wr's currently being sent
     uint32_t inflight = m_inflight_count_.load(std::memory_order_acquire);
     do {
-        if (UNLIKELY((int)(inflight + fu.m_sd_->inflight) > MAX_SEND_WR)) {
+        if (UNLIKELY((int)(inflight + n) > MAX_SEND_WR)) {
             errno = ENOSPC;
             DLOG_ERROR("ibv_post_send too much inflight wr");
             boost::this_fiber::yield();
@@ -626,50 +609,135 @@ RDMAFuture RDMAConnection::m_submit_impl(SgeWr *sge_wrs, size_t n) {
             continue;
         }
         // printf("inflight+: %u\n", inflight);
-    } while (!m_inflight_count_.compare_exchange_weak(inflight, inflight + fu.m_sd_->inflight,
+    } while (!m_inflight_count_.compare_exchange_weak(inflight, inflight + n,
                                                       std::memory_order_acquire));
 
-    if (RDMAConnection::RDMA_TIMEOUT_ENABLE) fu.m_sd_->now_ms = getMsTimestamp();
+    if (RDMAConnection::RDMA_TIMEOUT_ENABLE) sd->now_ms = getMsTimestamp();
+    if (m_engine_) {
+        sd->submit_ns = getNsTimestamp();
+        m_engine_->m_inflight_.fetch_add(1, std::memory_order_relaxed);
 
-    struct ibv_send_wr *bad_send_wr;
-    int ret = ibv_post_send(cm_id->qp, wr_head, &bad_send_wr);
-    if (UNLIKELY(ret != 0)) {
-        DLOG_ERROR("ibv_post_send fail");
-        goto need_retry;
+        CompletionStats &stats = m_engine_->m_stats_;
+        size_t inline_wrs = 0;
+        for (size_t i = 0; i < n; ++i) {
+            inline_wrs += (sge_wrs[i].wr.send_flags & IBV_SEND_INLINE) != 0;
+        }
+        stats.wrs.fetch_add(n, std::memory_order_relaxed);
+        stats.inline_wrs.fetch_add(inline_wrs, std::memory_order_relaxed);
     }
 
-    return fu;
+    sd->next = m_submit_head_.load(std::memory_order_relaxed);
+    while (!m_submit_head_.compare_exchange_weak(sd->next, sd, std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+    }
 
-need_retry:
+    if (m_engine_ && !m_post_queued_.exchange(true, std::memory_order_acq_rel)) {
+        m_engine_->queuePost(this);
+    }
 
-    fu.m_sd_ = nullptr;
     return fu;
 }
 
-int RDMAConnection::m_acknowledge_sd_cqe_(int rc, ibv_wc wcs[]) {
+void RDMAConnection::m_post_submitted_() {
+    if (m_submit_head_.load(std::memory_order_relaxed) == nullptr ||
+        m_posting_.exchange(true, std::memory_order_acquire)) {
+        return;
+    }
+
+    SyncData *sd = m_submit_head_.exchange(nullptr, std::memory_order_acquire);
+
+    // Restore the order of submission, and chain the wrs of the batch
+    SyncData *batch = nullptr;
+    while (sd != nullptr) {
+        SyncData *next = sd->next;
+        sd->next = batch;
+        if (batch != nullptr) {
+            sd->wr_tail->next = batch->wr_head;
+        }
+        batch = sd;
+        sd = next;
+    }
+
+    if (batch != nullptr) {
+        SyncData *last = batch;
+        while (last->next != nullptr) {
+            last = last->next;
+        }
+        // The QP completes wrs in order, so the completion of the last one covers the batch
+        last->wr_tail->wr_id = reinterpret_cast<uint64_t>(batch);
+        last->wr_tail->send_flags |= IBV_SEND_SIGNALED;
+
+        // Select a qp transfer that needs to be thread-safe
+        auto cm_id = m_cm_ids_.front();
+        m_cm_ids_.pop_front();
+        m_cm_ids_.push_back(cm_id);
+
+        struct ibv_send_wr *bad_send_wr;
+        int ret = ibv_post_send(cm_id->qp, batch->wr_head, &bad_send_wr);
+        if (UNLIKELY(ret != 0)) {
+            DLOG_ERROR("ibv_post_send fail");
+            for (sd = batch; sd != nullptr;) {
+                SyncData *next = sd->next;
+                m_inflight_count_.fetch_sub(sd->inflight, std::memory_order_release);
+                if (m_engine_) {
+                    m_engine_->m_inflight_.fetch_sub(1, std::memory_order_relaxed);
+                }
+                sd->timeout = true;
+                sd->cbk->set_value();
+                sd = next;
+            }
+        }
+    }
+
+    m_posting_.store(false, std::memory_order_release);
+}
+
+int RDMAConnection::m_acknowledge_sd_cqe_(int rc, ibv_wc wcs[], CompletionStats *stats) {
+    uint64_t now_ns = (stats && rc > 0) ? getNsTimestamp() : 0;
+    int ret = 0;
     for (int i = 0; i < rc; ++i) {
         auto &wc = wcs[i];
 
+        bool failed = UNLIKELY(IBV_WC_SUCCESS != wc.status);
+        if (failed) {
+            fprintf(stderr, "cmd_send status error: %s\n", ibv_wc_status_str(wc.status));
+            ret = -1;
+        }
+
+        // Only the last wr of a batch carries it. A failed wr before it completes on its own,
+        // and the QP flushes the rest of the batch, whose completion still covers the batch.
         SyncData *sd = reinterpret_cast<SyncData *>(wc.wr_id);
-        sd->conn->m_inflight_count_.fetch_sub(sd->inflight, std::memory_order_release);
 
-        // printf("inflight-: %u\n", sd->conn->m_inflight_count_.load());
+        // Fan the completion out to the submissions of the batch
+        while (sd != nullptr) {
+            // The submitter may free `sd` once it's finished
+            SyncData *next = sd->next;
+            sd->conn->m_inflight_count_.fetch_sub(sd->inflight, std::memory_order_release);
+
+            // printf("inflight-: %u\n", sd->conn->m_inflight_count_.load());
+
+            if (stats) {
+                sd->conn->m_engine_->m_inflight_.fetch_sub(1, std::memory_order_relaxed);
+                stats->completions.fetch_add(1, std::memory_order_relaxed);
+                stats->latency_ns.fetch_add(now_ns - sd->submit_ns, std::memory_order_relaxed);
+            }
 
-        if (LIKELY(IBV_WC_SUCCESS == wc.status)) {
-            // Break out as operation completed successfully
             if (LIKELY(!sd->timeout)) {
-                sd->wc_finish = true;
-                sd->cbk->set_value();
+                if (failed) {
+                    // The futures of the batch fail like a timeout
+                    sd->timeout = true;
+                } else {
+                    sd->wc_finish = true;
+                }
                 for (size_t i = 0; i < sd->props_size; ++i) {
                     sd->props[i]->set_high_priority();
                 }
+                sd->cbk->set_value();
             }
-        } else {
-            fprintf(stderr, "cmd_send status error: %s\n", ibv_wc_status_str(wc.status));
-            return -1;
+            sd = next;
         }
     }
-    return 0;
+    return ret;
 }
 
 int RDMAFuture::try_get() {
@@ -707,7 +775,7 @@ int RDMAFuture::get() {
 
     boost::this_fiber::properties<priority_props>().set_low_priority();
 
-    return 0;
+    return m_sd_->timeout ? -1 : 0;
 
     // while (1) {
     //     int ret = try_get();
@@ -721,6 +789,12 @@ int RDMAFuture::get() {
 }
 
 int RDMAConnection::m_poll_conn_sd_wr_() {
+    if (m_engine_) {
+        return m_engine_->Poll() < 0 ? -1 : 0;
+    }
+
+    m_post_submitted_();
+
     struct ibv_wc wcs[RDMAConnection::POLL_ENTRY_COUNT];
 
     int rc = ibv_poll_cq(m_cq_, RDMAConnection::POLL_ENTRY_COUNT, wcs);
@@ -738,4 +812,95 @@ int RDMAConnection::m_poll_conn_sd_wr_() {
     return 0;
 }
 
+CompletionEngine::~CompletionEngine() {
+    for (size_t i = 0; i < m_cq_num_.load(std::memory_order_acquire); ++i) {
+        ibv_destroy_cq(m_cqs_[i]);
+    }
+}
+
+ibv_cq *CompletionEngine::GetCQ(ibv_context *verbs, ibv_comp_channel *comp_chan) {
+    std::lock_guard<SpinMutex> lck(m_cq_lck_);
+
+    size_t cq_num = m_cq_num_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < cq_num; ++i) {
+        if (m_cq_verbs_[i] == verbs) {
+            return m_cqs_[i];
+        }
+    }
+
+    DLOG_ASSERT(cq_num < max_cq_num, "Too many devices of completion engine");
+
+    ibv_cq *cq = ibv_create_cq(verbs, cq_depth, nullptr, comp_chan, 0);
+    if (!cq) {
+        DLOG_ERROR("ibv_create_cq fail");
+        return nullptr;
+    }
+
+    m_cq_verbs_[cq_num] = verbs;
+    m_cqs_[cq_num] = cq;
+    m_cq_num_.store(cq_num + 1, std::memory_order_release);
+    return cq;
+}
+
+void CompletionEngine::queuePost(RDMAConnection *conn) {
+    conn->m_post_next_ = m_post_head_.load(std::memory_order_relaxed);
+    while (!m_post_head_.compare_exchange_weak(conn->m_post_next_, conn, std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+    }
+}
+
+int CompletionEngine::Poll() {
+    // Post the submissions of the queued connections. A connection is unqueued before posting, so
+    // a later submission queues it again.
+    RDMAConnection *conn = m_post_head_.exchange(nullptr, std::memory_order_acquire);
+    while (conn != nullptr) {
+        RDMAConnection *next = conn->m_post_next_;
+        conn->m_post_queued_.store(false, std::memory_order_release);
+        conn->m_post_submitted_();
+        // Another thread posting the connection may miss the submissions left
+        if (conn->m_submit_head_.load(std::memory_order_acquire) != nullptr &&
+            !conn->m_post_queued_.exchange(true, std::memory_order_acq_rel)) {
+            queuePost(conn);
+        }
+        conn = next;
+    }
+
+    if (!Busy()) {
+        return 0;
+    }
+
+    ibv_wc wcs[poll_batch];
+    int total = 0;
+    size_t cq_num = m_cq_num_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < cq_num; ++i) {
+        // Drain in batches until the CQ is empty, or a batch isn't full
+        int rc;
+        do {
+            rc = ibv_poll_cq(m_cqs_[i], poll_batch, wcs);
+            if (UNLIKELY(rc < 0)) {
+                DLOG_ERROR("ibv_poll_cq fail");
+                return -1;
+            }
+            if (rc == 0) {
+                break;
+            }
+
+            m_stats_.polls.fetch_add(1, std::memory_order_relaxed);
+            m_stats_.cqes.fetch_add(rc, std::memory_order_relaxed);
+            uint64_t max_batch = m_stats_.max_batch.load(std::memory_order_relaxed);
+            while (max_batch < static_cast<uint64_t>(rc) &&
+                   !m_stats_.max_batch.compare_exchange_weak(max_batch, rc,
+                                                             std::memory_order_relaxed)) {
+            }
+            total += rc;
+
+            if (UNLIKELY(RDMAConnection::m_acknowledge_sd_cqe_(rc, wcs, &m_stats_) == -1)) {
+                DLOG_ERROR("acknowledge_cqe fail");
+                return -1;
+            }
+        } while (rc == poll_batch);
+    }
+    return total;
+}
+
 }  // namespace rdma_rc
\ No newline at end of file
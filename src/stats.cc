@@ -80,7 +80,9 @@ double Histogram::getAverage() const {
     return S / getTotalCount();
 }
 
-int Histogram::getBucket(double value) const { return (value - m_minValue) / m_bucketWidth; }
+int Histogram::getBucket(double value) const {
+    return std::min<int>((value - m_minValue) / m_bucketWidth, m_numBuckets - 1);
+}
 
 Histogram Histogram::merge(Histogram &other) {
     Histogram nh(std::max(m_numBuckets, other.m_numBuckets), std::min(m_minValue, other.m_maxValue),
@@ -0,0 +1,186 @@
+#include "swap_watermark.hpp"
+
+#include <cmath>
+
+#include "config.hpp"
+#include "log.hpp"
+#include "utils.hpp"
+
+// Watermark multipliers
+constexpr static float watermark_raise_factor = 1.25;
+constexpr static float watermark_lower_factor = 0.8;
+constexpr static float watermark_probe_factor = 0.95;
+
+// Swap-back ratio over which swaps are considered as ping-pong
+constexpr static double swap_back_high_ratio = 0.25;
+constexpr static double swap_back_low_ratio = 0.05;
+// Saved direct io bytes per swapped byte under which swaps don't pay back
+constexpr static double swap_gain_low = 1;
+constexpr static double swap_gain_high = 4;
+
+void SwapWatermarkController::RackStats::Accrue(uint64_t now_us) {
+    if (now_us > last_accrue_us) {
+        saved_dio += resident_dio_rate * (now_us - last_accrue_us);
+        last_accrue_us = now_us;
+    }
+}
+
+void SwapWatermarkController::RackStats::RemoveRate(double dio_rate, uint64_t until_us) {
+    if (until_us >= last_accrue_us) {
+        Accrue(until_us);
+    } else {
+        // Already credited beyond `until_us`, take back the surplus
+        saved_dio -= dio_rate * (last_accrue_us - until_us);
+    }
+    resident_dio_rate = std::max(0.0, resident_dio_rate - dio_rate);
+}
+
+void SwapWatermarkController::Init(const rcmp::DaemonOptions &options) {
+    m_enable = options.adaptive_swap_watermark;
+    m_init_watermark = options.hot_swap_watermark;
+    m_min_watermark = options.min_hot_swap_watermark;
+    m_max_watermark = options.max_hot_swap_watermark;
+    m_half_life_us = options.heat_half_life_us;
+    m_swap_back_window_us = options.swap_back_window_us;
+
+    // The bounds only apply to the adapted watermarks, a fixed one can be anything
+    if (m_enable) {
+        DLOG_ASSERT(m_min_watermark <= m_init_watermark && m_init_watermark <= m_max_watermark,
+                    "hot_swap_watermark %f is out of bound [%f, %f]", m_init_watermark,
+                    m_min_watermark, m_max_watermark);
+    }
+}
+
+SwapWatermarkController::RackStats *SwapWatermarkController::AddRack(rack_id_t rack_id) {
+    std::unique_lock<SharedMutex> lck(m_rack_lck);
+    auto &rack_stats = m_rack_table[rack_id];
+    if (rack_stats == nullptr) {
+        rack_stats = std::make_unique<RackStats>();
+        rack_stats->rack_id = rack_id;
+        rack_stats->watermark = m_init_watermark;
+        rack_stats->last_accrue_us = getUsTimestamp();
+    }
+    return rack_stats.get();
+}
+
+void SwapWatermarkController::RecordSwapIn(RackStats *rack_stats, page_id_t page_id, float heat,
+                                           size_t page_bytes, bool with_swapout) {
+    if (!m_enable) {
+        return;
+    }
+
+    uint64_t now_us = getUsTimestamp();
+    // The heat is a exponential decayed count, whose steady value is `rate * half_life / ln2`.
+    double dio_rate = heat * M_LN2 / m_half_life_us;
+
+    std::lock_guard<SpinMutex> page_lck(m_page_lck);
+    m_swapped_pages[page_id] = {rack_stats, dio_rate, now_us};
+    m_swapin_queue.push_back({page_id, now_us});
+
+    std::lock_guard<SpinMutex> rack_lck(rack_stats->lck);
+    rack_stats->Accrue(now_us);
+    rack_stats->resident_dio_rate += dio_rate;
+    rack_stats->swap_cnt++;
+    rack_stats->swap_cost_bytes += page_bytes * (with_swapout ? 2 : 1);
+}
+
+void SwapWatermarkController::erasePage(page_id_t page_id, bool swap_out) {
+    if (!m_enable) {
+        return;
+    }
+
+    std::lock_guard<SpinMutex> page_lck(m_page_lck);
+    auto it = m_swapped_pages.find(page_id);
+    if (it == m_swapped_pages.end()) {
+        return;
+    }
+
+    SwapRecord &record = it->second;
+    std::lock_guard<SpinMutex> rack_lck(record.rack_stats->lck);
+    record.rack_stats->RemoveRate(record.dio_rate, getUsTimestamp());
+    if (swap_out) {
+        record.rack_stats->swap_back_cnt++;
+    }
+    m_swapped_pages.erase(it);
+}
+
+void SwapWatermarkController::Adjust() {
+    if (!m_enable) {
+        return;
+    }
+
+    uint64_t now_us = getUsTimestamp();
+
+    /* 1. Stop crediting the pages staying over the window */
+    {
+        std::lock_guard<SpinMutex> page_lck(m_page_lck);
+        while (!m_swapin_queue.empty() &&
+               m_swapin_queue.front().second + m_swap_back_window_us <= now_us) {
+            auto p = m_swapin_queue.front();
+            m_swapin_queue.pop_front();
+
+            auto it = m_swapped_pages.find(p.first);
+            if (it == m_swapped_pages.end() || it->second.swapin_us != p.second) {
+                continue;
+            }
+
+            SwapRecord &record = it->second;
+            std::lock_guard<SpinMutex> rack_lck(record.rack_stats->lck);
+            record.rack_stats->RemoveRate(record.dio_rate, p.second + m_swap_back_window_us);
+            m_swapped_pages.erase(it);
+        }
+    }
+
+    /* 2. Adjust the watermark of each rack */
+    std::shared_lock<SharedMutex> lck(m_rack_lck);
+    for (auto &p : m_rack_table) {
+        RackStats *rack_stats = p.second.get();
+
+        uint64_t dio_cnt = rack_stats->dio_cnt.exchange(0, std::memory_order_relaxed);
+        uint64_t dio_bytes = rack_stats->dio_bytes.exchange(0, std::memory_order_relaxed);
+        uint64_t swap_cnt, swap_back_cnt, swap_cost_bytes;
+        double saved_bytes;
+        {
+            std::lock_guard<SpinMutex> rack_lck(rack_stats->lck);
+            rack_stats->Accrue(now_us);
+            if (dio_cnt > 0) {
+                rack_stats->avg_dio_bytes = 1.0 * dio_bytes / dio_cnt;
+            }
+
+            swap_cnt = rack_stats->swap_cnt;
+            swap_back_cnt = rack_stats->swap_back_cnt;
+            swap_cost_bytes = rack_stats->swap_cost_bytes;
+            saved_bytes = std::max(0.0, rack_stats->saved_dio) * rack_stats->avg_dio_bytes;
+
+            rack_stats->swap_cnt = 0;
+            rack_stats->swap_back_cnt = 0;
+            rack_stats->swap_cost_bytes = 0;
+            rack_stats->saved_dio = 0;
+        }
+
+        float old_watermark = rack_stats->watermark.load(std::memory_order_relaxed);
+        float new_watermark = old_watermark;
+        if (swap_cnt > 0) {
+            double swap_back_ratio = 1.0 * swap_back_cnt / swap_cnt;
+            double gain = saved_bytes / swap_cost_bytes;
+            if (swap_back_ratio > swap_back_high_ratio || gain < swap_gain_low) {
+                new_watermark = old_watermark * watermark_raise_factor;
+            } else if (swap_back_ratio < swap_back_low_ratio && gain > swap_gain_high) {
+                new_watermark = old_watermark * watermark_lower_factor;
+            }
+        } else if (dio_cnt > 0) {
+            // No swap happened but the rack is still accessed remotely, probe a lower watermark.
+            new_watermark = old_watermark * watermark_probe_factor;
+        }
+        new_watermark = std::min(m_max_watermark, std::max(m_min_watermark, new_watermark));
+        rack_stats->watermark.store(new_watermark, std::memory_order_relaxed);
+
+        if (swap_cnt > 0 || dio_cnt > 0) {
+            DLOG(
+                "rack %u: direct io: %lu, swap: %lu, swap back: %lu, saved: %f KB, swap cost: %f "
+                "KB, watermark: %f -> %f",
+                rack_stats->rack_id, dio_cnt, swap_cnt, swap_back_cnt, saved_bytes / 1024,
+                1.0 * swap_cost_bytes / 1024, old_watermark, new_watermark);
+        }
+    }
+}
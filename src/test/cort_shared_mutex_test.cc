@@ -0,0 +1,111 @@
+#include <atomic>
+#include <boost/fiber/fiber.hpp>
+#include <boost/fiber/operations.hpp>
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lock.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+const int TH = 4;
+const int FB = 8;
+const int IT = 100000;
+
+// A reader queued after a waiting writer must not pass it, even though the lock is still shared.
+void check_writer_preference() {
+    CortSharedMutex m;
+    string order;
+
+    m.lock_shared();
+
+    boost::fibers::fiber writer([&]() {
+        m.lock();
+        order += 'W';
+        m.unlock();
+    });
+    boost::this_fiber::yield();
+    assert(order.empty());
+    assert(!m.try_lock_shared());
+
+    boost::fibers::fiber reader([&]() {
+        m.lock_shared();
+        order += 'R';
+        m.unlock_shared();
+    });
+    boost::this_fiber::yield();
+    assert(order.empty());
+
+    m.unlock_shared();
+    writer.join();
+    reader.join();
+    assert(order == "WR");
+}
+
+// Fibers on several threads take the lock shared or exclusive at random. A writer must be alone
+// in the lock, and readers must never see a half done write.
+void check_exclusion() {
+    CortSharedMutex m;
+    atomic<int> writers{0};
+    atomic<int> readers{0};
+    uint64_t a = 0, b = 0;
+    atomic<uint64_t> write_cnt{0};
+
+    vector<thread> vs;
+    for (int t = 0; t < TH; ++t) {
+        vs.emplace_back([&, t]() {
+            vector<boost::fibers::fiber> fibers;
+            for (int f = 0; f < FB; ++f) {
+                fibers.emplace_back([&, seed = t * FB + f]() {
+                    uint64_t x = seed;
+                    for (int i = 0; i < IT; ++i) {
+                        x = x * 6364136223846793005ul + 1442695040888963407ul;
+                        if ((x >> 60) == 0) {
+                            m.lock();
+                            assert(writers.fetch_add(1) == 0 && readers.load() == 0);
+                            a++;
+                            boost::this_fiber::yield();
+                            b++;
+                            writers.fetch_sub(1);
+                            m.unlock();
+                            write_cnt++;
+                        } else {
+                            m.lock_shared();
+                            readers.fetch_add(1);
+                            assert(writers.load() == 0 && a == b);
+                            if ((x >> 56) == 0xff) {
+                                boost::this_fiber::yield();
+                            }
+                            readers.fetch_sub(1);
+                            m.unlock_shared();
+                        }
+                    }
+                });
+            }
+            for (auto &f : fibers) {
+                f.join();
+            }
+        });
+    }
+    for (auto &t : vs) {
+        t.join();
+    }
+
+    assert(a == write_cnt && b == write_cnt);
+    assert(m.try_lock());
+    m.unlock();
+}
+
+int main() {
+    check_writer_preference();
+
+    uint64_t _s = getUsTimestamp();
+    check_exclusion();
+    cout << getUsTimestamp() - _s << " us" << endl;
+
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <thread>
+
+#include "allocator.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+// The previous IDGenerator, a linearly scanned std::vector<bool> under one lock.
+class LegacyIDGenerator {
+   public:
+    using id_t = uint64_t;
+
+    id_t Gen() {
+        lock_guard<Mutex> guard(m_lck);
+        size_t cur_tmp = m_gen_cur;
+        do {
+            size_t cur = m_gen_cur;
+            m_gen_cur = (m_gen_cur + 1) % m_bset.size();
+            if (m_bset[cur] == false) {
+                m_bset[cur] = true;
+                return cur;
+            }
+        } while (cur_tmp != m_gen_cur);
+        return -1;
+    }
+
+    id_t MultiGen(size_t count) {
+        lock_guard<Mutex> guard(m_lck);
+        id_t start = -1;
+        size_t c = 0;
+        size_t cur_tmp = m_gen_cur;
+        do {
+            size_t cur = m_gen_cur;
+            m_gen_cur = (m_gen_cur + 1) % m_bset.size();
+            if (m_bset[cur] == false) {
+                if (c == 0) {
+                    start = cur;
+                }
+                if (++c == count) {
+                    for (size_t k = start; k < start + count; ++k) {
+                        m_bset[k] = true;
+                    }
+                    return start;
+                }
+            } else {
+                c = 0;
+            }
+            if (m_gen_cur == 0) {
+                c = 0;
+            }
+        } while (cur_tmp != m_gen_cur);
+        return -1;
+    }
+
+    void Recycle(id_t id) {
+        lock_guard<Mutex> guard(m_lck);
+        m_bset[id] = false;
+    }
+
+    void MultiRecycle(id_t id, size_t count) {
+        lock_guard<Mutex> guard(m_lck);
+        for (size_t k = id; k < id + count; ++k) {
+            m_bset[k] = false;
+        }
+    }
+
+    void Expand(size_t n) { m_bset.insert(m_bset.end(), n, false); }
+
+   private:
+    size_t m_gen_cur = 0;
+    vector<bool> m_bset;
+    Mutex m_lck;
+};
+
+const size_t CAPACITY = 1 << 20;
+const size_t IT = 1000000;
+
+// Threads take ids concurrently: no id is handed out twice, and every recycled id comes back.
+void check_gen_recycle() {
+    const size_t cap = 1 << 16;
+    const int thread_num = 8;
+    IDGenerator g;
+    g.Expand(cap);
+
+    for (int round = 0; round < 2; ++round) {
+        vector<atomic<bool>> taken(cap);
+        vector<thread> vs;
+        for (int i = 0; i < thread_num; i++) {
+            vs.emplace_back([&, i]() {
+                mt19937 rng(i);
+                vector<IDGenerator::id_t> held;
+                // Churn a few ids, then keep a share of the pool
+                for (size_t a = 0; a < cap / thread_num; ++a) {
+                    IDGenerator::id_t id = g.Gen();
+                    assert(id != -1 && id < cap);
+                    bool was_taken = taken[id].exchange(true);
+                    assert(!was_taken);
+                    if (rng() % 4 == 0) {
+                        taken[id] = false;
+                        g.Recycle(id);
+                    } else {
+                        held.push_back(id);
+                    }
+                }
+                while (held.size() < cap / thread_num) {
+                    IDGenerator::id_t id = g.Gen();
+                    assert(id != -1);
+                    bool was_taken = taken[id].exchange(true);
+                    assert(!was_taken);
+                    held.push_back(id);
+                }
+                if (round == 0) {
+                    for (auto id : held) {
+                        taken[id] = false;
+                        g.Recycle(id);
+                    }
+                }
+            });
+        }
+        for (auto &th : vs) {
+            th.join();
+        }
+        if (round == 0) {
+            // All ids are back, including those cached in magazines
+            assert(g.size() == 0);
+        }
+    }
+
+    // The whole pool is handed out
+    assert(g.size() == cap && g.full());
+    assert(g.Gen() == -1);
+    assert(g.MultiGen(2) == -1);
+}
+
+// Runs are aligned and disjoint, also across `Expand`, and freed runs are found again.
+void check_multi_gen() {
+    IDGenerator g;
+    g.Expand(1000);
+    vector<bool> used(1000 + 4096, false);
+    auto take = [&](size_t count, size_t align) {
+        IDGenerator::id_t start = g.MultiGen(count, align);
+        if (start != -1) {
+            assert(start % align == 0 && start + count <= g.capacity());
+            for (size_t i = 0; i < count; ++i) {
+                assert(!used[start + i]);
+                used[start + i] = true;
+            }
+        }
+        return start;
+    };
+
+    assert(take(1, 1) == 0);
+    assert(take(16, 16) != -1);
+    assert(take(100, 1) != -1);
+    // The only aligned run of 512 in 1000 ids starts at the used id 0
+    assert(take(512, 512) == -1);
+
+    g.Expand(4096);
+    assert(take(512, 512) != -1);
+    IDGenerator::id_t big = take(2048, 2048);
+    assert(big == 2048);
+    assert(take(64, 64) != -1);
+
+    g.MultiRecycle(big, 2048);
+    for (size_t i = 0; i < 2048; ++i) {
+        used[big + i] = false;
+    }
+    assert(take(2048, 2048) == big);
+    assert(take(4096, 1) == -1);
+}
+
+// Fill the pool to 90% and free every other id, then churn single ids from several threads.
+template <typename G>
+double bench_single(G &g, int thread_num) {
+    vector<typename G::id_t> held;
+    for (size_t i = 0; i < CAPACITY * 9 / 10; ++i) {
+        held.push_back(g.Gen());
+    }
+    for (size_t i = 0; i < held.size(); i += 2) {
+        g.Recycle(held[i]);
+    }
+
+    uint64_t _s = getUsTimestamp();
+    vector<thread> vs;
+    for (int i = 0; i < thread_num; i++) {
+        vs.emplace_back([&]() {
+            vector<typename G::id_t> ids(16);
+            for (size_t a = 0; a < IT; a += ids.size()) {
+                for (auto &id : ids) {
+                    id = g.Gen();
+                    DLOG_ASSERT(id != -1);
+                }
+                for (auto id : ids) {
+                    g.Recycle(id);
+                }
+            }
+        });
+    }
+    for (auto &th : vs) {
+        th.join();
+    }
+    return 1.0 * thread_num * IT * 2 / (getUsTimestamp() - _s);
+}
+
+// Fragment a fully allocated pool with short free runs and a few long ones, then allocate runs
+// of 64 ids.
+template <typename G>
+double bench_multi(G &g) {
+    g.MultiGen(CAPACITY);
+    mt19937 rng(0);
+    for (size_t b = 0; b < CAPACITY; b += 256) {
+        size_t len = (b % (256 * 64) == 0) ? 128 : 48;
+        g.MultiRecycle(b + rng() % (256 - len), len);
+    }
+
+    const size_t count = 64;
+    const size_t it = 10000;
+    uint64_t _s = getUsTimestamp();
+    for (size_t a = 0; a < it; ++a) {
+        auto id = g.MultiGen(count);
+        DLOG_ASSERT(id != -1);
+        g.MultiRecycle(id, count);
+    }
+    return 1.0 * it * 2 / (getUsTimestamp() - _s);
+}
+
+int main() {
+    check_gen_recycle();
+    check_multi_gen();
+
+    for (int thread_num : {1, 8}) {
+        LegacyIDGenerator lg;
+        lg.Expand(CAPACITY);
+        IDGenerator g;
+        g.Expand(CAPACITY);
+        cout << "Gen/Recycle " << thread_num << " threads: legacy " << bench_single(lg, thread_num)
+             << " Mops, bitmap " << bench_single(g, thread_num) << " Mops" << endl;
+    }
+
+    LegacyIDGenerator lg;
+    lg.Expand(CAPACITY);
+    IDGenerator g;
+    g.Expand(CAPACITY);
+    cout << "MultiGen/MultiRecycle fragmented: legacy " << bench_multi(lg) << " Mops, bitmap "
+         << bench_multi(g) << " Mops" << endl;
+    return 0;
+}
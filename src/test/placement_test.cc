@@ -0,0 +1,120 @@
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "options.hpp"
+#include "placement.hpp"
+
+using namespace std;
+
+using Candidate = PlacementPolicy::Candidate;
+
+const size_t IT = 100000;
+const size_t RACK_NUM = 8;
+
+vector<Candidate> make_candidates(mt19937 &rng, size_t max_free) {
+    vector<Candidate> candidates;
+    for (size_t i = 0; i < RACK_NUM; ++i) {
+        Candidate c;
+        c.rack_table = nullptr;
+        // Some racks are full
+        c.free_page_num = (rng() % 4 == 0) ? 0 : rng() % (max_free + 1);
+        c.dio_rate = rng() % 4 == 0 ? 0 : (rng() % 4) * (1ul << 30);
+        c.swap_rate = rng() % 4 == 0 ? 0 : rng() % 4000;
+        c.distance = 1 + rng() % 2;
+        candidates.push_back(c);
+    }
+    return candidates;
+}
+
+// Every page placed is on a rack that holds it, and all pages are placed if the racks hold them
+void check_place(PlacementPolicy &policy, mt19937 &rng, size_t max_free, size_t max_count) {
+    for (size_t it = 0; it < IT; ++it) {
+        vector<Candidate> candidates = make_candidates(rng, max_free);
+        size_t count = 1 + rng() % max_count;
+
+        size_t capacity = 0;
+        for (auto &c : candidates) {
+            capacity += c.free_page_num;
+        }
+
+        size_t placed = policy.Place(candidates, count);
+
+        size_t S = 0;
+        for (auto &c : candidates) {
+            assert(c.alloc_cnt <= c.free_page_num);
+            S += c.alloc_cnt;
+        }
+        assert(S == placed);
+        assert(placed == min(count, capacity));
+    }
+}
+
+// First fit fills the racks in order, as the master did before policies
+void check_first_fit_order(PlacementPolicy &policy, mt19937 &rng) {
+    for (size_t it = 0; it < IT; ++it) {
+        vector<Candidate> candidates = make_candidates(rng, 64);
+        size_t count = 1 + rng() % 256;
+
+        size_t placed = policy.Place(candidates, count);
+
+        size_t rest = count;
+        for (auto &c : candidates) {
+            assert(c.alloc_cnt == min(rest, c.free_page_num));
+            rest -= c.alloc_cnt;
+        }
+        assert(placed == count - rest);
+    }
+}
+
+// Small allocations still spread over the racks instead of piling on the heaviest one
+void check_weighted_spread(PlacementPolicy &policy) {
+    vector<size_t> hits(RACK_NUM, 0);
+    for (size_t it = 0; it < IT; ++it) {
+        vector<Candidate> candidates(RACK_NUM);
+        for (auto &c : candidates) {
+            c.rack_table = nullptr;
+            c.free_page_num = 1024;
+            c.dio_rate = 0;
+            c.swap_rate = 0;
+            c.distance = 1;
+        }
+        size_t placed = policy.Place(candidates, 1);
+        assert(placed == 1);
+        for (size_t i = 0; i < RACK_NUM; ++i) {
+            hits[i] += candidates[i].alloc_cnt;
+        }
+    }
+    for (size_t i = 0; i < RACK_NUM; ++i) {
+        assert(hits[i] > IT / RACK_NUM / 2);
+    }
+}
+
+int main() {
+    mt19937 rng(0);
+
+    rcmp::MasterOptions options;
+    options.rack_group_size = 4;
+
+    options.placement_policy = "weighted";
+    auto weighted = PlacementPolicy::Create(options);
+    assert(weighted->RackDistance(1, 3) == 1 && weighted->RackDistance(3, 4) == 2);
+    // Few free pages against large requests leaves the racks full
+    check_place(*weighted, rng, 16, 256);
+    check_place(*weighted, rng, 1024, 256);
+    check_weighted_spread(*weighted);
+
+    options.placement_policy = "first_fit";
+    auto first_fit = PlacementPolicy::Create(options);
+    check_place(*first_fit, rng, 16, 256);
+    check_place(*first_fit, rng, 1024, 256);
+    check_first_fit_order(*first_fit, rng);
+
+    options.rack_group_size = 0;
+    assert(PlacementPolicy::Create(options)->RackDistance(0, 100) == 1);
+
+    cout << "ok" << endl;
+
+    return 0;
+}
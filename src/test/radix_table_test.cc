@@ -0,0 +1,123 @@
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "epoch.hpp"
+#include "radix_table.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+struct Node {
+    uint64_t key;
+    atomic<bool> reclaimed{false};
+};
+
+const int WT = 4;
+const int RT = 4;
+// Keys are a leaf apart, so lookups walk many leaves under two mid nodes
+const uint64_t KEY_NUM = 1 << 13;
+const uint64_t KEY_STRIDE = 1 << 12;
+const size_t IT = 200000;
+
+// Writers insert, erase and retire the nodes of their own keys, while readers look up any key
+// under a guard. A node a reader finds must still be mapped to its key and never reclaimed.
+int main() {
+    RadixTable<uint64_t, Node *> table;
+    EpochManager epoch_mgr;
+
+    // Reclaimed nodes are kept to catch a reader seeing one, and freed at the end
+    mutex graveyard_lck;
+    vector<Node *> graveyard;
+
+    atomic<bool> over{false};
+    atomic<size_t> hits{0};
+    vector<thread> vs;
+    for (int i = 0; i < WT; ++i) {
+        vs.emplace_back([&, i]() {
+            mt19937 rng(i);
+            for (size_t a = 0; a < IT; ++a) {
+                uint64_t key = ((rng() % (KEY_NUM / WT)) * WT + i) * KEY_STRIDE;
+                Node *node = table.find(key);
+                if (node == nullptr) {
+                    Node *new_node = new Node();
+                    new_node->key = key;
+                    auto p = table.insert(key, new_node);
+                    assert(p.second && p.first == new_node);
+                    // The key is owned by this writer, so a second insert must fail
+                    auto q = table.insert(key, new_node);
+                    assert(!q.second && q.first == new_node);
+                } else {
+                    assert(node->key == key);
+                    bool erased = table.erase(key, node);
+                    assert(erased);
+                    // Erasing an unmapped node fails
+                    erased = table.erase(key, node);
+                    assert(!erased);
+                    epoch_mgr.Retire([&, node]() {
+                        node->reclaimed.store(true);
+                        lock_guard<mutex> lck(graveyard_lck);
+                        graveyard.push_back(node);
+                    });
+                }
+            }
+        });
+    }
+    for (int i = 0; i < RT; ++i) {
+        vs.emplace_back([&, i]() {
+            mt19937 rng(WT + i);
+            while (!over) {
+                EpochGuard guard(epoch_mgr);
+                uint64_t key = (rng() % KEY_NUM) * KEY_STRIDE;
+                Node *node = table.find(key);
+                if (node != nullptr) {
+                    assert(node->key == key);
+                    assert(!node->reclaimed.load());
+                    hits++;
+                }
+            }
+        });
+    }
+
+    uint64_t _s = getUsTimestamp();
+
+    for (int i = 0; i < WT; ++i) {
+        vs[i].join();
+    }
+    over = true;
+    for (int i = WT; i < WT + RT; ++i) {
+        vs[i].join();
+    }
+
+    // With no guard left, every retired node is reclaimed
+    epoch_mgr.Reclaim();
+
+    size_t mapped = 0;
+    for (uint64_t k = 0; k < KEY_NUM; ++k) {
+        uint64_t key = k * KEY_STRIDE;
+        Node *node = table.find(key);
+        if (node != nullptr) {
+            assert(node->key == key && !node->reclaimed.load());
+            bool erased = table.erase(key, node);
+            assert(erased);
+            delete node;
+            mapped++;
+        }
+    }
+    assert(table.size() == 0);
+    // Each step inserts or erases a node
+    assert(mapped + 2 * graveyard.size() == IT * WT);
+
+    cout << "mapped " << mapped << ", reclaimed " << graveyard.size() << ", reader hits " << hits
+         << ", " << getUsTimestamp() - _s << " us" << endl;
+
+    for (Node *node : graveyard) {
+        delete node;
+    }
+
+    return 0;
+}
@@ -87,9 +87,11 @@ void MasterContext::InitRPCNexus() {
     erpc::SMHandlerWrap smhw;
     smhw.set_empty();
 
-    erpc::IBRpcWrap rpc(m_erpc_ctx.nexus.get(), &MasterContext::getInstance(), 0, smhw);
-    m_erpc_ctx.rpc_set.push_back(std::move(rpc));
-    DLOG_ASSERT(m_erpc_ctx.rpc_set.size() == 1);
+    auto shard = std::make_unique<MasterShard>();
+    shard->shard_id = 0;
+    shard->rpc = std::make_unique<erpc::IBRpcWrap>(m_erpc_ctx.nexus.get(), this, 0, smhw);
+    m_local_shard = shard.get();
+    m_shards.push_back(std::move(shard));
 }
 
 void DaemonContext::InitRPCNexus() {
@@ -100,9 +102,11 @@ void DaemonContext::InitRPCNexus() {
     erpc::SMHandlerWrap smhw;
     smhw.set_empty();
 
-    erpc::IBRpcWrap rpc(m_erpc_ctx.nexus.get(), this, 0, smhw);
-    m_erpc_ctx.rpc_set.push_back(std::move(rpc));
-    DLOG_ASSERT(m_erpc_ctx.rpc_set.size() == 1);
+    auto worker = std::make_unique<DaemonWorker>();
+    worker->worker_id = 0;
+    worker->rpc = std::make_unique<erpc::IBRpcWrap>(m_erpc_ctx.nexus.get(), this, 0, smhw);
+    m_local_worker = worker.get();
+    m_workers.push_back(std::move(worker));
 }
 
 void DaemonContext::ConnectWithMaster() {
@@ -110,10 +114,10 @@ void DaemonContext::ConnectWithMaster() {
 
     auto& master_connection = m_conn_manager.GetMasterConnection();
 
-    master_connection.erpc_conn =
-        std::make_unique<ErpcClient>(rpc, m_options.master_ip, m_options.master_port);
+    master_connection.ip = m_options.master_ip;
+    master_connection.port = m_options.master_port;
 
-    auto fu = master_connection.erpc_conn->call<SpinPromise>(joinDaemon, {});
+    auto fu = master_connection.GetErpcConn().call<SpinPromise>(joinDaemon, {});
 
     while (fu.wait_for(1ns) == std::future_status::timeout) {
         rpc.run_event_loop_once();
@@ -121,8 +125,6 @@ void DaemonContext::ConnectWithMaster() {
 
     auto& resp = fu.get();
 
-    master_connection.ip = m_options.master_ip;
-    master_connection.port = m_options.master_port;
     master_connection.master_id = resp.master_mac_id;
     m_daemon_id = resp.daemon_mac_id;
 
@@ -205,7 +207,8 @@ int main(int argc, char* argv[]) {
                     req.data[rand() % sizeof(req.data)] = getUsTimestamp();
 
                     auto fu = daemon_context.m_conn_manager.GetMasterConnection()
-                                  .erpc_conn->call<CortPromise>(dummy, std::move(req));
+                                  .GetErpcConn()
+                                  .call<CortPromise>(dummy, std::move(req));
 
                     auto& resp = fu.get();
 
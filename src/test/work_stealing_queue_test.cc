@@ -0,0 +1,93 @@
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "concurrent_queue.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+using WSQ = WorkStealingQueue<size_t *, 1024>;
+
+const int ST = 4;
+const size_t IT = 4000000;
+
+// The owner pushes every task and pops some of them back, while thieves steal from the top. Each
+// task must be taken exactly once.
+int main() {
+    WSQ q;
+    vector<size_t> tasks(IT);
+    vector<atomic<uint8_t>> taken(IT);
+    for (size_t i = 0; i < IT; ++i) {
+        tasks[i] = i;
+        taken[i].store(0);
+    }
+
+    auto take = [&](size_t *task) {
+        uint8_t n = taken[*task].fetch_add(1);
+        assert(n == 0);
+    };
+
+    atomic<bool> over{false};
+    vector<size_t> steals(ST, 0);
+    vector<thread> vs;
+    for (int i = 0; i < ST; ++i) {
+        vs.emplace_back([&, i]() {
+            size_t *task;
+            while (!over) {
+                if (q.TrySteal(&task)) {
+                    take(task);
+                    steals[i]++;
+                }
+            }
+        });
+    }
+
+    uint64_t _s = getUsTimestamp();
+
+    size_t pops = 0;
+    size_t *task;
+    for (size_t i = 0; i < IT; ++i) {
+        while (!q.TryPush(&tasks[i])) {
+            // Full, the owner drains its own bottom
+            if (q.TryPop(&task)) {
+                take(task);
+                pops++;
+            }
+        }
+        // Pop every few pushes, so the owner often races the thieves for the last task
+        if (i % 3 == 0 && q.TryPop(&task)) {
+            take(task);
+            pops++;
+        }
+    }
+    while (!q.empty()) {
+        if (q.TryPop(&task)) {
+            take(task);
+            pops++;
+        }
+    }
+
+    over = true;
+    for (auto &t : vs) {
+        t.join();
+    }
+
+    assert(!q.TryPop(&task) && !q.TrySteal(&task));
+
+    size_t S = pops;
+    for (auto n : steals) {
+        S += n;
+    }
+    assert(S == IT);
+    for (size_t i = 0; i < IT; ++i) {
+        assert(taken[i].load() == 1);
+    }
+
+    cout << "pops " << pops << ", steals " << S - pops << ", " << getUsTimestamp() - _s << " us"
+         << endl;
+
+    return 0;
+}
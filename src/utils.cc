@@ -1,9 +1,12 @@
 #include "utils.hpp"
 
 #include <pthread.h>
+#include <linux/futex.h>
 #include <sched.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 
+#include <cerrno>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
@@ -38,6 +41,19 @@ uint64_t getNsTimestamp() {
     return tp.tv_sec * 1e9 + tp.tv_nsec;
 }
 
+bool futexWait(std::atomic<uint32_t> *addr, uint32_t expected, uint64_t timeout_us) {
+    struct timespec ts;
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+    long ret = syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT, expected, &ts,
+                       nullptr, 0);
+    return ret == 0 || errno != ETIMEDOUT;
+}
+
+void futexWake(std::atomic<uint32_t> *addr, int n) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE, n, nullptr, nullptr, 0);
+}
+
 IPv4String::IPv4String(const std::string &ip) { strcpy(raw.ipstr, ip.c_str()); }
 IPv4String &IPv4String::operator=(const std::string &ip) {
     strcpy(raw.ipstr, ip.c_str());